@@ -16,8 +16,9 @@
  See the License for the specific language governing permissions and
  limitations under the License.
 */
-try
-{
+/* PRELUDE: compiled once and run before every page by the native page
+            driver (jst_run_page), which also calls _jst_finish */
+
 /* HEADERS: accumulate headers into a buffer
             to send to stdout in _jst_finish*/
 _jst_header_content_type_set = false;
@@ -43,13 +44,16 @@ function header(str)
   }
 }
 
-/* ECHO: accumulate main content into a buffer
-         to send to stdout in _jst_finish */
-_jst_echo_buffer = "";
-function echo(str)
+/* ECHO: echo(), _jst_echo() and _jst_static() are native (jst_output.c)
+         and accumulate the content in a buffer sent in _jst_finish */
+
+/* PREFETCH: the parser starts a run page with a call listing the data
+             model parameters it reads with getStr("literal"); they are
+             fetched in a few bus calls before the page runs */
+function _jst_prefetch(names)
 {
-   str = (typeof(str)!="undefined") ? str : "";
-  _jst_echo_buffer += str;
+  if(typeof ccsp_cosa != "undefined" && ccsp_cosa.prefetch)
+    ccsp_cosa.prefetch(names);
 }
 
 /* FINISH: _jst_finish is called at the very end of the script 
@@ -58,12 +62,12 @@ function _jst_finish()
 {
   if(!_jst_header_content_type_set)
     print("Content-type: text/html\r");
-  print(_jst_header_buffer + "\r\n" + _jst_echo_buffer);
+  _jst_flush(_jst_header_buffer + "\r\n");
 }
 
 /* EXIT: there is no way to simply quit in the middle of a script, so
-         we throw an exception which will be caught in ccsp_builtin_suffix.js
-         and that will call _jst_finish to write our content */
+         we throw an exception which the page driver catches before it
+         calls _jst_finish to write our content */
 function _jst_exit_exception(code)
 {
   this._jst_exit_code = code;
@@ -178,58 +182,82 @@ function session_print()
     print($k + "=" + $_jst_session[$k]);
 }
 
+/* LAZY GLOBALS: computed on first access, so a page that never looks at
+   $_POST/$_FILES never reads or parses the request body */
+function _jst_lazy_global(global, name, init)
+{
+  function define(value)
+  {
+    Object.defineProperty(global, name, { value: value, writable: true, enumerable: true, configurable: true });
+  }
+  Object.defineProperty(global, name, {
+    get: function() { var value = init(); define(value); return value; },
+    set: define,
+    enumerable: true,
+    configurable: true
+  });
+}
+
 /* POST: post data sent in via stdin */
-$_POST={};
-var postData = ccsp_post.getPost();
-if(postData)
+_jst_lazy_global(this, "$_POST", function()
 {
-  var postValues = postData.split('&');
-  for(var i = 0; i < postValues.length; ++i)
+  var post = {};
+  var postData = ccsp_post.getPost();
+  if(postData)
   {
-    var postValue = postValues[i].split('=');
-    if(postValue.length == 2)
+    var postValues = postData.split('&');
+    for(var i = 0; i < postValues.length; ++i)
     {
-      var value = postValue[1].replace(/[+]/g," ");
-      $_POST[postValue[0]] = decodeURIComponent(value);
-    }
-    else
-    {
-      print("unexpected post data");
-      $_val_input = 1;
+      var postValue = postValues[i].split('=');
+      if(postValue.length == 2)
+      {
+        var value = postValue[1].replace(/[+]/g," ");
+        post[postValue[0]] = decodeURIComponent(value);
+      }
+      else
+      {
+        print("unexpected post data");
+        $_val_input = 1;
+      }
     }
   }
-}
+  return post;
+});
 
 /* FILES: multipart/form-data files via stdin */
-$_FILES={};
-var filesData = ccsp_post.getFiles();
-if(filesData)
+_jst_lazy_global(this, "$_FILES", function()
 {
-  var fileList = filesData.split(';');
-  for(var i = 0; i < fileList.length; ++i)
+  var files = {};
+  var filesData = ccsp_post.getFiles();
+  if(filesData)
   {
-    var fileData = fileList[i].split('&');
-    var fileId = null;
-    for(var j = 0; j < fileData.length; ++j)
+    var fileList = filesData.split(';');
+    for(var i = 0; i < fileList.length; ++i)
     {
-      var fileValue = fileData[j].split('=');
-      if(fileValue.length == 2)
+      var fileData = fileList[i].split('&');
+      var fileId = null;
+      for(var j = 0; j < fileData.length; ++j)
       {
-        if(!fileId)
+        var fileValue = fileData[j].split('=');
+        if(fileValue.length == 2)
         {
-          fileId = decodeURIComponent(fileValue[1]);
-          $_FILES[fileId]={};
+          if(!fileId)
+          {
+            fileId = decodeURIComponent(fileValue[1]);
+            files[fileId]={};
+          }
+          else
+          {
+            files[fileId][decodeURIComponent(fileValue[0])]=decodeURIComponent(fileValue[1]);
+          }
         }
         else
-        {
-          $_FILES[fileId][decodeURIComponent(fileValue[0])]=decodeURIComponent(fileValue[1]);
-        }
+          print("unexpected file data");
       }
-      else
-        print("unexpected file data");
     }
   }
-}
+  return files;
+});
 
 /* GET: query parameters */
 $_GET= (function ()
@@ -256,4 +284,3 @@ function include($filepath)
 }
 
 /* begin application code */
-
@@ -102,17 +102,24 @@
 #endif
 
 #include "../jst.h"
+#include "../jst_fastcgi.h"
+#include "../jst_zygote.h"
+#include "../jst_http.h"
+#include "../jst_engine.h"
+#include "../jst_bundle.h"
 #include <unistd.h>
 
 #define  MEM_LIMIT_NORMAL   (128*1024*1024)   /* 128 MB */
 #define  MEM_LIMIT_HIGH     (2047*1024*1024)  /* ~2 GB */
 #define  LINEBUF_SIZE       65536
 
-char* jst_debug_file_name = NULL;
+extern char* jst_debug_file_name;
 
 static int main_argc = 0;
 static char **main_argv = NULL;
 static int interactive_mode = 0;
+static int request_isolation = 0;  /* heap is shared by requests, see handle_file_isolated() */
+static int cgi_profile = 0;  /* --cgi: one-shot page run, skip interactive-only setup */
 #if defined(DUK_CMDLINE_DEBUGGER_SUPPORT)
 static int debugger_reattach = 0;
 #endif
@@ -216,20 +223,6 @@ static void print_pop_error(duk_context *ctx, FILE *f) {
 	duk_pop(ctx);
 }
 
-// Function to generate secure random number
-int generateRandomNumber(int max) {
-    return rand() % (max + 1);
-}
-
-// C function that will be exposed to Duktape
-static duk_ret_t generate_random(duk_context *ctx) {
-    int max = duk_get_int(ctx, 0); // Get the maximum value from JavaScript arguments
-    int randomNumber = generateRandomNumber(max);
-    // Push the random number to the Duktape stack as a JavaScript number
-    duk_push_int(ctx, randomNumber);
-    return 1; // Number of return values
-}
-
 static duk_ret_t wrapped_compile_execute(duk_context *ctx, void *udata) {
 	const char *src_data;
 	duk_size_t src_len;
@@ -563,12 +556,34 @@ static int handle_fh(duk_context *ctx, FILE *f, const char *filename, const char
   if(strlen(filename) > 4 && !strcmp(filename + strlen(filename) - 4, ".jst"))
   {
     //fclose(f);
-    rc = load_template_file(filename, &buf, &bufoff, 1);
+    /* bytecode from the template cache, or the parsed source */
+    rc = load_template_bytecode(ctx, filename, &buf, &bufoff);
     if(!rc )
     {
       fprintf(stderr, "load_template_file failed\n");
       return 0;
     }
+
+    if(bufoff && buf[0] == JST_STATIC_PAGE && bytecode_filename)
+    {
+      fprintf(stderr, "Error: %s has no code to compile\n", filename);
+      goto error;
+    }
+
+    /* run after the prelude, unless only the bytecode is wanted */
+    if(!bytecode_filename)
+    {
+      interactive_mode = 0;  /* global */
+      rc = jst_run_page(ctx, filename, buf, bufoff);
+      free(buf);
+      buf = NULL;
+      if (rc != DUK_EXEC_SUCCESS) {
+        print_pop_error(ctx, stderr);
+        goto error;
+      }
+      duk_pop(ctx);
+      return 0;
+    }
   }
   else
   {
@@ -713,6 +728,14 @@ static int handle_file(duk_context *ctx, const char *filename, const char *bytec
 #endif
 	fnbuf[sizeof(fnbuf) - 1] = (char) 0;
 
+	/* with a site bundle the template source need not be on disk at all;
+	 * handle_fh loads templates by path, never from f
+	 */
+	if (strlen(filename) > 4 && !strcmp(filename + strlen(filename) - 4, ".jst") &&
+	    jst_bundle_active()) {
+		return handle_fh(ctx, NULL, filename, bytecode_filename);
+	}
+
 	f = fopen(fnbuf, "rb");
 	if (!f) {
 		fprintf(stderr, "failed to open source file: %s\n", filename);
@@ -1083,6 +1106,7 @@ static void debugger_detached(duk_context *ctx, void *udata) {
 
 static duk_context *create_duktape_heap(int alloc_provider, int debugger, int lowmem_log) {
 	duk_context *ctx;
+	int cgi;
 
 	(void) lowmem_log;  /* suppress warning */
 
@@ -1167,10 +1191,12 @@ static duk_context *create_duktape_heap(int alloc_provider, int debugger, int lo
 	}
 #endif
 
-	/* Register print() and alert() (removed in Duktape 2.x). */
-#if defined(DUK_CMDLINE_PRINTALERT_SUPPORT)
-	duk_print_alert_init(ctx, 0 /*flags*/);
-#endif
+	/* print/alert, console, logger, require and the static ccsp modules.
+	 * The CGI profile only applies to a heap that runs a single page;
+	 * shared heaps pay for a full setup once.
+	 */
+	cgi = cgi_profile && !request_isolation;
+	jst_heap_init(ctx, cgi ? JST_HEAP_CGI : 0);
 
 	/* Register String.fromBufferRaw() which does a 1:1 buffer-to-string
 	 * coercion needed by testcases.  String.fromBufferRaw() is -not- a
@@ -1178,29 +1204,16 @@ static duk_context *create_duktape_heap(int alloc_provider, int debugger, int lo
 	 * doesn't exist and we create it here; for ROM builds it may be
 	 * present but unwritable (which is ignored).
 	 */
-	duk_eval_string(ctx,
-		"(function(v){"
-		    "if (typeof String === 'undefined') { String = {}; }"
-		    "Object.defineProperty(String, 'fromBufferRaw', {value:v, configurable:true});"
-		"})");
-	duk_push_c_function(ctx, string_frombufferraw, 1 /*nargs*/);
-	(void) duk_pcall(ctx, 1);
-	duk_pop(ctx);
-
-	/* Register console object. */
-#if defined(DUK_CMDLINE_CONSOLE_SUPPORT)
-	duk_console_init(ctx, DUK_CONSOLE_PROXY_WRAPPER | DUK_CONSOLE_FLUSH /*flags*/);
-#endif
-
-	/* Register Duktape.Logger (removed in Duktape 2.x). */
-#if defined(DUK_CMDLINE_LOGGING_SUPPORT)
-	duk_logging_init(ctx, 0 /*flags*/);
-#endif
-
-	/* Register require() (removed in Duktape 2.x). */
-#if defined(DUK_CMDLINE_MODULE_SUPPORT)
-	duk_module_duktape_init(ctx);
-#endif
+	if (!cgi) {
+		duk_eval_string(ctx,
+			"(function(v){"
+			    "if (typeof String === 'undefined') { String = {}; }"
+			    "Object.defineProperty(String, 'fromBufferRaw', {value:v, configurable:true});"
+			"})");
+		duk_push_c_function(ctx, string_frombufferraw, 1 /*nargs*/);
+		(void) duk_pcall(ctx, 1);
+		duk_pop(ctx);
+	}
 
 	/* Register CBOR. */
 #if defined(DUK_CMDLINE_CBOR_SUPPORT)
@@ -1214,25 +1227,28 @@ static duk_context *create_duktape_heap(int alloc_provider, int debugger, int lo
 	duk_push_c_function(ctx, fileio_write_file, 2 /*nargs*/);
 	duk_put_global_string(ctx, "writeFile");
 #endif
-        srand(time(NULL));
-        duk_push_c_function(ctx, generate_random, 1 /* number of arguments */);
-        duk_put_global_string(ctx, "generateRandom");
-  ccsp_extensions_load(ctx);
+  /* shared heaps open the request level modules in each request's global */
+  if (!request_isolation)
+    ccsp_extensions_load_request(ctx);
 
-	/* Stash a formatting function for evaluation results. */
-	duk_push_global_stash(ctx);
-	duk_eval_string(ctx,
-		"(function (E) {"
-		    "return function format(v){"
-		        "try{"
-		            "return E('jx',v);"
-		        "}catch(e){"
-		            "return ''+v;"
-		        "}"
-		    "};"
-		"})(Duktape.enc)");
-	duk_put_prop_string(ctx, -2, "dukFormat");
-	duk_pop(ctx);
+	/* Stash a formatting function for evaluation results (interactive
+	 * mode only, which the CGI profile excludes).
+	 */
+	if (!cgi) {
+		duk_push_global_stash(ctx);
+		duk_eval_string(ctx,
+			"(function (E) {"
+			    "return function format(v){"
+			        "try{"
+			            "return E('jx',v);"
+			        "}catch(e){"
+			            "return ''+v;"
+			        "}"
+			    "};"
+			"})(Duktape.enc)");
+		duk_put_prop_string(ctx, -2, "dukFormat");
+		duk_pop(ctx);
+	}
 
 	if (debugger) {
 #if defined(DUK_CMDLINE_DEBUGGER_SUPPORT)
@@ -1325,6 +1341,88 @@ int create_jst_debug_file_name(const char* arg)
   return 0;
 }
 
+/*
+ *  Isolated request execution on a shared heap
+ */
+
+/* Run one request in a new thread with a fresh global environment and
+   drop the thread afterwards, so nothing the page declares is visible to
+   the next request. The request global inherits from the heap's global
+   object, which keeps the bindings registered by create_duktape_heap()
+   (print, console, require, ccsp, ccsp_session, ...) reachable, while the
+   request level modules are opened on the request global itself. */
+static int handle_file_isolated(duk_context *ctx, const char *filename) {
+  duk_context *thr;
+  char *buf;
+  size_t len;
+  int rc;
+
+  /* a static page needs neither a request thread nor the request modules */
+  if (strlen(filename) > 4 && !strcmp(filename + strlen(filename) - 4, ".jst") &&
+      load_template_static_page(filename, &buf, &len)) {
+    jst_write_static_page(stdout, buf, len);
+    free(buf);
+    return 0;
+  }
+
+  thr = jst_push_request_thread(ctx);
+
+  ccsp_extensions_load_request(thr);
+  rc = handle_file(thr, filename, NULL);
+  ccsp_extensions_unload(thr);
+
+  duk_pop(ctx);
+
+  return rc;
+}
+
+/*
+ *  FastCGI request handler
+ */
+
+typedef struct fastcgi_options {
+  int alloc_provider;
+  int lowmem_log;
+  duk_context *ctx;
+} fastcgi_options;
+
+/* runs inside a fastcgi worker with the request env/stdin/stdout installed
+   (see jst_fastcgi.c); the worker keeps one heap for all of its requests */
+static int handle_fastcgi_request(void *udata) {
+  fastcgi_options *opts = (fastcgi_options *) udata;
+  const char *filename = getenv("SCRIPT_FILENAME");
+
+  if (!filename || access(filename, R_OK) != 0) {
+    fprintf(stdout, "Status: 404 Not Found\r\nContent-type: text/html\r\n\r\n");
+    return 1;
+  }
+
+  if (!opts->ctx) {
+    opts->ctx = create_duktape_heap(opts->alloc_provider, 0 /*debugger*/, opts->lowmem_log);
+  }
+
+  return handle_file_isolated(opts->ctx, filename) == 0 ? 0 : 1;
+}
+
+/*
+ *  Zygote request handler
+ */
+
+/* runs in the child forked for each jst-cgi connection (see jst_zygote.c)
+   with the client's stdio and environment installed; ctx is the warm heap
+   created by main before the zygote started listening */
+static int handle_zygote_request(int argc, char **argv, void *udata) {
+  duk_context *ctx = (duk_context *) udata;
+  const char *filename = argc > 1 ? argv[1] : getenv("SCRIPT_FILENAME");
+
+  if (!filename) {
+    fprintf(stderr, "Error: no script given to zygote request\n");
+    return 1;
+  }
+
+  return handle_file_isolated(ctx, filename) == 0 ? 0 : 1;
+}
+
 /*
  *  Main
  */
@@ -1344,6 +1442,14 @@ int main(int argc, char *argv[], char **envp) {
 	int verbose = 0;
 	int run_stdin = 0;
 	const char *compile_filename = NULL;
+	const char *fastcgi_socket = NULL;
+	int fastcgi_workers = JST_FASTCGI_DEFAULT_WORKERS;
+	const char *zygote_socket = NULL;
+	const char *http_addr = NULL;
+	const char *http_docroot = ".";
+	const char *precompile_docroot = NULL;
+	const char *output_filename = NULL;
+	const char *page_filename = NULL;
 	int i;
 
 	main_argc = argc;
@@ -1354,9 +1460,21 @@ int main(int argc, char *argv[], char **envp) {
   {
     char *buf = NULL;
     size_t bufoff;
-    if(load_template_file(argv[2], &buf, &bufoff, 1))
+    if(load_template_file(argv[2], &buf, &bufoff, LOAD_TEMPLATE_PAGE))
     {
       fprintf(stdout, "%s", buf);
+      free(buf);
+
+      /* a page without code is written without running it */
+      if(load_template_static(argv[2], &buf, &bufoff))
+      {
+        fprintf(stderr, "%s: static page, served without the JS engine\n", argv[2]);
+        free(buf);
+      }
+      else
+      {
+        fprintf(stderr, "%s: has code, runs in the JS engine\n", argv[2]);
+      }
     }
     else
     {
@@ -1521,15 +1639,76 @@ int main(int argc, char *argv[], char **envp) {
 			verbose = 1;
 		} else if (strcmp(arg, "--run-stdin") == 0) {
 			run_stdin = 1;
+		} else if (strcmp(arg, "--cgi") == 0) {
+			cgi_profile = 1;
+		} else if (strcmp(arg, "--fastcgi") == 0) {
+			if (i == argc - 1) {
+				goto usage;
+			}
+			i++;
+			fastcgi_socket = argv[i];
+		} else if (strcmp(arg, "--fastcgi-workers") == 0) {
+			if (i == argc - 1) {
+				goto usage;
+			}
+			i++;
+			fastcgi_workers = atoi(argv[i]);
+		} else if (strcmp(arg, "--zygote") == 0) {
+			if (i == argc - 1) {
+				goto usage;
+			}
+			i++;
+			zygote_socket = argv[i];
+		} else if (strcmp(arg, "--http") == 0) {
+			if (i == argc - 1) {
+				goto usage;
+			}
+			i++;
+			http_addr = argv[i];
+		} else if (strcmp(arg, "--docroot") == 0) {
+			if (i == argc - 1) {
+				goto usage;
+			}
+			i++;
+			http_docroot = argv[i];
+		} else if (strcmp(arg, "--precompile") == 0) {
+			if (i == argc - 1) {
+				goto usage;
+			}
+			i++;
+			precompile_docroot = argv[i];
+		} else if (strcmp(arg, "-o") == 0) {
+			if (i == argc - 1) {
+				goto usage;
+			}
+			i++;
+			output_filename = argv[i];
+		} else if (strcmp(arg, "--bundle") == 0) {
+			if (i == argc - 1) {
+				goto usage;
+			}
+			i++;
+			if (!jst_bundle_use(argv[i])) {
+				retval = 1;
+				goto cleanup;
+			}
 		} else if (strlen(arg) >= 1 && arg[0] == '-') {
 			goto usage;
 		} else {
-			have_files = 1;
+			have_files++;
+			page_filename = arg;
 		}
 	}
-	if (!have_files && !have_eval && !run_stdin) {
+	if (!have_files && !have_eval && !run_stdin && !fastcgi_socket && !zygote_socket && !http_addr && !precompile_docroot) {
 		interactive = 1;
 	}
+	if (!precompile_docroot != !output_filename) {
+		goto usage;
+	}
+	if (cgi_profile && interactive) {
+		/* the profile drops the interactive result formatter */
+		goto usage;
+	}
 
 	/*
 	 *  Memory limit
@@ -1544,6 +1723,78 @@ int main(int argc, char *argv[], char **envp) {
 	}
 #endif
 
+	/*
+	 *  Precompile mode: build a site bundle and exit
+	 */
+
+	if (precompile_docroot) {
+		retval = jst_bundle_build(precompile_docroot, output_filename, 0 /*jobs: one per cpu*/);
+		goto cleanup;
+	}
+
+	/*
+	 *  FastCGI mode: each worker creates its own heap on first use
+	 */
+
+	if (fastcgi_socket) {
+		fastcgi_options opts;
+		opts.alloc_provider = alloc_provider;
+		opts.lowmem_log = lowmem_log;
+		opts.ctx = NULL;
+		request_isolation = 1;
+		retval = jst_fastcgi_run(fastcgi_socket, fastcgi_workers, handle_fastcgi_request, (void *) &opts);
+		goto cleanup;
+	}
+
+	/*
+	 *  Zygote mode: build the heap and load the prelude once, then fork a
+	 *  child off this state for every jst-cgi request
+	 */
+
+	if (zygote_socket) {
+		const char *prelude;
+		size_t prelude_len;
+
+		request_isolation = 1;
+		ctx = create_duktape_heap(alloc_provider, 0 /*debugger*/, lowmem_log);
+		load_template_prelude(ctx, &prelude, &prelude_len);
+		duk_gc(ctx, 0);
+		retval = jst_zygote_run(zygote_socket, handle_zygote_request, (void *) ctx);
+		goto cleanup;
+	}
+
+	/*
+	 *  HTTP mode: pages are rendered in-process through libjst
+	 */
+
+	if (http_addr) {
+		jst_engine *engine = jst_engine_create();
+		if (!engine) {
+			fprintf(stderr, "Error: failed to create jst engine\n");
+			retval = 1;
+			goto cleanup;
+		}
+		retval = jst_http_run(http_addr, http_docroot, engine);
+		jst_engine_destroy(engine);
+		goto cleanup;
+	}
+
+	/*
+	 *  Static page: written as it is, without creating a heap
+	 */
+
+	if (have_files == 1 && !have_eval && !interactive && !run_stdin && !compile_filename && !debugger &&
+	    strlen(page_filename) > 4 && !strcmp(page_filename + strlen(page_filename) - 4, ".jst")) {
+		char *buf;
+		size_t len;
+
+		if (load_template_static_page(page_filename, &buf, &len)) {
+			jst_write_static_page(stdout, buf, len);
+			free(buf);
+			goto cleanup;
+		}
+	}
+
 	/*
 	 *  Create heap
 	 */
@@ -1570,7 +1821,8 @@ int main(int argc, char *argv[], char **envp) {
 			}
 			i++;  /* skip code */
 			continue;
-		} else if (strlen(arg) == 2 && strcmp(arg, "-c") == 0) {
+		} else if ((strlen(arg) == 2 && strcmp(arg, "-c") == 0) ||
+		           strcmp(arg, "--bundle") == 0) {
 			i++;  /* skip filename */
 			continue;
 		} else if (strlen(arg) >= 1 && arg[0] == '-') {
@@ -1666,6 +1918,7 @@ int main(int argc, char *argv[], char **envp) {
 			"   -c FILE            compile into bytecode (use with only one file argument)\n"
 			"   --run-stdin        treat stdin like a file, i.e. compile full input (not line by line)\n"
 			"   --verbose          verbose messages to stderr\n"
+			"   --cgi              minimal startup for running one page per process\n"
 	                "   --restrict-memory  use lower memory limit (used by test runner)\n"
 	                "   --alloc-default    use Duktape default allocator\n"
 #if defined(DUK_CMDLINE_ALLOC_LOGGING)
@@ -1685,6 +1938,13 @@ int main(int argc, char *argv[], char **envp) {
 			"   --debugger         start example debugger\n"
 			"   --reattach         automatically reattach debugger on detach\n"
 #endif
+			"   --fastcgi SOCKET   serve FastCGI requests on unix socket SOCKET\n"
+			"   --fastcgi-workers N  number of pre-forked FastCGI workers (default 2)\n"
+			"   --http [HOST]:PORT serve HTTP/1.1 directly, rendering .jst pages in-process\n"
+			"   --docroot DIR      document root for --http (default: current directory)\n"
+			"   --zygote SOCKET    fork a pre-initialized process per jst-cgi request on unix socket SOCKET\n"
+			"   --precompile DIR -o FILE  compile every .jst under DIR into the site bundle FILE\n"
+			"   --bundle FILE      serve pages from a site bundle (default: $JST_BUNDLE)\n"
 			"   --recreate-heap    recreate heap after every file\n"
 			"   --no-heap-destroy  force GC, but don't destroy heap at end (leak testing)\n"
 	                "\n"
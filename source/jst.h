@@ -19,6 +19,7 @@
 #ifndef CCSP_DUKTAPE_H
 #define CCSP_DUKTAPE_H
 
+#include <stdio.h>
 #include <duktape.h>
 
 #if defined(__cplusplus)
@@ -26,10 +27,159 @@ extern "C" {
 #endif
 
 duk_ret_t ccsp_extensions_load(duk_context *ctx);
+duk_ret_t ccsp_extensions_load_static(duk_context *ctx);
+duk_ret_t ccsp_extensions_load_request(duk_context *ctx);
 duk_ret_t ccsp_extensions_unload(duk_context *ctx);
 
+/* jst_heap_init flags */
+#define JST_HEAP_CGI (1U << 0)  /* one-shot CGI process: lightfunc bindings,
+                                   console/Duktape.Logger/require set up on
+                                   first access */
+
+/* Set up a heap the way every jst entry point needs it: print/alert,
+   console, Duktape.Logger, require, generateRandom, the output functions
+   and the static ccsp modules. The request level modules are left to the
+   caller. */
+void jst_heap_init(duk_context *ctx, duk_uint_t flags);
+
+/* Push a thread with a fresh global environment whose global object
+   inherits from ctx's global and return its context. Pop it from ctx
+   to drop everything the request created. */
+duk_context* jst_push_request_thread(duk_context *ctx);
+
+/* top argument of load_template_file */
+#define LOAD_TEMPLATE_INCLUDE 0  /* included file, loaded once per page */
+#define LOAD_TEMPLATE_PAGE    1  /* page wrapped in jst_prefix.js/jst_suffix.js */
+#define LOAD_TEMPLATE_BODY    2  /* page alone, to be run by jst_run_page */
+#define LOAD_TEMPLATE_UNIT    3  /* include run on its own, see load_template_unit */
+#define LOAD_TEMPLATE_STATIC  4  /* includes inlined, only the content: the
+                                    page's output if load_template_is_static */
+
 int load_template_file(const char *filename, char** bufout, size_t* lenout, int top);
 
+/* Forget the document root and the include-once registry of the last page. */
+void load_template_reset(void);
+
+/* The prelude (jst_prefix.js) compiled to bytecode, from the site bundle,
+   the bytecode cache or a fresh compile, kept for the life of the process.
+   *code is the source instead if it doesn't compile. 0 if it can't be read. */
+int load_template_prelude(duk_context *ctx, const char** code, size_t* len);
+
+/* Resolve a top level template the way load_template_file does (document
+   root from the CGI environment or the cwd) and write its full path. This
+   resets the include registry. */
+int load_template_resolve(const char *filename, char* path, size_t pathlen);
+const char* load_template_root(void);
+
+/* Full path of the current top level template, "" before the first. */
+const char* load_template_page(void);
+
+/* The include registry: full paths of the top level template and every
+   file included since. Marking a path makes a later include of it a
+   no-op, as if it had been parsed. */
+int load_template_included(const char* path);
+int load_template_mark_included(const char* path);
+
+/* Compile time includes of the last BODY/UNIT parse, as written in the
+   template and NUL separated. They are not inlined but become calls to
+   ccsp.include_unit, which runs each file as a unit of its own. */
+const char* load_template_units(size_t* len);
+
+/* i-th path of the include registry, NULL past the last */
+const char* load_template_registry(int i);
+
+/* 1 if the last top level parse found no code but compile time includes.
+   After a LOAD_TEMPLATE_STATIC parse, which inlines the includes, this
+   means the page is static: it writes its content and nothing else. */
+int load_template_is_static(void);
+
+/* The output of a page without code, includes inlined, as _jst_finish
+   would write it after the Content-type header: 1 with the content in
+   *bufout, 0 if the page has code or no content. Call it after the
+   LOAD_TEMPLATE_BODY parse of the page: if it returns 0 the registry,
+   units and is_static of that parse are left as they were. */
+int load_template_static(const char *filename, char** bufout, size_t* lenout);
+
+/* Like load_template_file for a page body (LOAD_TEMPLATE_BODY), but
+   returns it compiled to Duktape bytecode (first byte 0xbf), taken from
+   the site bundle (see jst_bundle.h) or read from the bytecode cache when
+   the template is unchanged. Includes are units with their own entries,
+   so editing one doesn't invalidate the pages using it.
+   A static page is returned as JST_STATIC_PAGE followed by its content.
+   Falls back to returning the parsed source when the cache can't be used
+   or the page doesn't compile, so the caller reports errors as before. */
+int load_template_bytecode(duk_context *ctx, const char *filename, char** bufout, size_t* lenout);
+
+/* First byte of a static page from the template loaders; neither bytecode
+   nor source start with it. Its output is JST_STATIC_HEADER, the content
+   and a line feed, as _jst_finish writes it when no header() was set. */
+#define JST_STATIC_PAGE   '\x01'
+#define JST_STATIC_HEADER "Content-type: text/html\r\n\r\n"
+
+/* A static page without a Duktape heap: from the site bundle or the
+   bytecode cache, or the file itself if it has no <?% at all. Returns 0
+   if the page isn't known to be static; then a cache entry already read
+   is kept for the load_template_bytecode of the same page that follows. */
+int load_template_static_page(const char *filename, char** bufout, size_t* lenout);
+
+/* Write a static page from the loaders to f. */
+void jst_write_static_page(FILE* f, const char* code, size_t len);
+
+/* The same for an include, relative to the document root of the current
+   page. The include registry is left to the caller. */
+int load_template_unit(duk_context *ctx, const char *filename, char** bufout, size_t* lenout);
+
+/* The same for a runtime include() (a path the parser couldn't resolve).
+   The bytecode is also kept in memory for the rest of the process, so an
+   include in a loop or included again by a later request is not even read
+   from the cache while its size and mtime are unchanged. */
+int load_template_include(duk_context *ctx, const char *filename, char** bufout, size_t* lenout);
+
+/* A CommonJS module for require(), the .js file at path, compiled to a
+   function (require, exports, module) and dumped to bytecode, or read from
+   the bytecode cache. Returns the wrapped source if it doesn't compile. */
+int load_template_module(duk_context *ctx, const char* path, char** bufout, size_t* lenout);
+
+/* counts of load_template_include since the process started */
+typedef struct jst_include_stats
+{
+  unsigned long hits;    /* from memory */
+  unsigned long loads;   /* from the site bundle or the bytecode cache */
+  unsigned long misses;  /* parsed and compiled */
+}jst_include_stats;
+
+void load_template_include_stats(jst_include_stats* stats);
+
+/* Page output and static content, see jst_output.c. jst_heap_init
+   registers echo, _jst_echo, _jst_static and _jst_flush; jst_run_page
+   empties the output before a page. */
+#define JST_STATIC_KEY_LEN 16
+void jst_output_init(duk_context *ctx);
+void jst_output_reset(void);
+
+/* Length of code from the template loaders without the static content
+   table the parser appends to it, if any. */
+size_t jst_static_code_len(const char* code, size_t len);
+
+/* The same, also registering the table for _jst_static; call it before
+   the code is compiled or loaded. */
+size_t jst_static_register(const char* code, size_t len);
+
+/* Catalog for compile time translation (JST_TEXTDOMAIN), see jst_i18n.c:
+   its path, or NULL if _() is left to run time. */
+const char* jst_i18n_catalog(void);
+
+/* Translation of msgid from the catalog; 0 if there is none. */
+int jst_i18n_lookup(const char* msgid, size_t msgid_len, const char** str, size_t* len);
+
+/* Run a page from load_template_bytecode: the prelude, then the page, then
+   _jst_finish() to write the headers and echo buffer. exit() ends the page
+   early; any other error thrown by the page drops its output, as the
+   catch in the old jst_suffix.js did. Compile errors, including those of
+   units, and errors from _jst_finish are returned. A static page is only
+   print()ed. Leaves one value on the stack like duk_safe_call. */
+duk_int_t jst_run_page(duk_context *ctx, const char *filename, const char *code, size_t len);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,711 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+/*
+  Building and reading site bundles, see jst_bundle.h.
+
+  The parser keeps its state in globals, so the build runs in worker
+  processes rather than threads: each worker compiles every jobs'th page
+  in its own heap and writes the results to a temporary file, which the
+  parent reads back once all workers have exited.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "jst.h"
+#include "jst_bundle.h"
+#include "jst_internal.h"
+
+#define MAX_DISPLACE (1U << 24)
+
+typedef struct bundle_page
+{
+  char* path;
+  char* includes;
+  uint32_t includes_len;
+  char* code;
+  uint32_t code_len;
+}bundle_page;
+
+/* record a worker writes per page; includes and code follow */
+typedef struct bundle_record
+{
+  uint32_t index;
+  uint32_t includes_len;
+  uint32_t code_len;
+}bundle_record;
+
+static bundle_page* g_pages = NULL;
+static size_t g_page_count = 0;
+static size_t g_page_alloc = 0;
+static size_t g_root_len = 0;
+
+static const char* g_bundle = NULL;
+static size_t g_bundle_len = 0;
+static int g_bundle_checked = 0;
+
+static uint32_t bundle_hash(const char* s, size_t len, uint32_t seed)
+{
+  uint32_t h = 2166136261U ^ (seed * 0x9e3779b9U);
+  size_t i;
+
+  for(i = 0; i < len; ++i)
+  {
+    h ^= (unsigned char)s[i];
+    h *= 16777619U;
+  }
+
+  /* final avalanche so nearby seeds give unrelated slots */
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+  return h;
+}
+
+/* the translation catalog pages are built with, see jst_bundle_header */
+static uint64_t bundle_i18n(void)
+{
+  return jst_i18n_catalog() ? jst_i18n_catalog_hash() | 1 : 0;
+}
+
+static int bundle_add_page(const char* path)
+{
+  if(g_page_count == g_page_alloc)
+  {
+    size_t alloc = g_page_alloc ? g_page_alloc * 2 : 64;
+    bundle_page* pages = (bundle_page*)realloc(g_pages, alloc * sizeof(bundle_page));
+    if(!pages)
+      return -1;
+    g_pages = pages;
+    g_page_alloc = alloc;
+  }
+
+  memset(&g_pages[g_page_count], 0, sizeof(bundle_page));
+  g_pages[g_page_count].path = strdup(path);
+  if(!g_pages[g_page_count].path)
+    return -1;
+  g_page_count++;
+  return 0;
+}
+
+static int collect_page(const char* fpath, const struct stat* sb, int type, struct FTW* ftwbuf)
+{
+  size_t len = strlen(fpath);
+
+  (void)sb;
+  (void)ftwbuf;
+
+  if(type != FTW_F || len < 5 || strcmp(fpath + len - 4, ".jst") != 0)
+    return 0;
+
+  return bundle_add_page(fpath + g_root_len);
+}
+
+static int compare_pages(const void* a, const void* b)
+{
+  return strcmp(((const bundle_page*)a)->path, ((const bundle_page*)b)->path);
+}
+
+static void bundle_free_pages(void)
+{
+  size_t i;
+
+  for(i = 0; i < g_page_count; ++i)
+  {
+    free(g_pages[i].path);
+    free(g_pages[i].includes);
+    free(g_pages[i].code);
+  }
+  free(g_pages);
+  g_pages = NULL;
+  g_page_count = g_page_alloc = 0;
+}
+
+/* write the record of a page without code, if it is static */
+static int bundle_static_page(const char* path, bundle_record* rec, FILE* out)
+{
+  char* content;
+  size_t content_len;
+  char mark = JST_STATIC_PAGE;
+
+  if(!load_template_static(path, &content, &content_len))
+    return 0;
+
+  rec->includes_len = 0;
+  rec->code_len = (uint32_t)content_len + 1;
+  fwrite(rec, sizeof(*rec), 1, out);
+  fwrite(&mark, 1, 1, out);
+  fwrite(content, 1, content_len, out);
+  free(content);
+  return 1;
+}
+
+/* compile one page and write its record; code_len 0 marks a failure */
+static void bundle_compile_page(duk_context* ctx, uint32_t index, FILE* out)
+{
+  bundle_record rec;
+  char* src;
+  size_t src_len;
+  size_t js_len;
+  const char* includes;
+  size_t includes_len = 0;
+  void* code = NULL;
+  duk_size_t code_len = 0;
+
+  rec.index = index;
+  rec.includes_len = 0;
+  rec.code_len = 0;
+
+  if(strcmp(g_pages[index].path, JST_BUNDLE_PRELUDE) == 0)
+  {
+    load_template_reset();
+    if(!read_file(JST_PRELUDE_PATH, &src, &src_len))
+    {
+      fprintf(stderr, "Error: failed to load %s\n", JST_PRELUDE_PATH);
+      fwrite(&rec, sizeof(rec), 1, out);
+      return;
+    }
+  }
+  else if(!load_template_file(g_pages[index].path, &src, &src_len, LOAD_TEMPLATE_BODY))
+  {
+    fprintf(stderr, "Error: failed to load %s\n", g_pages[index].path);
+    fwrite(&rec, sizeof(rec), 1, out);
+    return;
+  }
+
+  /* a static page is stored as its content, see load_template_static_page */
+  if(strcmp(g_pages[index].path, JST_BUNDLE_PRELUDE) != 0 && load_template_is_static() &&
+     bundle_static_page(g_pages[index].path, &rec, out))
+  {
+    free(src);
+    return;
+  }
+
+  /* the static content table goes after the bytecode, see jst_output.c */
+  js_len = jst_static_code_len(src, src_len);
+  duk_push_string(ctx, g_pages[index].path);
+  if(duk_pcompile_lstring_filename(ctx, 0, src, js_len) != 0)
+  {
+    fprintf(stderr, "Error: %s: %s\n", g_pages[index].path, duk_safe_to_string(ctx, -1));
+    duk_pop(ctx);
+    free(src);
+    fwrite(&rec, sizeof(rec), 1, out);
+    return;
+  }
+
+  duk_dump_function(ctx);
+  code = duk_get_buffer(ctx, -1, &code_len);
+
+  /* the includes are units of their own, see bundle_add_units */
+  includes = load_template_units(&includes_len);
+
+  rec.includes_len = (uint32_t)includes_len;
+  rec.code_len = (uint32_t)(code_len + src_len - js_len);
+  fwrite(&rec, sizeof(rec), 1, out);
+  if(includes_len)
+    fwrite(includes, 1, includes_len, out);
+  fwrite(code, 1, code_len, out);
+  fwrite(src + js_len, 1, src_len - js_len, out);
+  free(src);
+
+  duk_pop(ctx);
+}
+
+static int bundle_worker(size_t first, size_t last, int jobs, FILE* out)
+{
+  duk_context* ctx = duk_create_heap_default();
+  size_t i;
+
+  if(!ctx)
+  {
+    fprintf(stderr, "Error: failed to create Duktape heap\n");
+    return 1;
+  }
+
+  for(i = first; i < last; i += jobs)
+    bundle_compile_page(ctx, (uint32_t)i, out);
+
+  duk_destroy_heap(ctx);
+  return fflush(out) == 0 ? 0 : 1;
+}
+
+static int bundle_read_results(FILE* in)
+{
+  bundle_record rec;
+
+  rewind(in);
+  while(fread(&rec, sizeof(rec), 1, in) == 1)
+  {
+    bundle_page* page;
+
+    if(rec.index >= g_page_count)
+      return 0;
+    page = &g_pages[rec.index];
+
+    if(rec.code_len == 0)
+      continue;
+
+    page->includes = (char*)malloc(rec.includes_len + 1);
+    page->code = (char*)malloc(rec.code_len);
+    if(!page->includes || !page->code ||
+       fread(page->includes, 1, rec.includes_len, in) != rec.includes_len ||
+       fread(page->code, 1, rec.code_len, in) != rec.code_len)
+      return 0;
+    page->includes_len = rec.includes_len;
+    page->code_len = rec.code_len;
+  }
+  return 1;
+}
+
+/* hash and displace: place the biggest buckets first, each with the first
+   displacement that sends all of its keys to free slots */
+static int bundle_perfect_hash(uint32_t bucket_count, uint32_t slot_count, uint32_t* displace, uint32_t* slots)
+{
+  uint32_t* bucket_of;
+  uint32_t* bucket_size;
+  uint32_t* placed;
+  uint32_t size;
+  uint32_t b;
+  size_t i;
+  int ok = 1;
+
+  bucket_of = (uint32_t*)malloc(g_page_count * sizeof(uint32_t));
+  bucket_size = (uint32_t*)calloc(bucket_count, sizeof(uint32_t));
+  placed = (uint32_t*)malloc(g_page_count * sizeof(uint32_t));
+  if(!bucket_of || !bucket_size || !placed)
+  {
+    free(bucket_of);
+    free(bucket_size);
+    free(placed);
+    return 0;
+  }
+
+  for(i = 0; i < g_page_count; ++i)
+  {
+    bucket_of[i] = bundle_hash(g_pages[i].path, strlen(g_pages[i].path), 0) % bucket_count;
+    bucket_size[bucket_of[i]]++;
+  }
+
+  for(i = 0; i < slot_count; ++i)
+    slots[i] = JST_BUNDLE_EMPTY;
+
+  for(size = (uint32_t)g_page_count; size > 0 && ok; --size)
+  {
+    for(b = 0; b < bucket_count && ok; ++b)
+    {
+      uint32_t d;
+
+      if(bucket_size[b] != size)
+        continue;
+
+      for(d = 1; d < MAX_DISPLACE; ++d)
+      {
+        uint32_t n = 0;
+
+        for(i = 0; i < g_page_count; ++i)
+        {
+          uint32_t s;
+
+          if(bucket_of[i] != b)
+            continue;
+          s = bundle_hash(g_pages[i].path, strlen(g_pages[i].path), d) % slot_count;
+          if(slots[s] != JST_BUNDLE_EMPTY)
+            break;
+          slots[s] = (uint32_t)i;
+          placed[n++] = s;
+        }
+
+        if(n == size)
+          break;
+
+        /* collision: undo this attempt */
+        while(n)
+          slots[placed[--n]] = JST_BUNDLE_EMPTY;
+      }
+
+      if(d == MAX_DISPLACE)
+        ok = 0;
+      else
+        displace[b] = d;
+    }
+  }
+
+  free(bucket_of);
+  free(bucket_size);
+  free(placed);
+  return ok;
+}
+
+static int bundle_write(const char* out)
+{
+  jst_bundle_header hdr;
+  uint32_t* displace;
+  uint32_t* slots;
+  jst_bundle_entry* entries;
+  uint32_t off;
+  char tmp[512];
+  FILE* f;
+  size_t i;
+  int ok;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = JST_BUNDLE_MAGIC;
+  hdr.format = JST_BUNDLE_FORMAT;
+  hdr.duk_version = (uint32_t)DUK_VERSION;
+  snprintf(hdr.jst_version, sizeof(hdr.jst_version), "%s", JST_VERSION);
+  hdr.count = (uint32_t)g_page_count;
+  hdr.bucket_count = (uint32_t)(g_page_count / 4 + 1);
+  hdr.slot_count = (uint32_t)(g_page_count + g_page_count / 4 + 1);
+  hdr.i18n = bundle_i18n();
+
+  displace = (uint32_t*)calloc(hdr.bucket_count, sizeof(uint32_t));
+  slots = (uint32_t*)calloc(hdr.slot_count, sizeof(uint32_t));
+  entries = (jst_bundle_entry*)calloc(g_page_count + 1, sizeof(jst_bundle_entry));
+  ok = displace && slots && entries &&
+       bundle_perfect_hash(hdr.bucket_count, hdr.slot_count, displace, slots);
+  if(!ok)
+  {
+    fprintf(stderr, "Error: failed to build the bundle index\n");
+    goto done;
+  }
+
+  off = sizeof(hdr) + hdr.bucket_count * 4 + hdr.slot_count * 4 + hdr.count * sizeof(jst_bundle_entry);
+  for(i = 0; i < g_page_count; ++i)
+  {
+    entries[i].path_off = off;
+    entries[i].path_len = (uint32_t)strlen(g_pages[i].path);
+    off += entries[i].path_len + 1;
+    entries[i].includes_off = off;
+    entries[i].includes_len = g_pages[i].includes_len;
+    off += g_pages[i].includes_len;
+    entries[i].code_off = off;
+    entries[i].code_len = g_pages[i].code_len;
+    off += g_pages[i].code_len;
+  }
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", out);
+  f = fopen(tmp, "wb");
+  if(!f)
+  {
+    fprintf(stderr, "Error: cannot create %s error:%s\n", tmp, strerror(errno));
+    ok = 0;
+    goto done;
+  }
+
+  fwrite(&hdr, sizeof(hdr), 1, f);
+  fwrite(displace, 4, hdr.bucket_count, f);
+  fwrite(slots, 4, hdr.slot_count, f);
+  fwrite(entries, sizeof(jst_bundle_entry), hdr.count, f);
+  for(i = 0; i < g_page_count; ++i)
+  {
+    fwrite(g_pages[i].path, 1, entries[i].path_len + 1, f);
+    fwrite(g_pages[i].includes, 1, g_pages[i].includes_len, f);
+    fwrite(g_pages[i].code, 1, g_pages[i].code_len, f);
+  }
+
+  ok = !ferror(f);
+  ok = fclose(f) == 0 && ok;
+  if(!ok || rename(tmp, out) != 0)
+  {
+    fprintf(stderr, "Error: failed to write %s\n", out);
+    unlink(tmp);
+    ok = 0;
+  }
+
+done:
+  free(displace);
+  free(slots);
+  free(entries);
+  return ok;
+}
+
+/* compile pages first..last-1 in jobs worker processes; 0 on success */
+static int bundle_compile_round(size_t first, size_t last, int jobs)
+{
+  FILE** results = NULL;
+  pid_t* pids = NULL;
+  int failed = 0;
+  int i;
+  size_t p;
+
+  if((size_t)jobs > last - first)
+    jobs = (int)(last - first);
+
+  results = (FILE**)calloc(jobs, sizeof(FILE*));
+  pids = (pid_t*)calloc(jobs, sizeof(pid_t));
+  if(!results || !pids)
+  {
+    failed = 1;
+    goto done;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  for(i = 0; i < jobs; ++i)
+  {
+    results[i] = tmpfile();
+    if(!results[i])
+    {
+      fprintf(stderr, "Error: tmpfile failed:%s\n", strerror(errno));
+      failed = 1;
+      break;
+    }
+
+    pids[i] = fork();
+    if(pids[i] == 0)
+      _exit(bundle_worker(first + i, last, jobs, results[i]));
+    if(pids[i] < 0)
+    {
+      fprintf(stderr, "Error: fork failed:%s\n", strerror(errno));
+      failed = 1;
+      break;
+    }
+  }
+
+  for(i = 0; i < jobs; ++i)
+  {
+    int status;
+
+    if(pids[i] <= 0)
+      continue;
+    while(waitpid(pids[i], &status, 0) < 0 && errno == EINTR)
+      ;
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !bundle_read_results(results[i]))
+      failed = 1;
+  }
+
+  for(p = first; p < last && !failed; ++p)
+    if(!g_pages[p].code)
+      failed = 1;
+
+done:
+  for(i = 0; results && i < jobs; ++i)
+    if(results[i])
+      fclose(results[i]);
+  free(results);
+  free(pids);
+  return failed;
+}
+
+/* add the includes of pages first..last-1 that aren't pages themselves
+   (.js files, includes outside the root); 0 on failure */
+static int bundle_add_units(size_t first, size_t last)
+{
+  size_t p;
+  size_t q;
+
+  for(p = first; p < last; ++p)
+  {
+    const char* inc;
+
+    for(inc = g_pages[p].includes; inc < g_pages[p].includes + g_pages[p].includes_len; inc += strlen(inc) + 1)
+    {
+      for(q = 0; q < g_page_count; ++q)
+        if(strcmp(g_pages[q].path, inc) == 0)
+          break;
+      /* a missing include is left to fail at run time, as it did when
+         includes were inlined */
+      if(q == g_page_count && access(inc, R_OK) == 0 && bundle_add_page(inc) != 0)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+int jst_bundle_build(const char* docroot, const char* out, int jobs)
+{
+  char root[4096];
+  int failed = 0;
+  size_t first;
+  size_t last;
+
+  if(!realpath(docroot, root))
+  {
+    fprintf(stderr, "Error: cannot resolve %s error:%s\n", docroot, strerror(errno));
+    return 1;
+  }
+  g_root_len = strlen(root) + (root[strlen(root) - 1] == '/' ? 0 : 1);
+
+  if(nftw(root, collect_page, 32, FTW_PHYS) != 0)
+  {
+    fprintf(stderr, "Error: failed to scan %s\n", root);
+    bundle_free_pages();
+    return 1;
+  }
+  qsort(g_pages, g_page_count, sizeof(bundle_page), compare_pages);
+
+  /* pages are compiled without the prelude, it goes in once */
+  if(bundle_add_page(JST_BUNDLE_PRELUDE) != 0)
+  {
+    bundle_free_pages();
+    return 1;
+  }
+
+  /* pages are parsed stand-alone, relative to the working directory */
+  if(chdir(root) != 0)
+  {
+    fprintf(stderr, "Error: cannot enter %s error:%s\n", root, strerror(errno));
+    bundle_free_pages();
+    return 1;
+  }
+  unsetenv("GATEWAY_INTERFACE");
+
+  if(jobs <= 0)
+    jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if(jobs < 1)
+    jobs = 1;
+
+  /* the pages, then the includes they name that are not pages */
+  for(first = 0; first < g_page_count && !failed; first = last)
+  {
+    last = g_page_count;
+    failed = bundle_compile_round(first, last, jobs) || !bundle_add_units(first, last);
+  }
+
+  if(!failed)
+  {
+    if(bundle_write(out))
+      fprintf(stderr, "precompiled %u pages into %s\n", (unsigned)g_page_count - 1, out);
+    else
+      failed = 1;
+  }
+  else
+  {
+    fprintf(stderr, "Error: precompile failed, %s not written\n", out);
+  }
+
+  bundle_free_pages();
+  return failed;
+}
+
+int jst_bundle_use(const char* path)
+{
+  const jst_bundle_header* hdr;
+  struct stat st;
+  void* map;
+  int fd;
+
+  g_bundle_checked = 1;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+  {
+    CosaPhpExtLog("bundle: cannot open %s: %s\n", path, strerror(errno));
+    fprintf(stderr, "Error: cannot open file:%s error:%s\n", path, strerror(errno));
+    return 0;
+  }
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(jst_bundle_header))
+  {
+    fprintf(stderr, "Error: %s is not a bundle\n", path);
+    close(fd);
+    return 0;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+  {
+    CosaPhpExtLog("bundle: mmap %s failed: %s\n", path, strerror(errno));
+    return 0;
+  }
+
+  hdr = (const jst_bundle_header*)map;
+  if(hdr->magic != JST_BUNDLE_MAGIC || hdr->format != JST_BUNDLE_FORMAT ||
+     hdr->duk_version != (uint32_t)DUK_VERSION ||
+     strncmp(hdr->jst_version, JST_VERSION, sizeof(hdr->jst_version)) != 0 ||
+     hdr->bucket_count == 0 || hdr->slot_count == 0 ||
+     sizeof(*hdr) + ((uint64_t)hdr->bucket_count + hdr->slot_count) * 4 +
+       (uint64_t)hdr->count * sizeof(jst_bundle_entry) > (uint64_t)st.st_size)
+  {
+    CosaPhpExtLog("bundle: %s was not built by this jst\n", path);
+    fprintf(stderr, "Error: %s is not a bundle for this jst version\n", path);
+    munmap(map, st.st_size);
+    return 0;
+  }
+  if(hdr->i18n != bundle_i18n())
+  {
+    CosaPhpExtLog("bundle: %s was built with another translation catalog\n", path);
+    fprintf(stderr, "Error: %s was built with another translation catalog\n", path);
+    munmap(map, st.st_size);
+    return 0;
+  }
+
+  if(g_bundle)
+    munmap((void*)g_bundle, g_bundle_len);
+  g_bundle = (const char*)map;
+  g_bundle_len = st.st_size;
+  return 1;
+}
+
+int jst_bundle_active(void)
+{
+  if(!g_bundle_checked)
+  {
+    const char* env = getenv("JST_BUNDLE");
+    g_bundle_checked = 1;
+    if(env && env[0])
+      jst_bundle_use(env);
+  }
+  return g_bundle != NULL;
+}
+
+const char* jst_bundle_find(const char* page, size_t* code_len, const char** includes, size_t* includes_len)
+{
+  const jst_bundle_header* hdr;
+  const uint32_t* displace;
+  const uint32_t* slots;
+  const jst_bundle_entry* entry;
+  size_t len = strlen(page);
+  uint32_t b;
+  uint32_t index;
+
+  if(!jst_bundle_active())
+    return NULL;
+
+  hdr = (const jst_bundle_header*)g_bundle;
+  displace = (const uint32_t*)(hdr + 1);
+  slots = displace + hdr->bucket_count;
+
+  b = bundle_hash(page, len, 0) % hdr->bucket_count;
+  index = slots[bundle_hash(page, len, displace[b]) % hdr->slot_count];
+  if(index >= hdr->count)
+    return NULL;
+
+  entry = (const jst_bundle_entry*)(slots + hdr->slot_count) + index;
+  if((uint64_t)entry->code_off + entry->code_len > g_bundle_len ||
+     (uint64_t)entry->includes_off + entry->includes_len > g_bundle_len ||
+     (uint64_t)entry->path_off + entry->path_len > g_bundle_len ||
+     entry->path_len != len || memcmp(g_bundle + entry->path_off, page, len) != 0)
+    return NULL;
+
+  *code_len = entry->code_len;
+  *includes = g_bundle + entry->includes_off;
+  *includes_len = entry->includes_len;
+  return g_bundle + entry->code_off;
+}
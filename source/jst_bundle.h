@@ -0,0 +1,105 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#ifndef JST_BUNDLE_H
+#define JST_BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+  Site bundle: every .jst page of a document root precompiled to Duktape
+  bytecode in one file, built ahead of time with 'jst --precompile'.
+
+  layout (host byte order, all offsets from the start of the file):
+    jst_bundle_header
+    uint32_t displace[bucket_count]   perfect hash displacements
+    uint32_t slots[slot_count]        entry index, or JST_BUNDLE_EMPTY
+    jst_bundle_entry entries[count]
+    string and bytecode data
+
+  A page path (relative to the document root, e.g. "admin/index.jst") is
+  found with two hashes: bucket = hash(path, 0) % bucket_count, then
+  slot = hash(path, displace[bucket]) % slot_count. The entry's path is
+  compared to reject pages that are not in the bundle. The prelude
+  (jst_prefix.js) is stored as one more entry, JST_BUNDLE_PRELUDE.
+
+  Bytecode is specific to the Duktape version and the target's byte order
+  and word size, so a bundle must be built by the jst binary (or an
+  identical build) that will use it. Pages built with a translation catalog
+  (jst_i18n.c) have _() resolved, so the bundle is only used with the same
+  catalog: the same content, not just the same path.
+*/
+
+#define JST_BUNDLE_MAGIC   0x4a535442U /* "JSTB" */
+#define JST_BUNDLE_FORMAT  6
+#define JST_BUNDLE_PRELUDE ":prelude"
+#define JST_BUNDLE_EMPTY   0xffffffffU
+
+typedef struct jst_bundle_header
+{
+  uint32_t magic;
+  uint32_t format;
+  uint32_t duk_version;
+  char jst_version[16];
+  uint32_t count;
+  uint32_t bucket_count;
+  uint32_t slot_count;
+  uint32_t pad;
+  uint64_t i18n;            /* hash of the translation catalog's content, 0 for none */
+}jst_bundle_header;
+
+typedef struct jst_bundle_entry
+{
+  uint32_t path_off;
+  uint32_t path_len;
+  uint32_t includes_off;   /* compile time includes, NUL separated, relative to the root;
+                              each is an entry of its own */
+  uint32_t includes_len;
+  uint32_t code_off;
+  uint32_t code_len;
+}jst_bundle_entry;
+
+/* Parse and compile every .jst under docroot, using jobs processes
+   (0: one per online CPU), and write the bundle to out.
+   Returns 0 on success; nothing is written if any page fails. */
+int jst_bundle_build(const char* docroot, const char* out, int jobs);
+
+/* Use the bundle at path (mmap'ed) for load_template_bytecode. Without
+   a call the JST_BUNDLE environment variable is used, if set.
+   Returns 0 if the file is not a usable bundle. */
+int jst_bundle_use(const char* path);
+
+/* 1 if a bundle is in use (jst_bundle_use or $JST_BUNDLE) */
+int jst_bundle_active(void);
+
+/* Bytecode of a page given relative to the document root, or NULL if
+   there is no bundle or the page is not in it. includes is set to the
+   NUL separated list of files the page inlined at compile time.
+   A static page is JST_STATIC_PAGE and its content, see jst.h. */
+const char* jst_bundle_find(const char* page, size_t* code_len, const char** includes, size_t* includes_len);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
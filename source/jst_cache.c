@@ -0,0 +1,934 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+/*
+  Bytecode cache for parsed templates.
+
+  A page is stored as the duk_dump_function output of its compiled code
+  plus a key that lists what the code was built from: jst and Duktape
+  versions, the document root, the page path and the size/mtime of the
+  file. Compile time includes are not inlined but run as units of their
+  own (ccsp.include_unit), each with its own entry, and so is the
+  prelude. An entry is used only if rebuilding the key from the current
+  state of its file gives the same bytes, so editing a page or an include
+  recompiles just that file. Runtime include()s are units too, and are
+  also kept in memory by load_template_include. A page without code is
+  stored as its output instead (JST_STATIC_PAGE), with its includes
+  inlined and in the key, and written without a heap by
+  load_template_static_page. With a translation catalog (jst_i18n.c) the
+  key holds the catalog too, and each catalog has entries of its own.
+
+  The key is the include graph of the entry: a line per file it was built
+  from with its size, mtime and a hash of its content, and a line per
+  compile time include, the units it runs. A file whose mtime changed but
+  not its content (a copy, a reinstall) doesn't invalidate the entry, which
+  is stored again with the new mtime instead. On a hit the entries of the
+  units are read ahead, as the page is about to load them.
+
+  Entries live in JST_CACHE_DIR (environment, else the compile time
+  default), one file per page named after a hash of its path. Bytecode is
+  loaded without validation, so the directory must be private to the
+  user running jst; the cache disables itself otherwise. An empty
+  JST_CACHE_DIR turns the cache off.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "jst.h"
+#include "jst_bundle.h"
+#include "jst_internal.h"
+
+#ifndef JST_CACHE_DIR
+#define JST_CACHE_DIR "/tmp/jst_cache"
+#endif
+
+/* bump whenever the parser emits different code for the same input */
+#define JST_CACHE_FORMAT 9
+
+#define JST_CACHE_MAGIC "JSTC"
+
+typedef struct cache_header
+{
+  char magic[4];
+  uint32_t key_len;
+  uint32_t code_len;
+}cache_header;
+
+/* prelude bytecode (or source), loaded once per process */
+static char* g_prelude = NULL;
+static size_t g_prelude_len = 0;
+
+/* page entry read by load_template_static_page, for the
+   load_template_bytecode that follows it */
+static char* g_page_code = NULL;
+static size_t g_page_code_len = 0;
+static char g_page_path[512];
+
+/* runtime include() bytecode, kept for the life of the process and
+   checked against the file's size and mtime on every use */
+#define JST_INCLUDE_MEMO_MAX 64
+
+typedef struct include_memo
+{
+  char* path;
+  off_t size;
+  struct timespec mtime;
+  char* code;
+  size_t code_len;
+  struct include_memo* next;
+}include_memo;
+
+static include_memo* g_include_memo = NULL;
+static int g_include_memo_count = 0;
+static jst_include_stats g_include_stats;
+
+/* directory to use, NULL when the cache is off or unusable */
+static const char* cache_dir(void)
+{
+  static int checked = 0;
+  static const char* dir = NULL;
+  const char* env;
+  struct stat st;
+
+  if(checked)
+    return dir;
+  checked = 1;
+
+  env = getenv("JST_CACHE_DIR");
+  if(!env)
+    env = JST_CACHE_DIR;
+  if(!env[0])
+    return NULL;
+
+  if(mkdir(env, 0700) != 0 && errno != EEXIST)
+  {
+    CosaPhpExtLog("bytecode cache: cannot create %s: %s\n", env, strerror(errno));
+    return NULL;
+  }
+
+  if(lstat(env, &st) != 0 || !S_ISDIR(st.st_mode) ||
+     st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+  {
+    CosaPhpExtLog("bytecode cache: %s is not a private directory, cache disabled\n", env);
+    return NULL;
+  }
+
+  dir = env;
+  return dir;
+}
+
+/* FNV-1a, only used to name the entry; the key holds the real path */
+static uint64_t cache_hash(const char* s)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  while(*s)
+  {
+    h ^= (unsigned char)*s++;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/* a dependency as stored in a key, "dep <size> <mtime> <hash> <path>" */
+typedef struct cache_dep
+{
+  long long size;
+  long long sec;
+  long nsec;
+  unsigned long long hash;
+}cache_dep;
+
+/* hash of the content of the file at path */
+static uint64_t dep_hash(const char* path)
+{
+  jst_file file;
+  uint64_t h;
+
+  if(!map_file(path, &file))
+    return jst_hash("", 0);
+  h = jst_hash(file.data, file.len);
+  unmap_file(&file);
+  return h;
+}
+
+/* The dependency line for path. With the line stored for it, the hash is
+   only computed if the size or mtime changed; if just the mtime did,
+   *touched is set and, unless refresh, the stored line is written so the
+   key stays the same. */
+static void key_add_dep(FILE* key, const char* path, time_t* newest, const cache_dep* stored, int refresh, int* touched)
+{
+  struct stat st;
+  uint64_t hash;
+
+  if(stat(path, &st) != 0)
+  {
+    /* a missing include is part of the key too, so creating it later
+       invalidates the entry */
+    fprintf(key, "dep -1 0.0 0 %s\n", path);
+    return;
+  }
+
+  if(stored && stored->size == st.st_size &&
+     stored->sec == st.st_mtim.tv_sec && stored->nsec == st.st_mtim.tv_nsec)
+    hash = stored->hash;
+  else
+  {
+    hash = dep_hash(path);
+    if(stored && stored->size == st.st_size && stored->hash == hash)
+    {
+      *touched = 1;
+      if(!refresh)
+      {
+        fprintf(key, "dep %lld %lld.%09ld %016llx %s\n", stored->size, stored->sec, stored->nsec, stored->hash, path);
+        return;
+      }
+    }
+  }
+
+  fprintf(key, "dep %lld %lld.%09ld %016llx %s\n", (long long)st.st_size,
+          (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec, (unsigned long long)hash, path);
+
+  if(newest && st.st_mtim.tv_sec > *newest)
+    *newest = st.st_mtim.tv_sec;
+}
+
+/* "unit <path>" for each compile time include in the NUL separated units */
+static void key_add_units(FILE* key, const char* units, size_t units_len)
+{
+  size_t i;
+
+  for(i = 0; i < units_len; i += strlen(units + i) + 1)
+    fprintf(key, "unit %s\n", units + i);
+}
+
+static FILE* key_open(char** key, size_t* key_len, const char* root, const char* page)
+{
+  FILE* f = open_memstream(key, key_len);
+  const char* catalog = jst_i18n_catalog();
+  struct stat st;
+
+  if(!f)
+    return NULL;
+
+  fprintf(f, "jst %s format %d duktape %ld\n", JST_VERSION, JST_CACHE_FORMAT, (long)DUK_VERSION);
+  fprintf(f, "root %s\n", root);
+  fprintf(f, "page %s\n", page);
+
+  /* the code depends on the catalog _() was resolved with, see jst_i18n.c */
+  if(catalog && stat(catalog, &st) == 0)
+    fprintf(f, "i18n %lld %lld.%09ld %s\n", (long long)st.st_size,
+            (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec, catalog);
+  return f;
+}
+
+/* key rebuilt from the dependencies of a stored key, see key_add_dep;
+   the units are copied, they only change with the files */
+static int key_from_stored(const char* root, const char* page, const char* stored, size_t stored_len,
+                           int refresh, char** key, size_t* key_len, int* touched, time_t* newest)
+{
+  FILE* f = key_open(key, key_len, root, page);
+  const char* cur = stored;
+  const char* end = stored + stored_len;
+
+  if(!f)
+    return 0;
+
+  while(cur < end)
+  {
+    const char* eol = memchr(cur, '\n', end - cur);
+    if(!eol)
+      break;
+
+    if(strncmp(cur, "dep ", 4) == 0)
+    {
+      /* the path is after the fourth space */
+      char line[600];
+      const char* p = cur;
+      int spaces = 0;
+      cache_dep dep;
+
+      while(p < eol && spaces < 4)
+        if(*p++ == ' ')
+          spaces++;
+
+      if(spaces == 4 && (size_t)(eol - cur) < sizeof(line))
+      {
+        memcpy(line, cur, eol - cur);
+        line[eol - cur] = 0;
+        if(sscanf(line, "dep %lld %lld.%ld %llx", &dep.size, &dep.sec, &dep.nsec, &dep.hash) == 4)
+          key_add_dep(f, line + (p - cur), newest, &dep, refresh, touched);
+      }
+    }
+    else if(strncmp(cur, "unit ", 5) == 0)
+      fwrite(cur, 1, eol + 1 - cur, f);
+    cur = eol + 1;
+  }
+
+  return fclose(f) == 0;
+}
+
+static void cache_entry(char* entry, size_t entry_len, const char* dir, const char* name);
+
+/* read ahead the entries of the units in a key, see load_template_unit */
+static void key_read_ahead(const char* dir, const char* root, const char* key, size_t key_len)
+{
+  const char* cur = key;
+  const char* end = key + key_len;
+  char path[512];
+  char entry[512];
+  int fd;
+
+  while(cur < end)
+  {
+    const char* eol = memchr(cur, '\n', end - cur);
+    if(!eol)
+      break;
+
+    if(strncmp(cur, "unit ", 5) == 0 &&
+       snprintf(path, sizeof(path), "%s%.*s", root, (int)(eol - cur - 5), cur + 5) < (int)sizeof(path))
+    {
+      cache_entry(entry, sizeof(entry), dir, path);
+      fd = open(entry, O_RDONLY);
+      if(fd >= 0)
+      {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+      }
+    }
+    cur = eol + 1;
+  }
+}
+
+static void cache_store(const char* entry, const char* key, size_t key_len, const void* code, size_t code_len);
+
+static int cache_lookup(const char* entry, const char* root, const char* page, char** bufout, size_t* lenout)
+{
+  jst_file file;
+  const char* data;
+  size_t len;
+  cache_header hdr;
+  char* key = NULL;
+  size_t key_len = 0;
+  int touched = 0;
+  time_t newest = 0;
+  int valid;
+
+  /* entries are replaced by rename, so a mapped one never changes */
+  if(access(entry, R_OK) != 0 || !map_file(entry, &file))
+    return 0;
+  data = file.data;
+  len = file.len;
+
+  if(len < sizeof(hdr))
+  {
+    unmap_file(&file);
+    return 0;
+  }
+  memcpy(&hdr, data, sizeof(hdr));
+
+  if(memcmp(hdr.magic, JST_CACHE_MAGIC, 4) != 0 ||
+     (size_t)hdr.key_len + hdr.code_len != len - sizeof(hdr) ||
+     hdr.code_len == 0)
+  {
+    unmap_file(&file);
+    return 0;
+  }
+
+  valid = key_from_stored(root, page, data + sizeof(hdr), hdr.key_len, 0, &key, &key_len, &touched, NULL) &&
+          key_len == hdr.key_len &&
+          memcmp(key, data + sizeof(hdr), key_len) == 0;
+  free(key);
+
+  if(!valid)
+  {
+    CosaPhpExtLog("bytecode cache: %s is stale\n", page);
+    unmap_file(&file);
+    return 0;
+  }
+
+  /* same content with a new mtime: store the key as it is now, unless
+     a file might still change without a visible mtime change */
+  if(touched)
+  {
+    key = NULL;
+    key_len = 0;
+    if(key_from_stored(root, page, data + sizeof(hdr), hdr.key_len, 1, &key, &key_len, &touched, &newest) &&
+       newest < time(NULL) - 1)
+    {
+      CosaPhpExtLog("bytecode cache: %s is unchanged, mtime updated\n", page);
+      cache_store(entry, key, key_len, data + sizeof(hdr) + hdr.key_len, hdr.code_len);
+    }
+    free(key);
+  }
+
+  key_read_ahead(cache_dir(), root, data + sizeof(hdr), hdr.key_len);
+
+  /* an entry read into the heap is the code once moved to the front */
+  if(!file.mapped)
+  {
+    *bufout = (char*)file.data;
+    memmove(*bufout, data + sizeof(hdr) + hdr.key_len, hdr.code_len);
+    *lenout = hdr.code_len;
+    return 1;
+  }
+
+  *bufout = (char*)malloc(hdr.code_len);
+  if(*bufout)
+    memcpy(*bufout, data + sizeof(hdr) + hdr.key_len, hdr.code_len);
+  *lenout = *bufout ? hdr.code_len : 0;
+  unmap_file(&file);
+  return *bufout != NULL;
+}
+
+static void cache_store(const char* entry, const char* key, size_t key_len, const void* code, size_t code_len)
+{
+  char tmp[512];
+  cache_header hdr;
+  int fd;
+  int ok;
+
+  if(snprintf(tmp, sizeof(tmp), "%s.%d", entry, (int)getpid()) >= (int)sizeof(tmp))
+    return;
+
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL, 0600);
+  if(fd < 0)
+  {
+    CosaPhpExtLog("bytecode cache: cannot create %s: %s\n", tmp, strerror(errno));
+    return;
+  }
+
+  memcpy(hdr.magic, JST_CACHE_MAGIC, 4);
+  hdr.key_len = (uint32_t)key_len;
+  hdr.code_len = (uint32_t)code_len;
+
+  ok = write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+       write(fd, key, key_len) == (ssize_t)key_len &&
+       write(fd, code, code_len) == (ssize_t)code_len;
+  ok = close(fd) == 0 && ok;
+
+  /* rename so concurrent requests never read a partial entry */
+  if(!ok || rename(tmp, entry) != 0)
+  {
+    CosaPhpExtLog("bytecode cache: failed to write %s\n", entry);
+    unlink(tmp);
+  }
+}
+
+/* precompiled template from the site bundle (jst --precompile), if any */
+static int bundle_lookup(const char* path, char** bufout, size_t* lenout)
+{
+  const char* root = load_template_root();
+  size_t root_len = strlen(root);
+  const char* code;
+  size_t code_len;
+  const char* includes;
+  size_t includes_len;
+
+  if(strncmp(path, root, root_len) != 0)
+    return 0;
+
+  code = jst_bundle_find(path + root_len, &code_len, &includes, &includes_len);
+  if(!code)
+    return 0;
+
+  *bufout = (char*)malloc(code_len);
+  if(!*bufout)
+    return 0;
+  memcpy(*bufout, code, code_len);
+  *lenout = code_len;
+  return 1;
+}
+
+/* Compile src with flags and dump it. Returns 1 with *bufout the
+   bytecode, else 0 and the caller runs the source, which reports the
+   compile error. The static content table of a template is kept after
+   the bytecode (jst_output.c). */
+static int compile_dump(duk_context *ctx, const char* filename, duk_uint_t flags, const char* src, size_t src_len, char** bufout, size_t* lenout)
+{
+  void* code;
+  duk_size_t code_len;
+  size_t js_len = jst_static_code_len(src, src_len);
+  char* buf;
+
+  duk_push_string(ctx, filename);
+  if(duk_pcompile_lstring_filename(ctx, flags, src, js_len) != 0)
+  {
+    duk_pop(ctx);
+    return 0;
+  }
+
+  duk_dump_function(ctx);
+  code = duk_get_buffer(ctx, -1, &code_len);
+  buf = (char*)malloc(code_len + src_len - js_len);
+  if(buf)
+  {
+    memcpy(buf, code, code_len);
+    memcpy(buf + code_len, src + js_len, src_len - js_len);
+    *bufout = buf;
+    *lenout = code_len + src_len - js_len;
+  }
+  duk_pop(ctx);
+  return buf != NULL;
+}
+
+/* store code for an entry keyed by name and the single file path it was
+   built from, or every file of the include registry if path is NULL,
+   read at started, and the NUL separated units it runs */
+static void cache_store_file(const char* entry, const char* root, const char* name, const char* path, time_t started,
+                             const char* units, size_t units_len, const char* code, size_t code_len)
+{
+  char* key = NULL;
+  size_t key_len = 0;
+  time_t newest = 0;
+  FILE* f = key_open(&key, &key_len, root, name);
+  const char* dep;
+  int i;
+
+  if(!f)
+    return;
+  if(path)
+    key_add_dep(f, path, &newest, NULL, 0, NULL);
+  else
+    for(i = 0; (dep = load_template_registry(i)) != NULL; ++i)
+      key_add_dep(f, dep, &newest, NULL, 0, NULL);
+  key_add_units(f, units, units_len);
+
+  /* a file modified in the same second it was read might change again
+     without a visible mtime change; don't cache it yet */
+  if(fclose(f) == 0 && newest < started - 1)
+    cache_store(entry, key, key_len, code, code_len);
+  free(key);
+}
+
+/* with a translation catalog an entry is kept per catalog */
+static void cache_entry(char* entry, size_t entry_len, const char* dir, const char* name)
+{
+  const char* catalog = jst_i18n_catalog();
+  uint64_t h = cache_hash(name);
+
+  if(catalog)
+    h ^= cache_hash(catalog) * 31;
+  snprintf(entry, entry_len, "%s/%016llx.jstc", dir, (unsigned long long)h);
+}
+
+/* a static page (load_template_static): JST_STATIC_PAGE and the content */
+static int static_page(const char *filename, char** bufout, size_t* lenout)
+{
+  char* content;
+  size_t content_len;
+
+  if(!load_template_static(filename, &content, &content_len))
+    return 0;
+
+  *bufout = (char*)malloc(content_len + 1);
+  if(*bufout)
+  {
+    (*bufout)[0] = JST_STATIC_PAGE;
+    memcpy(*bufout + 1, content, content_len);
+  }
+  *lenout = *bufout ? content_len + 1 : 0;
+  free(content);
+  return *bufout != NULL;
+}
+
+/* parse the template filename with mode; a page without code is static */
+static int template_parse(const char *filename, int mode, char** bufout, size_t* lenout, int* is_static)
+{
+  char* page;
+  size_t page_len;
+
+  *is_static = 0;
+  if(!load_template_file(filename, bufout, lenout, mode))
+    return 0;
+
+  if(mode == LOAD_TEMPLATE_BODY && load_template_is_static() &&
+     static_page(filename, &page, &page_len))
+  {
+    free(*bufout);
+    *bufout = page;
+    *lenout = page_len;
+    *is_static = 1;
+  }
+  return (int)*lenout;
+}
+
+/* bytecode for the template filename, found at path, parsed with mode.
+   compiled is set to 1 if it was parsed rather than taken from the
+   bundle or the cache. */
+static int template_bytecode(duk_context *ctx, const char *filename, const char* path, int mode, char** bufout, size_t* lenout, int* compiled)
+{
+  const char* dir = cache_dir();
+  char entry[512];
+  char* src;
+  size_t src_len;
+  time_t started;
+  int is_static;
+  const char* units;
+  size_t units_len;
+  size_t units_start;
+
+  *compiled = 0;
+  if(bundle_lookup(path, bufout, lenout))
+    return (int)*lenout;
+
+  *compiled = 1;
+  if(!dir)
+    return template_parse(filename, mode, bufout, lenout, &is_static);
+
+  cache_entry(entry, sizeof(entry), dir, path);
+  if(cache_lookup(entry, load_template_root(), path, bufout, lenout))
+  {
+    *compiled = 0;
+    return (int)*lenout;
+  }
+
+  /* a unit's parse adds its includes to those of the page */
+  load_template_units(&units_start);
+  started = time(NULL);
+  if(!template_parse(filename, mode, &src, &src_len, &is_static))
+    return 0;
+  units = load_template_units(&units_len);
+
+  /* a static page depends on the includes it inlined */
+  if(is_static)
+  {
+    *bufout = src;
+    *lenout = src_len;
+    cache_store_file(entry, load_template_root(), path, NULL, started, NULL, 0, src, src_len);
+  }
+  else if(compile_dump(ctx, filename, 0, src, src_len, bufout, lenout))
+  {
+    free(src);
+    cache_store_file(entry, load_template_root(), path, path, started,
+                     units + units_start, units_len - units_start, *bufout, *lenout);
+  }
+  else
+  {
+    *bufout = src;
+    *lenout = src_len;
+  }
+  return (int)*lenout;
+}
+
+int load_template_bytecode(duk_context *ctx, const char *filename, char** bufout, size_t* lenout)
+{
+  char page[512];
+  int compiled;
+
+  if(!load_template_resolve(filename, page, sizeof(page)))
+    return 0;
+
+  /* a parse registers the page itself, a cached copy doesn't */
+  load_template_mark_included(page);
+
+  if(g_page_code && strcmp(g_page_path, page) == 0)
+  {
+    *bufout = g_page_code;
+    *lenout = g_page_code_len;
+    g_page_code = NULL;
+    return (int)*lenout;
+  }
+  return template_bytecode(ctx, filename, page, LOAD_TEMPLATE_BODY, bufout, lenout, &compiled);
+}
+
+/* 1 if the content has something else than whitespace */
+static int content_visible(const char* s, size_t len)
+{
+  size_t i;
+
+  for(i = 0; i < len; ++i)
+    if(!isspace((unsigned char)s[i]))
+      return 1;
+  return 0;
+}
+
+int load_template_static_page(const char *filename, char** bufout, size_t* lenout)
+{
+  const char* dir = cache_dir();
+  char page[512];
+  char entry[512];
+  char* code;
+  size_t code_len;
+  jst_file file;
+
+  free(g_page_code);
+  g_page_code = NULL;
+
+  if(!load_template_resolve(filename, page, sizeof(page)))
+    return 0;
+
+  if(bundle_lookup(page, &code, &code_len) ||
+     (dir && (cache_entry(entry, sizeof(entry), dir, page),
+              cache_lookup(entry, load_template_root(), page, &code, &code_len))))
+  {
+    if(code[0] == JST_STATIC_PAGE)
+    {
+      *bufout = code;
+      *lenout = code_len;
+      return 1;
+    }
+    g_page_code = code;
+    g_page_code_len = code_len;
+    snprintf(g_page_path, sizeof(g_page_path), "%s", page);
+    return 0;
+  }
+
+  /* not compiled yet: without a single tag the file is one content block.
+     Whitespace only content is written as nothing, not even the header.
+     A page with code, the usual case, is only looked at where it is mapped. */
+  if(!map_file(page, &file))
+    return 0;
+  if(memmem(file.data, file.len, "<?%", 3) || !content_visible(file.data, file.len))
+  {
+    unmap_file(&file);
+    return 0;
+  }
+
+  *bufout = (char*)malloc(file.len + 1);
+  if(*bufout)
+  {
+    (*bufout)[0] = JST_STATIC_PAGE;
+    memcpy(*bufout + 1, file.data, file.len);
+  }
+  *lenout = *bufout ? file.len + 1 : 0;
+  unmap_file(&file);
+  return *bufout != NULL;
+}
+
+int load_template_unit(duk_context *ctx, const char *filename, char** bufout, size_t* lenout)
+{
+  char path[512];
+  int compiled;
+
+  if(snprintf(path, sizeof(path), "%s%s", load_template_root(), filename) >= (int)sizeof(path))
+    return 0;
+
+  return template_bytecode(ctx, filename, path, LOAD_TEMPLATE_UNIT, bufout, lenout, &compiled);
+}
+
+#define MODULE_HEAD "function (require, exports, module) {"
+#define MODULE_TAIL "\n}"
+
+int load_template_module(duk_context *ctx, const char* path, char** bufout, size_t* lenout)
+{
+  const char* dir = cache_dir();
+  char name[520];
+  char entry[512];
+  jst_file src;
+  char* fn;
+  size_t fn_len;
+  time_t started;
+
+  /* a module is compiled differently from a unit of the same file */
+  if(snprintf(name, sizeof(name), "module:%s", path) >= (int)sizeof(name))
+    return 0;
+
+  if(dir)
+  {
+    cache_entry(entry, sizeof(entry), dir, name);
+    if(cache_lookup(entry, load_template_root(), name, bufout, lenout))
+      return (int)*lenout;
+  }
+
+  started = time(NULL);
+  if(!map_file(path, &src))
+    return 0;
+
+  /* the wrapper Duktape's require() puts around a module's source */
+  fn_len = sizeof(MODULE_HEAD) - 1 + src.len + sizeof(MODULE_TAIL) - 1;
+  fn = (char*)malloc(fn_len);
+  if(!fn)
+  {
+    unmap_file(&src);
+    return 0;
+  }
+  memcpy(fn, MODULE_HEAD, sizeof(MODULE_HEAD) - 1);
+  memcpy(fn + sizeof(MODULE_HEAD) - 1, src.data, src.len);
+  memcpy(fn + sizeof(MODULE_HEAD) - 1 + src.len, MODULE_TAIL, sizeof(MODULE_TAIL) - 1);
+  unmap_file(&src);
+
+  if(compile_dump(ctx, path, DUK_COMPILE_FUNCTION, fn, fn_len, bufout, lenout))
+  {
+    free(fn);
+    if(dir)
+      cache_store_file(entry, load_template_root(), name, path, started, NULL, 0, *bufout, *lenout);
+  }
+  else
+  {
+    *bufout = fn;
+    *lenout = fn_len;
+  }
+  return (int)*lenout;
+}
+
+static char* copy_code(const char* code, size_t len)
+{
+  char* copy = (char*)malloc(len);
+
+  if(copy)
+    memcpy(copy, code, len);
+  return copy;
+}
+
+int load_template_include(duk_context *ctx, const char *filename, char** bufout, size_t* lenout)
+{
+  char path[512];
+  struct stat st;
+  include_memo* memo;
+  int compiled;
+  int have_stat;
+
+  if(snprintf(path, sizeof(path), "%s%s", load_template_root(), filename) >= (int)sizeof(path))
+    return 0;
+
+  /* a bundle without the sources has nothing to stat; it is cheap anyway */
+  have_stat = stat(path, &st) == 0;
+  if(have_stat)
+  {
+    for(memo = g_include_memo; memo; memo = memo->next)
+    {
+      if(strcmp(memo->path, path) != 0)
+        continue;
+      if(!memo->code || memo->size != st.st_size ||
+         memo->mtime.tv_sec != st.st_mtim.tv_sec ||
+         memo->mtime.tv_nsec != st.st_mtim.tv_nsec)
+        break;
+      *bufout = copy_code(memo->code, memo->code_len);
+      if(!*bufout)
+        return 0;
+      *lenout = memo->code_len;
+      g_include_stats.hits++;
+      CosaPhpExtLog("include %s from %s: hit\n", filename, load_template_page());
+      return (int)*lenout;
+    }
+  }
+
+  if(!template_bytecode(ctx, filename, path, LOAD_TEMPLATE_UNIT, bufout, lenout, &compiled))
+    return 0;
+
+  if(compiled)
+    g_include_stats.misses++;
+  else
+    g_include_stats.loads++;
+  CosaPhpExtLog("include %s from %s: %s\n", filename, load_template_page(), compiled ? "miss" : "cached");
+
+  /* only bytecode is kept, a source fallback is a compile error to
+     report; as in the cache, a file modified within the last second
+     might change again without a visible mtime change */
+  if(!have_stat || !*lenout || (*bufout)[0] != (char)0xbf ||
+     st.st_mtim.tv_sec >= time(NULL) - 1)
+    return (int)*lenout;
+
+  if(!memo)
+  {
+    if(g_include_memo_count == JST_INCLUDE_MEMO_MAX)
+      return (int)*lenout;
+    memo = (include_memo*)calloc(1, sizeof(include_memo));
+    if(!memo || !(memo->path = strdup(path)))
+    {
+      free(memo);
+      return (int)*lenout;
+    }
+    memo->next = g_include_memo;
+    g_include_memo = memo;
+    g_include_memo_count++;
+  }
+
+  free(memo->code);
+  memo->code = copy_code(*bufout, *lenout);
+  memo->code_len = memo->code ? *lenout : 0;
+  memo->size = st.st_size;
+  memo->mtime = st.st_mtim;
+  return (int)*lenout;
+}
+
+void load_template_include_stats(jst_include_stats* stats)
+{
+  *stats = g_include_stats;
+}
+
+int load_template_prelude(duk_context *ctx, const char** code, size_t* len)
+{
+  const char* dir;
+  const char* found;
+  size_t found_len;
+  const char* includes;
+  size_t includes_len;
+  char entry[512];
+  jst_file src;
+  time_t started;
+
+  if(g_prelude)
+    goto done;
+
+  found = jst_bundle_find(JST_BUNDLE_PRELUDE, &found_len, &includes, &includes_len);
+  if(found)
+  {
+    g_prelude = (char*)malloc(found_len);
+    if(!g_prelude)
+      return 0;
+    memcpy(g_prelude, found, found_len);
+    g_prelude_len = found_len;
+    goto done;
+  }
+
+  /* the prelude doesn't depend on the document root, its key has none */
+  dir = cache_dir();
+  if(dir)
+  {
+    cache_entry(entry, sizeof(entry), dir, JST_PRELUDE_PATH);
+    if(cache_lookup(entry, "", JST_PRELUDE_PATH, &g_prelude, &g_prelude_len))
+      goto done;
+  }
+
+  started = time(NULL);
+  if(!map_file(JST_PRELUDE_PATH, &src))
+  {
+    fprintf(stderr, "Error: cannot open file:%s error:%s\n", JST_PRELUDE_PATH, strerror(errno));
+    return 0;
+  }
+
+  if(compile_dump(ctx, "jst_prefix.js", 0, src.data, src.len, &g_prelude, &g_prelude_len))
+  {
+    if(dir)
+      cache_store_file(entry, "", JST_PRELUDE_PATH, JST_PRELUDE_PATH, started, NULL, 0, g_prelude, g_prelude_len);
+  }
+  else if((g_prelude = copy_code(src.data, src.len)) != NULL)
+  {
+    /* the source, which reports the compile error when it runs */
+    g_prelude_len = src.len;
+  }
+  unmap_file(&src);
+  if(!g_prelude)
+    return 0;
+
+done:
+  *code = g_prelude;
+  *len = g_prelude_len;
+  return 1;
+}
@@ -0,0 +1,228 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+/*
+  jst-cgi: drop-in CGI interpreter that hands the request to a running
+  'jst --zygote' daemon instead of starting a new interpreter.
+  Our argv, environment and stdin/stdout/stderr are passed over the zygote
+  socket, the forked child writes the response straight to our stdout and
+  its exit status is returned as ours.
+  If the zygote can't be reached, or the process listening on the socket
+  is neither root nor our own user, the real jst binary is exec'd so the
+  request is still served, just without the warm start.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "jst_zygote.h"
+
+#ifndef JST_CGI_FALLBACK
+#define JST_CGI_FALLBACK "/usr/sbin/jst"
+#endif
+
+extern char** environ;
+
+static int connect_zygote(const char* path)
+{
+  struct sockaddr_un addr;
+  struct ucred cred;
+  socklen_t cred_len = sizeof(cred);
+  int fd;
+
+  if(strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0)
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  /* the request's stdio, cookies and body only go to a zygote we trust */
+  if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+     (cred.uid != 0 && cred.uid != geteuid()))
+  {
+    fprintf(stderr, "Error: %s is not a zygote of root or this user, not using it\n", path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int write_full(int fd, const char* buf, size_t len)
+{
+  while(len)
+  {
+    ssize_t n = write(fd, buf, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int send_request(int fd, int argc, char** argv)
+{
+  jst_zygote_header header;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr* cmsg;
+  char control[CMSG_SPACE(sizeof(int) * JST_ZYGOTE_NUM_FDS)];
+  int stdio_fds[JST_ZYGOTE_NUM_FDS] = { 0, 1, 2 };
+  char* payload;
+  char* p;
+  size_t len = 0;
+  int envc = 0;
+  int i;
+  ssize_t n;
+
+  for(i = 0; i < argc; ++i)
+    len += strlen(argv[i]) + 1;
+  for(envc = 0; environ[envc]; ++envc)
+    len += strlen(environ[envc]) + 1;
+
+  if(len > JST_ZYGOTE_MAX_PAYLOAD)
+  {
+    fprintf(stderr, "Error: request environment too large for zygote\n");
+    return -1;
+  }
+
+  payload = (char*)malloc(len ? len : 1);
+  if(!payload)
+    return -1;
+
+  p = payload;
+  for(i = 0; i < argc; ++i)
+  {
+    size_t l = strlen(argv[i]) + 1;
+    memcpy(p, argv[i], l);
+    p += l;
+  }
+  for(i = 0; i < envc; ++i)
+  {
+    size_t l = strlen(environ[i]) + 1;
+    memcpy(p, environ[i], l);
+    p += l;
+  }
+
+  header.magic = JST_ZYGOTE_MAGIC;
+  header.payload_len = (uint32_t)len;
+  header.argc = (uint32_t)argc;
+  header.envc = (uint32_t)envc;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(header);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(stdio_fds));
+  memcpy(CMSG_DATA(cmsg), stdio_fds, sizeof(stdio_fds));
+
+  do
+  {
+    n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while(n < 0 && errno == EINTR);
+
+  if(n != (ssize_t)sizeof(header) || write_full(fd, payload, len) != 0)
+  {
+    free(payload);
+    return -1;
+  }
+
+  free(payload);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  const char* socket_path = getenv("JST_ZYGOTE_SOCKET");
+  int32_t status = 1;
+  char* p = (char*)&status;
+  size_t got = 0;
+  int fd;
+
+  if(!socket_path)
+    socket_path = JST_ZYGOTE_SOCKET;
+
+  fd = connect_zygote(socket_path);
+  if(fd < 0 || send_request(fd, argc, argv) != 0)
+  {
+    if(fd >= 0)
+      close(fd);
+    /* one page per process: ask for the minimal --cgi startup */
+    if(argc > 1)
+    {
+      char** args = (char**)malloc((argc + 2) * sizeof(char*));
+      if(args)
+      {
+        args[0] = (char*)JST_CGI_FALLBACK;
+        args[1] = (char*)"--cgi";
+        memcpy(args + 2, argv + 1, argc * sizeof(char*));
+        execv(JST_CGI_FALLBACK, args);
+        free(args);
+      }
+    }
+    argv[0] = (char*)JST_CGI_FALLBACK;
+    execv(JST_CGI_FALLBACK, argv);
+    fprintf(stderr, "Error: zygote at %s not available and failed to exec %s\n", socket_path, JST_CGI_FALLBACK);
+    return 1;
+  }
+
+  /* the child owns our stdio from here on; we only wait for its exit status */
+  while(got < sizeof(status))
+  {
+    ssize_t n = read(fd, p + got, sizeof(status) - got);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+    {
+      fprintf(stderr, "Error: zygote request terminated abnormally\n");
+      close(fd);
+      return 1;
+    }
+    got += n;
+  }
+
+  close(fd);
+  return status;
+}
@@ -111,6 +111,13 @@ int cosa_init()
 {
   FILE *fp = NULL;
   int iReturnStatus = 0;
+
+  /* long-lived processes (fastcgi workers) open this module once per request
+     but must keep a single message bus connection */
+  if (bus_handle)
+  {
+    return 1;
+  }
   
   /* Check if this is a PC simulation */
   fp = fopen(COSA_PHP_EXT_PCSIM, "r");
@@ -169,6 +176,234 @@ int get_array_length(duk_context *ctx, duk_idx_t i)
 #define RETURN_TRUE { duk_push_true(ctx); return 1; }
 #define RETURN_FALSE { duk_push_false(ctx); return 1; }
 
+/*
+  Data model prefetch: the parser starts a run page with a call to
+  prefetch() listing the parameters the page and its includes read with
+  getStr("literal") (template_prefetch in jst_parser.c). They are fetched
+  with one component lookup per object and one CcspBaseIf_getParameterValues
+  per owning component, instead of a lookup and a get per getStr, and
+  getStr is served from them until anything is set, added or deleted, or
+  the request ends. A parameter that couldn't be prefetched is read by
+  getStr as before. ccsp_cosa_module_close logs the bus calls saved.
+*/
+typedef struct prefetch_value
+{
+    char* name;     /* as given to getStr, with the subsystem prefix */
+    char* value;
+}prefetch_value;
+
+static prefetch_value* g_prefetch         = NULL;
+static int             g_prefetch_count   = 0;
+static int             g_prefetch_calls   = 0;  /* bus calls made by prefetch */
+static int             g_prefetch_served  = 0;  /* getStr calls it saved */
+
+static void prefetch_clear(void)
+{
+    int i;
+
+    for (i = 0; i < g_prefetch_count; i++)
+    {
+        free(g_prefetch[i].name);
+        free(g_prefetch[i].value);
+    }
+    free(g_prefetch);
+    g_prefetch = NULL;
+    g_prefetch_count = 0;
+}
+
+static const char* prefetch_find(const char* name)
+{
+    int i;
+
+    for (i = 0; i < g_prefetch_count; i++)
+    {
+        if (!strcmp(g_prefetch[i].name, name))
+        {
+            return g_prefetch[i].value;
+        }
+    }
+    return NULL;
+}
+
+static void prefetch_add(const char* prefix, const char* name, const char* value)
+{
+    prefetch_value* values = realloc(g_prefetch, (g_prefetch_count + 1) * sizeof(prefetch_value));
+    char* full = malloc(strlen(prefix) + strlen(name) + 1);
+
+    if (values)
+    {
+        g_prefetch = values;
+    }
+    if (!values || !full)
+    {
+        free(full);
+        return;
+    }
+    sprintf(full, "%s%s", prefix, name);
+    g_prefetch[g_prefetch_count].name = full;
+    g_prefetch[g_prefetch_count].value = strdup(value ? value : "");
+    if (!g_prefetch[g_prefetch_count].value)
+    {
+        free(full);
+        return;
+    }
+    g_prefetch_count++;
+}
+
+/* a parameter to prefetch and the component that owns it */
+typedef struct prefetch_param
+{
+    char*   dotstr;         /* without the subsystem prefix */
+    char    prefix[6];
+    size_t  object_len;     /* of the object name, up to the last '.' */
+    char*   component;      /* shared by the parameters of an object */
+    char*   path;
+    int     owner;          /* 1 if component and path are to be freed here */
+    int     done;
+}prefetch_param;
+
+/* prefetch(names): see above */
+static duk_ret_t prefetch(duk_context *ctx)
+{
+    prefetch_param*         params;
+    char**                  names;
+    duk_size_t              count;
+    duk_size_t              n = 0;
+    duk_size_t              i;
+    duk_size_t              j;
+
+    if (!duk_is_array(ctx, 0) || !bus_handle)
+    {
+        return 0;
+    }
+    count = duk_get_length(ctx, 0);
+    params = calloc(count ? count : 1, sizeof(prefetch_param));
+    names = calloc(count ? count : 1, sizeof(char*));
+    if (!params || !names)
+    {
+        free(params);
+        free(names);
+        return 0;
+    }
+
+    /* the owning component of each parameter, looked up once per object */
+    for (i = 0; i < count; i++)
+    {
+        const char* name;
+        char*       dotstr;
+
+        memset(&params[n], 0, sizeof(prefetch_param));
+        duk_get_prop_index(ctx, 0, (duk_uarridx_t)i);
+        name = duk_get_string(ctx, -1);
+        if (!name || prefetch_find(name) || !(params[n].dotstr = strdup(name)))
+        {
+            duk_pop(ctx);
+            continue;
+        }
+        duk_pop(ctx);
+
+        dotstr = params[n].dotstr;
+        CheckAndSetSubsystemPrefix(&dotstr, params[n].prefix);
+        memmove(params[n].dotstr, dotstr, strlen(dotstr) + 1);
+        dotstr = strrchr(params[n].dotstr, '.');
+        params[n].object_len = dotstr ? (size_t)(dotstr - params[n].dotstr) + 1 : 0;
+
+        for (j = 0; j < n; j++)
+        {
+            if (params[j].object_len == params[n].object_len && !strcmp(params[j].prefix, params[n].prefix) &&
+                !strncmp(params[j].dotstr, params[n].dotstr, params[n].object_len))
+            {
+                params[n].component = params[j].component;
+                params[n].path = params[j].path;
+                break;
+            }
+        }
+        if (!params[n].component)
+        {
+            g_prefetch_calls++;
+            if (UiDbusClientGetDestComponent(params[n].dotstr, &params[n].component, &params[n].path, params[n].prefix) != 0)
+            {
+                free(params[n].dotstr);
+                continue;
+            }
+            params[n].owner = 1;
+        }
+        n++;
+    }
+
+    /* one get per component */
+    for (i = 0; i < n; i++)
+    {
+        parameterValStruct_t ** parameterVal = NULL;
+        int                     size = 0;
+        int                     batch = 0;
+        int                     iReturn;
+
+        if (params[i].done)
+        {
+            continue;
+        }
+        for (j = i; j < n; j++)
+        {
+            if (!params[j].done && !strcmp(params[j].component, params[i].component) &&
+                !strcmp(params[j].path, params[i].path) && !strcmp(params[j].prefix, params[i].prefix))
+            {
+                names[batch++] = params[j].dotstr;
+                params[j].done = 1;
+            }
+        }
+
+        g_prefetch_calls++;
+        iReturn = CcspBaseIf_getParameterValues(bus_handle,
+                                                params[i].component,
+                                                params[i].path,
+                                                names,
+                                                batch,
+                                                &size,
+                                                &parameterVal);
+        if (CCSP_SUCCESS != iReturn)
+        {
+            CosaPhpExtLog("prefetch: CcspBaseIf_getParameterValues of %d parameters from %s failed, error code = %d.\n",
+                          batch, params[i].component, iReturn);
+            continue;
+        }
+        for (j = 0; j < (duk_size_t)size; j++)
+        {
+            prefetch_add(params[i].prefix, parameterVal[j]->parameterName, parameterVal[j]->parameterValue);
+        }
+        free_parameterValStruct_t(bus_handle, size, parameterVal);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        free(params[i].dotstr);
+        if (params[i].owner)
+        {
+            free(params[i].component);
+            free(params[i].path);
+        }
+    }
+    free(params);
+    free(names);
+    return 0;
+}
+
+void ccsp_cosa_module_close(void)
+{
+    /* every getStr served saved a component lookup and a get */
+    if (g_prefetch_calls || g_prefetch_served)
+    {
+        const char* page = jst_getenv("SCRIPT_FILENAME");
+
+        CosaPhpExtLog("prefetch %s: %d getStr served by %d bus calls, %d round trips saved\n",
+                      page ? page : "", g_prefetch_served, g_prefetch_calls,
+                      g_prefetch_served * 2 - g_prefetch_calls);
+    }
+    prefetch_clear();
+    g_prefetch_calls = 0;
+    g_prefetch_served = 0;
+}
+
 static duk_ret_t getStr(duk_context *ctx)
 {
     char*                   dotstr              = 0;
@@ -179,6 +414,7 @@ static duk_ret_t getStr(duk_context *ctx)
     char                    retParamVal[1536]   = {0};
     int                     iReturn             = 0;
     char                    subSystemPrefix[6]  = {0};
+    const char*             prefetched          = NULL;
 
     //Parse Input parameters first
     if (!parse_parameter(__FUNCTION__, ctx, "s", &dotstr))
@@ -186,6 +422,14 @@ static duk_ret_t getStr(duk_context *ctx)
         RETURN_STRING("");
     }
 
+    prefetched = prefetch_find(dotstr);
+    if (prefetched)
+    {
+        g_prefetch_served++;
+        strncpy(retParamVal, prefetched, sizeof(retParamVal));
+        RETURN_STRING(retParamVal);
+    }
+
     //check whether there are subsystem prefix in the dot string
     //Split Subsytem prefix and COSA dotstr if subsystem prefix is found
     CheckAndSetSubsystemPrefix(&dotstr,subSystemPrefix); 
@@ -246,6 +490,9 @@ static duk_ret_t setStr(duk_context *ctx)
     char                          subSystemPrefix[6]    = {0};
     dbus_bool                     bDbusCommit           = 1;
 
+    /* what the page prefetched may change */
+    prefetch_clear();
+
     //Parse Parameters first
     if (!parse_parameter(__FUNCTION__, ctx, "ssb", &dotstr, &val, &bCommit))
     {
@@ -448,6 +695,9 @@ static duk_ret_t addTblObj(duk_context *ctx)
     int                             iReturnInstNum = 0;
     char                            subSystemPrefix[6] = {0};
 
+    /* what the page prefetched may change */
+    prefetch_clear();
+
     if (!parse_parameter(__FUNCTION__, ctx, "s", &dotstr))
     {
         iReturn = CCSP_FAILURE;
@@ -496,6 +746,9 @@ static duk_ret_t delTblObj(duk_context *ctx)
     int                             iReturn;
     char                            subSystemPrefix[6] = {0};
 
+    /* what the page prefetched may change */
+    prefetch_clear();
+
     if (!parse_parameter(__FUNCTION__, ctx, "s", &dotstr))
     {
         iReturn = CCSP_FAILURE;
@@ -709,6 +962,9 @@ static duk_ret_t DmExtSetStrsWithRootObj(duk_context *ctx)
     int                             iIndex              = 0;
     char*                           pFaultParamName     = NULL;
 
+    /* what the page prefetched may change */
+    prefetch_clear();
+
     /* Parse paremeters */
     if (!parse_parameter(__FUNCTION__, ctx, "sbo", &pRootObjName, &bCommit, &pParamArray))
     {
@@ -1032,6 +1288,7 @@ static const duk_function_list_entry ccsp_cosa_funcs[] = {
   { "DmExtGetStrsWithRootObj", DmExtGetStrsWithRootObj, DUK_VARARGS },
   { "DmExtSetStrsWithRootObj", DmExtSetStrsWithRootObj, DUK_VARARGS },
   { "DmExtGetInstanceIds", DmExtGetInstanceIds, DUK_VARARGS },
+  { "prefetch", prefetch, 1 },
   { NULL, NULL, 0 }
 };
 
@@ -1039,7 +1296,7 @@ duk_ret_t ccsp_cosa_module_open(duk_context *ctx)
 {
   cosa_init();
   duk_push_object(ctx);
-  duk_put_function_list(ctx, -1, ccsp_cosa_funcs);
+  jst_put_function_list(ctx, -1, ccsp_cosa_funcs);
   return 1;
 }
 
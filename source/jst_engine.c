@@ -0,0 +1,659 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "jst.h"
+#include "jst_engine.h"
+#include "jst_internal.h"
+
+#if defined(DUK_CMDLINE_PRINTALERT_SUPPORT)
+#include "duk_print_alert.h"
+#endif
+#if defined(DUK_CMDLINE_CONSOLE_SUPPORT)
+#include "duk_console.h"
+#endif
+#if defined(DUK_CMDLINE_LOGGING_SUPPORT)
+#include "duk_logging.h"
+#endif
+#if defined(DUK_CMDLINE_MODULE_SUPPORT)
+#include "duk_module_duktape.h"
+#endif
+
+struct jst_engine
+{
+  duk_context* ctx;
+};
+
+typedef struct engine_output
+{
+  char* data;
+  size_t len;
+  size_t alloc_len;
+}engine_output;
+
+/* output of the request being rendered, see engine_print */
+static engine_output* g_output = NULL;
+
+/* bytes from the kernel CSPRNG, the way session ids are made (jst_session.c),
+   with /dev/urandom for kernels without getrandom */
+static int engine_random_bytes(void* buf, size_t len)
+{
+  long n;
+  int fd;
+
+  do
+  {
+    n = syscall(SYS_getrandom, buf, len, 0);
+  } while(n < 0 && errno == EINTR);
+  if(n == (long)len)
+    return 0;
+
+  fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return -1;
+  n = read(fd, buf, len);
+  close(fd);
+  return n == (long)len ? 0 : -1;
+}
+
+// Function to generate secure random number: 0 to max, -1 on failure.
+// Not rand(): one process serves many requests, so tokens made from it
+// would be predictable from the ones a client saw before.
+int generateRandomNumber(int max) {
+    uint64_t range;
+    uint64_t limit;
+    uint32_t r;
+
+    if(max <= 0)
+      return 0;
+    range = (uint64_t)max + 1;
+    limit = (1ULL << 32) - (1ULL << 32) % range;  /* no modulo bias */
+    do
+    {
+      if(engine_random_bytes(&r, sizeof(r)) != 0)
+        return -1;
+    } while(r >= limit);
+    return (int)(r % range);
+}
+
+// C function that will be exposed to Duktape
+static duk_ret_t generate_random(duk_context *ctx) {
+    int max = duk_get_int(ctx, 0); // Get the maximum value from JavaScript arguments
+    int randomNumber = generateRandomNumber(max);
+    if(randomNumber < 0)
+      return duk_error(ctx, DUK_ERR_ERROR, "generateRandom: no random bytes available");
+    // Push the random number to the Duktape stack as a JavaScript number
+    duk_push_int(ctx, randomNumber);
+    return 1; // Number of return values
+}
+
+#if defined(DUK_CMDLINE_CONSOLE_SUPPORT)
+static void extra_console_init(duk_context *ctx)
+{
+  duk_console_init(ctx, DUK_CONSOLE_PROXY_WRAPPER | DUK_CONSOLE_FLUSH /*flags*/);
+}
+#endif
+
+#if defined(DUK_CMDLINE_LOGGING_SUPPORT)
+static void extra_logging_init(duk_context *ctx)
+{
+  duk_logging_init(ctx, 0 /*flags*/);
+}
+#endif
+
+#if defined(DUK_CMDLINE_MODULE_SUPPORT)
+/* Duktape.modSearch(id, require, exports, module): module ids are .js
+   files relative to the document root ("lib/util" is lib/util.js). The
+   function is created on the heap's own thread, so a module sees the heap
+   global (built-ins and the static bindings) and not the globals of the
+   request that loaded it first: Duktape.modLoaded keeps its exports for
+   the life of the heap. */
+static duk_ret_t engine_mod_search(duk_context *ctx)
+{
+  const char* id = duk_require_string(ctx, 0);
+  duk_context* heap;
+  char path[512];
+  char* buf;
+  size_t len;
+  duk_int_t rc = 0;
+
+  if(snprintf(path, sizeof(path), "%s%s.js", load_template_root(), id) >= (int)sizeof(path) ||
+     access(path, R_OK) != 0)
+    return duk_error(ctx, DUK_ERR_ERROR, "module not found: %s", id);
+
+  duk_push_heap_stash(ctx);
+  duk_get_prop_string(ctx, -1, "jst_heap");
+  heap = (duk_context*)duk_get_pointer(ctx, -1);
+  duk_pop_2(ctx);
+  if(!heap)
+    heap = ctx;
+
+  if(!load_template_module(heap, path, &buf, &len))
+    return duk_error(ctx, DUK_ERR_ERROR, "cannot load module %s", id);
+
+  if(len && buf[0] == (char)0xbf)
+  {
+    void* code = duk_push_fixed_buffer(heap, len);
+    memcpy(code, buf, len);
+    duk_load_function(heap);
+  }
+  else
+  {
+    duk_push_string(heap, path);
+    rc = duk_pcompile_lstring_filename(heap, DUK_COMPILE_FUNCTION, buf, len);
+  }
+  free(buf);
+  if(heap != ctx)
+    duk_xmove_top(ctx, heap, 1);
+  if(rc != 0)
+    return duk_throw(ctx);
+
+  duk_push_string(ctx, path);
+  duk_put_prop_string(ctx, 3, "filename");
+
+  /* called the way require() calls a module it compiled itself */
+  duk_dup(ctx, 2);
+  duk_dup(ctx, 1);
+  duk_get_prop_string(ctx, 3, "exports");
+  duk_dup(ctx, 3);
+  duk_call_method(ctx, 3);
+
+  /* no source returned: require() takes module.exports as it is */
+  return 0;
+}
+
+static void extra_module_init(duk_context *ctx)
+{
+  duk_module_duktape_init(ctx);
+
+  duk_get_global_string(ctx, "Duktape");
+  duk_push_c_function(ctx, engine_mod_search, 4);
+  duk_put_prop_string(ctx, -2, "modSearch");
+  duk_pop(ctx);
+}
+#endif
+
+/* Duktape extras that JST_HEAP_CGI installs on first access. Each one is
+   an accessor on the global (or Duktape) object; reading it runs the
+   extra's init, which replaces the accessor with the real value. */
+typedef struct lazy_extra
+{
+  const char* name;
+  int on_duktape;    /* property of the Duktape object instead of the global */
+  int enumerable;    /* as the extra's own init defines it */
+  void (*init)(duk_context *ctx);
+}lazy_extra;
+
+static const lazy_extra lazy_extras[] = {
+#if defined(DUK_CMDLINE_CONSOLE_SUPPORT)
+  { "console", 0, 1, extra_console_init },
+#endif
+#if defined(DUK_CMDLINE_LOGGING_SUPPORT)
+  { "Logger", 1, 0, extra_logging_init },
+#endif
+#if defined(DUK_CMDLINE_MODULE_SUPPORT)
+  { "require", 0, 0, extra_module_init },
+#endif
+  { NULL, 0, 0, NULL }
+};
+
+/* replace the accessor on 'this' by a plain data property holding the value on top */
+static void lazy_extra_define(duk_context *ctx, const lazy_extra* extra)
+{
+  duk_push_this(ctx);
+  duk_push_string(ctx, extra->name);
+  duk_dup(ctx, -3);
+  duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE |
+                        DUK_DEFPROP_SET_WRITABLE |
+                        DUK_DEFPROP_SET_CONFIGURABLE |
+                        (extra->enumerable ? DUK_DEFPROP_SET_ENUMERABLE : DUK_DEFPROP_CLEAR_ENUMERABLE));
+  duk_pop(ctx);
+}
+
+static duk_ret_t lazy_extra_get(duk_context *ctx)
+{
+  const lazy_extra* extra = &lazy_extras[duk_get_current_magic(ctx)];
+
+  /* the inits assign with a plain put, which an accessor without a
+     setter of its own would reject */
+  duk_push_undefined(ctx);
+  lazy_extra_define(ctx, extra);
+  duk_pop(ctx);
+
+  extra->init(ctx);
+
+  duk_push_this(ctx);
+  duk_get_prop_string(ctx, -1, extra->name);
+  return 1;
+}
+
+/* a page assigning the name before reading it just gets its own value */
+static duk_ret_t lazy_extra_set(duk_context *ctx)
+{
+  lazy_extra_define(ctx, &lazy_extras[duk_get_current_magic(ctx)]);
+  return 0;
+}
+
+static void lazy_extras_install(duk_context *ctx)
+{
+  int i;
+
+  for(i = 0; lazy_extras[i].name; ++i)
+  {
+    if(lazy_extras[i].on_duktape)
+      duk_get_global_string(ctx, "Duktape");
+    else
+      duk_push_global_object(ctx);
+
+    duk_push_string(ctx, lazy_extras[i].name);
+    duk_push_c_function(ctx, lazy_extra_get, 0);
+    duk_set_magic(ctx, -1, i);
+    duk_push_c_function(ctx, lazy_extra_set, 1);
+    duk_set_magic(ctx, -1, i);
+    duk_def_prop(ctx, -4, DUK_DEFPROP_HAVE_GETTER |
+                          DUK_DEFPROP_HAVE_SETTER |
+                          DUK_DEFPROP_SET_CONFIGURABLE |
+                          (lazy_extras[i].enumerable ? DUK_DEFPROP_SET_ENUMERABLE : 0));
+    duk_pop(ctx);
+  }
+}
+
+void jst_heap_init(duk_context *ctx, duk_uint_t flags)
+{
+#if defined(DUK_USE_ROM_OBJECTS)
+  /* ROM built-ins are read-only (see JST_ROM_BUILTINS): Logger, modLoaded
+     and the lazy extras go on a writable Duktape that inherits the ROM one.
+     The global object itself is writable with DUK_USE_ROM_GLOBAL_INHERIT. */
+  duk_push_object(ctx);
+  duk_get_global_string(ctx, "Duktape");
+  duk_set_prototype(ctx, -2);
+  duk_put_global_string(ctx, "Duktape");
+#endif
+
+  /* the thread modules are created on, see engine_mod_search */
+  duk_push_heap_stash(ctx);
+  duk_push_pointer(ctx, (void*)ctx);
+  duk_put_prop_string(ctx, -2, "jst_heap");
+  duk_pop(ctx);
+
+  /* Register print() and alert() (removed in Duktape 2.x). */
+#if defined(DUK_CMDLINE_PRINTALERT_SUPPORT)
+  duk_print_alert_init(ctx, 0 /*flags*/);
+#endif
+
+  if(flags & JST_HEAP_CGI)
+  {
+    /* console, Duktape.Logger and require() are rarely used by pages */
+    lazy_extras_install(ctx);
+    jst_use_lightfuncs = 1;
+  }
+  else
+  {
+    int i;
+
+    /* Register console object, Duktape.Logger and require() (removed
+       in Duktape 2.x). */
+    for(i = 0; lazy_extras[i].name; ++i)
+      lazy_extras[i].init(ctx);
+  }
+
+  if(jst_use_lightfuncs)
+    duk_push_c_lightfunc(ctx, generate_random, 1 /* number of arguments */, 1, 0);
+  else
+    duk_push_c_function(ctx, generate_random, 1 /* number of arguments */);
+  duk_put_global_string(ctx, "generateRandom");
+
+  jst_output_init(ctx);
+  ccsp_extensions_load_static(ctx);
+}
+
+duk_context* jst_push_request_thread(duk_context *ctx)
+{
+  duk_context* thr;
+
+  duk_push_thread_new_globalenv(ctx);
+  thr = duk_get_context(ctx, -1);
+
+  /* the request global falls back to the heap global for the bindings */
+  duk_push_global_object(thr);
+  duk_push_global_object(ctx);
+  duk_xmove_top(thr, ctx, 1);
+  duk_set_prototype(thr, -2);
+
+#if !defined(DUK_USE_ROM_OBJECTS)
+  /* same for the fresh Duktape built-in, so Duktape.Logger, modSearch etc.
+     set up on the heap's Duktape object are found. With ROM built-ins the
+     thread has no Duktape of its own and inherits the heap's. */
+  duk_get_prop_string(thr, -1, "Duktape");
+  duk_get_global_string(ctx, "Duktape");
+  duk_xmove_top(thr, ctx, 1);
+  duk_set_prototype(thr, -2);
+  duk_pop(thr);
+#endif
+  duk_pop(thr);
+
+  return thr;
+}
+
+static int output_push(engine_output* out, const char* s, size_t len)
+{
+  if(out->len + len > out->alloc_len)
+  {
+    size_t alloc_len = out->alloc_len ? out->alloc_len : 4096;
+    char* data;
+
+    while(alloc_len < out->len + len)
+      alloc_len *= 2;
+
+    data = (char*)realloc(out->data, alloc_len);
+    if(!data)
+    {
+      CosaPhpExtLog("failed to grow response buffer\n");
+      return 0;
+    }
+    out->data = data;
+    out->alloc_len = alloc_len;
+  }
+  memcpy(out->data + out->len, s, len);
+  out->len += len;
+  return 1;
+}
+
+/* print() for rendered pages: same formatting as the print() extra
+   (arguments joined by a space plus a newline, a single buffer argument
+   written raw) but collected into the response instead of stdout */
+static duk_ret_t engine_print(duk_context *ctx)
+{
+  duk_idx_t nargs = duk_get_top(ctx);
+  duk_idx_t i;
+  const char* s;
+  duk_size_t len;
+
+  if(!g_output)
+    return 0;
+
+  if(nargs == 1 && duk_is_buffer_data(ctx, 0))
+  {
+    s = (const char*)duk_get_buffer_data(ctx, 0, &len);
+    output_push(g_output, s, len);
+    return 0;
+  }
+
+  for(i = 0; i < nargs; ++i)
+  {
+    s = duk_to_lstring(ctx, i, &len);
+    output_push(g_output, s, len);
+    output_push(g_output, i == nargs - 1 ? "\n" : " ", 1);
+  }
+  if(nargs == 0)
+    output_push(g_output, "\n", 1);
+
+  return 0;
+}
+
+typedef struct engine_page
+{
+  const char* filename;
+  const char* data;   /* bytecode or source from load_template_bytecode */
+  size_t len;
+}engine_page;
+
+/* push the function for bytecode or source from the template loaders */
+static void engine_push_code(duk_context *ctx, const char* filename, const char* data, size_t len)
+{
+  len = jst_static_register(data, len);
+  if(len && data[0] == (char)0xbf)
+  {
+    void* code = duk_push_fixed_buffer(ctx, len);
+    memcpy(code, data, len);
+    duk_load_function(ctx);
+  }
+  else
+  {
+    duk_push_string(ctx, filename);
+    duk_compile_lstring_filename(ctx, 0, data, len);
+  }
+}
+
+/* the page threw a value with key set: _jst_exit_code for a
+   _jst_exit_exception from exit(), _jst_compile_error for an include
+   unit that didn't compile */
+static int engine_error_has(duk_context *ctx, duk_idx_t idx, const char* key)
+{
+  int has;
+
+  if(!duk_is_object(ctx, idx))
+    return 0;
+  duk_get_prop_string(ctx, idx, key);
+  has = !duk_is_undefined(ctx, -1);
+  duk_pop(ctx);
+  return has;
+}
+
+static duk_ret_t engine_run_page(duk_context *ctx, void *udata)
+{
+  engine_page* page = (engine_page*)udata;
+  const char* prelude;
+  size_t prelude_len;
+  duk_int_t rc;
+
+  /* nothing to run: print() what _jst_finish would */
+  if(page->len && page->data[0] == JST_STATIC_PAGE)
+  {
+    duk_get_global_string(ctx, "print");
+    duk_dup_top(ctx);
+    duk_push_string(ctx, "Content-type: text/html\r");
+    duk_call(ctx, 1);
+    duk_pop(ctx);
+    duk_push_string(ctx, "\r\n");
+    duk_push_lstring(ctx, page->data + 1, page->len - 1);
+    duk_concat(ctx, 2);
+    duk_call(ctx, 1);
+    return 1;
+  }
+
+  if(!load_template_prelude(ctx, &prelude, &prelude_len))
+    return duk_generic_error(ctx, "cannot load %s", JST_PRELUDE_PATH);
+
+  jst_output_reset();
+
+  /* compile both before running anything, like the single program did */
+  engine_push_code(ctx, "jst_prefix.js", prelude, prelude_len);
+  engine_push_code(ctx, page->filename, page->data, page->len);
+
+  /* [ prelude page ] */
+  duk_dup(ctx, 0);
+  rc = duk_pcall(ctx, 0);
+  if(rc == DUK_EXEC_SUCCESS)
+  {
+    duk_pop(ctx);
+    duk_dup(ctx, 1);
+    rc = duk_pcall(ctx, 0);
+  }
+
+  if(rc != DUK_EXEC_SUCCESS && engine_error_has(ctx, -1, "_jst_compile_error"))
+    return duk_throw(ctx);
+
+  if(rc != DUK_EXEC_SUCCESS && !engine_error_has(ctx, -1, "_jst_exit_code"))
+  {
+    CosaPhpExtLog("%s: %s\n", page->filename, duk_safe_to_string(ctx, -1));
+    return 0;
+  }
+  duk_pop(ctx);
+
+  duk_get_global_string(ctx, "_jst_finish");
+  duk_call(ctx, 0);
+  return 1;
+}
+
+duk_int_t jst_run_page(duk_context *ctx, const char *filename, const char *code, size_t len)
+{
+  engine_page page;
+
+  page.filename = filename;
+  page.data = code;
+  page.len = len;
+  return duk_safe_call(ctx, engine_run_page, (void*)&page, 0, 1);
+}
+
+void jst_write_static_page(FILE* f, const char* code, size_t len)
+{
+  fputs(JST_STATIC_HEADER, f);
+  fwrite(code + 1, 1, len - 1, f);
+  fputc('\n', f);
+  fflush(f);
+}
+
+static void engine_fatal_handler(void *udata, const char *msg)
+{
+  (void)udata;
+  fprintf(stderr, "*** FATAL ERROR: %s\n", msg ? msg : "no message");
+  fflush(stderr);
+  abort();
+}
+
+jst_engine* jst_engine_create(void)
+{
+  jst_engine* engine;
+  const char* prelude;
+  size_t prelude_len;
+
+  engine = (jst_engine*)calloc(1, sizeof(jst_engine));
+  if(!engine)
+    return NULL;
+
+  engine->ctx = duk_create_heap(NULL, NULL, NULL, NULL, engine_fatal_handler);
+  if(!engine->ctx)
+  {
+    fprintf(stderr, "Error: failed to create Duktape heap\n");
+    free(engine);
+    return NULL;
+  }
+
+  jst_heap_init(engine->ctx, 0);
+
+  if(!load_template_prelude(engine->ctx, &prelude, &prelude_len))
+  {
+    duk_destroy_heap(engine->ctx);
+    free(engine);
+    return NULL;
+  }
+
+  return engine;
+}
+
+int jst_render(jst_engine* engine, const jst_request* request, jst_response* response)
+{
+  duk_context* ctx = engine->ctx;
+  duk_context* thr;
+  engine_output out;
+  const char* filename;
+  char* buf = NULL;
+  size_t len = 0;
+  int rc = 1;
+
+  memset(&out, 0, sizeof(out));
+  response->data = NULL;
+  response->len = 0;
+
+  jst_set_request_input(request->env, request->cookies, request->body, request->body_len);
+
+  filename = jst_getenv("SCRIPT_FILENAME");
+  if(!filename)
+  {
+    fprintf(stderr, "Error: jst_render request without SCRIPT_FILENAME\n");
+    jst_set_request_input(NULL, NULL, NULL, 0);
+    return 1;
+  }
+
+  /* a static page needs neither a request thread nor the request modules */
+  if(load_template_static_page(filename, &buf, &len))
+  {
+    if(output_push(&out, JST_STATIC_HEADER, sizeof(JST_STATIC_HEADER) - 1) &&
+       output_push(&out, buf + 1, len - 1) &&
+       output_push(&out, "\n", 1))
+      rc = 0;
+    free(buf);
+    jst_set_request_input(NULL, NULL, NULL, 0);
+    response->data = out.data;
+    response->len = out.len;
+    return rc;
+  }
+
+  thr = jst_push_request_thread(ctx);
+
+  duk_push_c_function(thr, engine_print, DUK_VARARGS);
+  duk_put_global_string(thr, "print");
+
+  ccsp_extensions_load_request(thr);
+
+  g_output = &out;
+
+  if(load_template_bytecode(thr, filename, &buf, &len))
+  {
+    if(jst_run_page(thr, filename, buf, len) == DUK_EXEC_SUCCESS)
+    {
+      rc = 0;
+    }
+    else
+    {
+      fprintf(stderr, "Error: %s: %s\n", filename, duk_safe_to_string(thr, -1));
+    }
+    duk_pop(thr);
+    free(buf);
+  }
+  else
+  {
+    fprintf(stderr, "Error: failed to load %s\n", filename);
+  }
+
+  g_output = NULL;
+
+  ccsp_extensions_unload(thr);
+  duk_pop(ctx);
+
+  jst_set_request_input(NULL, NULL, NULL, 0);
+
+  response->data = out.data;
+  response->len = out.len;
+  return rc;
+}
+
+void jst_response_free(jst_response* response)
+{
+  free(response->data);
+  response->data = NULL;
+  response->len = 0;
+}
+
+void jst_engine_destroy(jst_engine* engine)
+{
+  if(!engine)
+    return;
+  duk_destroy_heap(engine->ctx);
+  free(engine);
+}
@@ -0,0 +1,75 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#ifndef JST_ENGINE_H
+#define JST_ENGINE_H
+
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+  libjst: render .jst pages inside the calling process.
+
+  An engine owns one Duktape heap with the jst bindings set up; every
+  jst_render call runs the page in its own global environment on that heap.
+  The parser and the ccsp modules keep per-request state in statics, so a
+  process may render only one request at a time.
+*/
+
+typedef struct jst_engine jst_engine;
+
+typedef struct jst_request
+{
+  /* CGI variables as a NULL terminated list of "NAME=value" strings.
+     SCRIPT_FILENAME/SCRIPT_NAME select the page, GATEWAY_INTERFACE=CGI/1.1
+     makes the document root derive from them as it does under a web server */
+  const char* const* env;
+  /* request body, read by $_POST/$_FILES instead of stdin */
+  const char* body;
+  size_t body_len;
+  /* raw Cookie header value; if non NULL it is used as HTTP_COOKIE */
+  const char* cookies;
+}jst_request;
+
+typedef struct jst_response
+{
+  /* CGI style output of the page: header lines, an empty line, the body.
+     Owned by the caller, release with jst_response_free */
+  char* data;
+  size_t len;
+}jst_response;
+
+jst_engine* jst_engine_create(void);
+
+/* Render the page named by SCRIPT_FILENAME in request->env.
+   Returns 0 on success; on failure response still holds whatever the page
+   printed before the error. */
+int jst_render(jst_engine* engine, const jst_request* request, jst_response* response);
+
+void jst_response_free(jst_response* response);
+
+void jst_engine_destroy(jst_engine* engine);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
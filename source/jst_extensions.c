@@ -17,30 +17,27 @@
  limitations under the License.
 */
 #include "jst_internal.h"
+#include "jst.h"
 
 duk_ret_t ccsp_cosa_module_open(duk_context *ctx);
 duk_ret_t ccsp_session_module_open(duk_context *ctx);
 duk_ret_t ccsp_post_module_open(duk_context *ctx);
 duk_ret_t ccsp_functions_module_open(duk_context *ctx);
+void ccsp_session_module_close(void);
+void ccsp_post_module_close(void);
+#ifdef BUILD_RDK
+void ccsp_cosa_module_close(void);
+#endif
 
-duk_ret_t ccsp_extensions_load(duk_context *ctx)
+/* modules without request state; safe to set up once in a long lived heap */
+duk_ret_t ccsp_extensions_load_static(duk_context *ctx)
 {
   init_logger();
 
-#ifdef BUILD_RDK
-  duk_push_c_function(ctx, ccsp_cosa_module_open, 0);
-  duk_call(ctx, 0);
-  duk_put_global_string(ctx, "ccsp_cosa");
-#endif
-
   duk_push_c_function(ctx, ccsp_session_module_open, 0);
   duk_call(ctx, 0);
   duk_put_global_string(ctx, "ccsp_session");
 
-  duk_push_c_function(ctx, ccsp_post_module_open, 0);
-  duk_call(ctx, 0);
-  duk_put_global_string(ctx, "ccsp_post");
-
   duk_push_c_function(ctx, ccsp_functions_module_open, 0);
   duk_call(ctx, 0);
   duk_put_global_string(ctx, "ccsp");
@@ -48,8 +45,77 @@ duk_ret_t ccsp_extensions_load(duk_context *ctx)
   return 1;
 }
 
+/* modules that read the request (post body) or own a bus connection.
+   They are installed as lazy getters on the global object: the module is
+   opened, and replaces the getter with a plain value, on first access, so
+   pages that never touch ccsp_cosa or $_POST/$_FILES skip the message bus
+   connect and the post body read/parse entirely */
+typedef struct lazy_module
+{
+  const char* name;
+  duk_c_function open;
+}lazy_module;
+
+static const lazy_module request_modules[] = {
+#ifdef BUILD_RDK
+  { "ccsp_cosa", ccsp_cosa_module_open },
+#endif
+  { "ccsp_post", ccsp_post_module_open },
+};
+
+static duk_ret_t lazy_module_get(duk_context *ctx)
+{
+  const lazy_module* module = &request_modules[duk_get_current_magic(ctx)];
+
+  duk_push_global_object(ctx);
+  duk_push_c_function(ctx, module->open, 0);
+  duk_call(ctx, 0);
+  duk_push_string(ctx, module->name);
+  duk_dup(ctx, -2);
+  duk_def_prop(ctx, -4, DUK_DEFPROP_HAVE_VALUE |
+                        DUK_DEFPROP_SET_WRITABLE |
+                        DUK_DEFPROP_SET_ENUMERABLE |
+                        DUK_DEFPROP_SET_CONFIGURABLE);
+  return 1;
+}
+
+duk_ret_t ccsp_extensions_load_request(duk_context *ctx)
+{
+  size_t i;
+
+  duk_push_global_object(ctx);
+  for(i = 0; i < sizeof(request_modules) / sizeof(request_modules[0]); ++i)
+  {
+    duk_push_string(ctx, request_modules[i].name);
+    duk_push_c_function(ctx, lazy_module_get, 0);
+    duk_set_magic(ctx, -1, (duk_int_t)i);
+    duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_GETTER |
+                          DUK_DEFPROP_SET_ENUMERABLE |
+                          DUK_DEFPROP_SET_CONFIGURABLE);
+  }
+  duk_pop(ctx);
+
+  return 1;
+}
+
+duk_ret_t ccsp_extensions_load(duk_context *ctx)
+{
+  ccsp_extensions_load_static(ctx);
+  ccsp_extensions_load_request(ctx);
+  return 1;
+}
+
 duk_ret_t ccsp_extensions_unload(duk_context *ctx)
 {
   (void)ctx;
+
+  /* reset the per-request state kept in module statics */
+  ccsp_session_module_close();
+  ccsp_post_module_close();
+#ifdef BUILD_RDK
+  ccsp_cosa_module_close();
+#endif
+  load_template_reset();
+
   return 1;
 }
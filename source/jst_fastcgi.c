@@ -0,0 +1,731 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "jst_fastcgi.h"
+#include "jst_internal.h"
+
+/*
+  Minimal FastCGI 1.0 responder (see the FastCGI specification, section 8).
+
+  The parent process binds the unix socket and pre-forks the workers.
+  Each worker accepts connections on the shared listening socket and
+  serves one request at a time: FCGI_PARAMS become the process environment
+  (only the CGI meta-variables and HTTP_* headers, so a request can't set
+  JST_CACHE_DIR, JST_TEXTDOMAIN, LANG and such) and FCGI_STDIN becomes
+  stdin, so the rest of jst (getenv, ccsp_post reading stdin, print
+  writing stdout) works exactly as it does under plain CGI.
+  Multiplexing is not supported (FCGI_MPXS_CONNS=0), which is what lighttpd
+  expects from a single-threaded backend.
+*/
+
+#define FCGI_VERSION_1          1
+#define FCGI_HEADER_LEN         8
+
+#define FCGI_BEGIN_REQUEST      1
+#define FCGI_ABORT_REQUEST      2
+#define FCGI_END_REQUEST        3
+#define FCGI_PARAMS             4
+#define FCGI_STDIN              5
+#define FCGI_STDOUT             6
+#define FCGI_GET_VALUES         9
+#define FCGI_GET_VALUES_RESULT  10
+#define FCGI_UNKNOWN_TYPE       11
+
+#define FCGI_RESPONDER          1
+#define FCGI_KEEP_CONN          1
+
+#define FCGI_REQUEST_COMPLETE   0
+#define FCGI_CANT_MPX_CONN      1
+#define FCGI_UNKNOWN_ROLE       3
+
+#define FCGI_MAX_CONTENT        65535
+#define FCGI_STDOUT_CHUNK       65528 /* largest multiple of 8 that fits a record */
+#define FCGI_MAX_PARAMS_SIZE    (256 * 1024)
+#define FCGI_MAX_STDIN_SIZE     (8 * 1048576) /* same limit as POST_MAX_SIZE in jst_post.c */
+#define FCGI_LISTEN_BACKLOG     64
+#define FCGI_MIN_UPTIME         2     /* a worker exiting sooner crashed at startup */
+#define FCGI_MAX_BACKOFF        32    /* seconds between restarts at most */
+
+typedef struct fcgi_buffer
+{
+  char* data;
+  size_t len;
+  size_t alloc;
+}fcgi_buffer;
+
+typedef struct fcgi_request
+{
+  int id;
+  int keep_conn;
+  int params_done;
+  int stdin_done;
+  fcgi_buffer params;
+  fcgi_buffer body;
+}fcgi_request;
+
+static volatile sig_atomic_t g_stop = 0;
+static char** g_base_env = NULL;
+
+static void fcgi_stop_handler(int sig)
+{
+  (void)sig;
+  g_stop = 1;
+}
+
+static int fcgi_buffer_push(fcgi_buffer* buf, const char* data, size_t len, size_t limit)
+{
+  if(buf->len + len > limit)
+    return -1;
+
+  if(buf->len + len + 1 > buf->alloc)
+  {
+    size_t alloc = buf->alloc ? buf->alloc : 1024;
+    char* rbuf;
+
+    while(alloc < buf->len + len + 1)
+      alloc *= 2;
+
+    rbuf = (char*)realloc(buf->data, alloc);
+    if(!rbuf)
+      return -1;
+    buf->data = rbuf;
+    buf->alloc = alloc;
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  buf->data[buf->len] = 0;
+  return 0;
+}
+
+static void fcgi_buffer_free(fcgi_buffer* buf)
+{
+  free(buf->data);
+  memset(buf, 0, sizeof(fcgi_buffer));
+}
+
+static void fcgi_request_reset(fcgi_request* req)
+{
+  fcgi_buffer_free(&req->params);
+  fcgi_buffer_free(&req->body);
+  memset(req, 0, sizeof(fcgi_request));
+}
+
+static int read_full(int fd, void* buf, size_t len)
+{
+  char* p = (char*)buf;
+
+  while(len)
+  {
+    ssize_t n = read(fd, p, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int write_full(int fd, const void* buf, size_t len)
+{
+  const char* p = (const char*)buf;
+
+  while(len)
+  {
+    ssize_t n = write(fd, p, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int fcgi_write_record(int fd, int type, int id, const char* content, size_t len)
+{
+  unsigned char header[FCGI_HEADER_LEN];
+
+  header[0] = FCGI_VERSION_1;
+  header[1] = (unsigned char)type;
+  header[2] = (unsigned char)((id >> 8) & 0xff);
+  header[3] = (unsigned char)(id & 0xff);
+  header[4] = (unsigned char)((len >> 8) & 0xff);
+  header[5] = (unsigned char)(len & 0xff);
+  header[6] = 0;
+  header[7] = 0;
+
+  if(write_full(fd, header, FCGI_HEADER_LEN) != 0)
+    return -1;
+  if(len && write_full(fd, content, len) != 0)
+    return -1;
+  return 0;
+}
+
+static int fcgi_write_end_request(int fd, int id, int app_status, int protocol_status)
+{
+  unsigned char body[8];
+
+  body[0] = (unsigned char)((app_status >> 24) & 0xff);
+  body[1] = (unsigned char)((app_status >> 16) & 0xff);
+  body[2] = (unsigned char)((app_status >> 8) & 0xff);
+  body[3] = (unsigned char)(app_status & 0xff);
+  body[4] = (unsigned char)protocol_status;
+  body[5] = body[6] = body[7] = 0;
+
+  return fcgi_write_record(fd, FCGI_END_REQUEST, id, (const char*)body, sizeof(body));
+}
+
+/* name-value pair lengths are 1 byte if < 128, else 4 bytes with the high bit set */
+static int fcgi_read_length(const unsigned char** p, const unsigned char* end, size_t* len)
+{
+  if(*p >= end)
+    return -1;
+
+  if(**p & 0x80)
+  {
+    if(end - *p < 4)
+      return -1;
+    *len = ((size_t)((*p)[0] & 0x7f) << 24) | ((size_t)(*p)[1] << 16) | ((size_t)(*p)[2] << 8) | (size_t)(*p)[3];
+    *p += 4;
+  }
+  else
+  {
+    *len = **p;
+    *p += 1;
+  }
+  return 0;
+}
+
+static void fcgi_get_values(int fd, const char* content, size_t len)
+{
+  const unsigned char* p = (const unsigned char*)content;
+  const unsigned char* end = p + len;
+  char reply[256];
+  size_t reply_len = 0;
+
+  while(p < end)
+  {
+    size_t nlen, vlen;
+    const char* value = NULL;
+
+    if(fcgi_read_length(&p, end, &nlen) || fcgi_read_length(&p, end, &vlen))
+      break;
+    if((size_t)(end - p) < nlen + vlen)
+      break;
+
+    if(nlen == 14 && !memcmp(p, "FCGI_MAX_CONNS", 14))
+      value = "1";
+    else if(nlen == 13 && !memcmp(p, "FCGI_MAX_REQS", 13))
+      value = "1";
+    else if(nlen == 15 && !memcmp(p, "FCGI_MPXS_CONNS", 15))
+      value = "0";
+
+    if(value && reply_len + 2 + nlen + 1 < sizeof(reply))
+    {
+      reply[reply_len++] = (char)nlen;
+      reply[reply_len++] = 1;
+      memcpy(reply + reply_len, p, nlen);
+      reply_len += nlen;
+      reply[reply_len++] = *value;
+    }
+    p += nlen + vlen;
+  }
+
+  fcgi_write_record(fd, FCGI_GET_VALUES_RESULT, 0, reply, reply_len);
+}
+
+/* the params a request may set: RFC 3875 meta-variables, those lighttpd,
+   nginx and apache add, and the HTTP_* request headers */
+static const char* const g_cgi_params[] =
+{
+  "AUTH_TYPE", "CONTENT_LENGTH", "CONTENT_TYPE", "DOCUMENT_ROOT", "DOCUMENT_URI",
+  "GATEWAY_INTERFACE", "HTTPS", "PATH_INFO", "PATH_TRANSLATED", "QUERY_STRING",
+  "REDIRECT_STATUS", "REMOTE_ADDR", "REMOTE_HOST", "REMOTE_IDENT", "REMOTE_PORT",
+  "REMOTE_USER", "REQUEST_METHOD", "REQUEST_SCHEME", "REQUEST_URI", "SCRIPT_FILENAME",
+  "SCRIPT_NAME", "SERVER_ADDR", "SERVER_NAME", "SERVER_PORT", "SERVER_PROTOCOL",
+  "SERVER_SOFTWARE", NULL
+};
+
+static int fcgi_param_allowed(const char* name, size_t len)
+{
+  int i;
+
+  if(len > 5 && memcmp(name, "HTTP_", 5) == 0)
+    return 1;
+  for(i = 0; g_cgi_params[i]; ++i)
+  {
+    if(strlen(g_cgi_params[i]) == len && memcmp(g_cgi_params[i], name, len) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+/* Build a new environ from the worker's startup environment plus the request params.
+   The strings live in 'strings' which must stay alive while the environ is installed. */
+static char** fcgi_build_env(fcgi_request* req, fcgi_buffer* strings)
+{
+  const unsigned char* p;
+  const unsigned char* end;
+  size_t base_count = 0;
+  size_t count = 0;
+  size_t capacity;
+  size_t* offsets;
+  char** env;
+  size_t i;
+
+  while(g_base_env && g_base_env[base_count])
+    base_count++;
+
+  capacity = 32;
+  offsets = (size_t*)malloc(capacity * sizeof(size_t));
+  if(!offsets)
+    return NULL;
+
+  p = (const unsigned char*)req->params.data;
+  end = p + req->params.len;
+  while(p && p < end)
+  {
+    size_t nlen, vlen;
+
+    if(fcgi_read_length(&p, end, &nlen) || fcgi_read_length(&p, end, &vlen))
+      break;
+    if((size_t)(end - p) < nlen + vlen)
+      break;
+
+    if(!fcgi_param_allowed((const char*)p, nlen))
+    {
+      CosaPhpExtLog("fastcgi: ignoring param %.*s\n", (int)nlen, (const char*)p);
+      p += nlen + vlen;
+      continue;
+    }
+
+    if(count == capacity)
+    {
+      size_t* roffsets;
+      capacity *= 2;
+      roffsets = (size_t*)realloc(offsets, capacity * sizeof(size_t));
+      if(!roffsets)
+      {
+        free(offsets);
+        return NULL;
+      }
+      offsets = roffsets;
+    }
+
+    offsets[count++] = strings->len;
+    if(fcgi_buffer_push(strings, (const char*)p, nlen, FCGI_MAX_PARAMS_SIZE * 2) ||
+       fcgi_buffer_push(strings, "=", 1, FCGI_MAX_PARAMS_SIZE * 2) ||
+       fcgi_buffer_push(strings, (const char*)p + nlen, vlen, FCGI_MAX_PARAMS_SIZE * 2) ||
+       fcgi_buffer_push(strings, "", 1, FCGI_MAX_PARAMS_SIZE * 2))
+    {
+      free(offsets);
+      return NULL;
+    }
+    p += nlen + vlen;
+  }
+
+  env = (char**)malloc((base_count + count + 1) * sizeof(char*));
+  if(!env)
+  {
+    free(offsets);
+    return NULL;
+  }
+
+  /* params go first so they win over a startup variable of the same name */
+  for(i = 0; i < count; ++i)
+    env[i] = strings->data + offsets[i];
+  for(i = 0; i < base_count; ++i)
+    env[count + i] = g_base_env[i];
+  env[base_count + count] = NULL;
+
+  free(offsets);
+  return env;
+}
+
+static int fcgi_run_request(int fd, fcgi_request* req, jst_fastcgi_handler handler, void* udata)
+{
+  extern char** environ;
+  char** saved_env = environ;
+  FILE* saved_in = stdin;
+  FILE* saved_out = stdout;
+  FILE* fin;
+  FILE* fout;
+  char* out = NULL;
+  size_t out_len = 0;
+  size_t off;
+  fcgi_buffer strings;
+  char** env;
+  int rc;
+
+  memset(&strings, 0, sizeof(strings));
+
+  env = fcgi_build_env(req, &strings);
+  if(!env)
+  {
+    CosaPhpExtLog("fastcgi: failed to build request environment\n");
+    fcgi_buffer_free(&strings);
+    return fcgi_write_end_request(fd, req->id, 1, FCGI_REQUEST_COMPLETE);
+  }
+
+  if(req->body.len)
+    fin = fmemopen(req->body.data, req->body.len, "r");
+  else
+    fin = fopen("/dev/null", "r");
+  fout = open_memstream(&out, &out_len);
+
+  if(!fin || !fout)
+  {
+    CosaPhpExtLog("fastcgi: failed to open request streams\n");
+    if(fin)
+      fclose(fin);
+    if(fout)
+      fclose(fout);
+    free(out);
+    free(env);
+    fcgi_buffer_free(&strings);
+    return fcgi_write_end_request(fd, req->id, 1, FCGI_REQUEST_COMPLETE);
+  }
+
+  environ = env;
+  stdin = fin;
+  stdout = fout;
+
+  rc = handler(udata);
+
+  fflush(stdout);
+  stdout = saved_out;
+  stdin = saved_in;
+  environ = saved_env;
+
+  fclose(fout);
+  fclose(fin);
+  free(env);
+  fcgi_buffer_free(&strings);
+
+  for(off = 0; off < out_len; off += FCGI_STDOUT_CHUNK)
+  {
+    size_t len = out_len - off > FCGI_STDOUT_CHUNK ? FCGI_STDOUT_CHUNK : out_len - off;
+    if(fcgi_write_record(fd, FCGI_STDOUT, req->id, out + off, len) != 0)
+    {
+      free(out);
+      return -1;
+    }
+  }
+  free(out);
+
+  if(fcgi_write_record(fd, FCGI_STDOUT, req->id, NULL, 0) != 0)
+    return -1;
+
+  return fcgi_write_end_request(fd, req->id, rc, FCGI_REQUEST_COMPLETE);
+}
+
+static void fcgi_serve_connection(int fd, jst_fastcgi_handler handler, void* udata)
+{
+  unsigned char header[FCGI_HEADER_LEN];
+  char content[FCGI_MAX_CONTENT + 256];
+  fcgi_request req;
+
+  memset(&req, 0, sizeof(req));
+
+  while(!g_stop)
+  {
+    int type, id;
+    size_t len, padding;
+
+    if(read_full(fd, header, FCGI_HEADER_LEN) != 0)
+      break;
+
+    if(header[0] != FCGI_VERSION_1)
+    {
+      CosaPhpExtLog("fastcgi: unsupported protocol version %d\n", header[0]);
+      break;
+    }
+
+    type = header[1];
+    id = (header[2] << 8) | header[3];
+    len = (header[4] << 8) | header[5];
+    padding = header[6];
+
+    if(read_full(fd, content, len + padding) != 0)
+      break;
+
+    if(id == 0)
+    {
+      /* management records */
+      if(type == FCGI_GET_VALUES)
+      {
+        fcgi_get_values(fd, content, len);
+      }
+      else
+      {
+        unsigned char body[8] = {0};
+        body[0] = (unsigned char)type;
+        fcgi_write_record(fd, FCGI_UNKNOWN_TYPE, 0, (const char*)body, sizeof(body));
+      }
+      continue;
+    }
+
+    if(type == FCGI_BEGIN_REQUEST)
+    {
+      int role;
+
+      if(len < 8)
+        break;
+      role = ((unsigned char)content[0] << 8) | (unsigned char)content[1];
+
+      if(req.id)
+      {
+        fcgi_write_end_request(fd, id, 0, FCGI_CANT_MPX_CONN);
+        continue;
+      }
+      if(role != FCGI_RESPONDER)
+      {
+        fcgi_write_end_request(fd, id, 0, FCGI_UNKNOWN_ROLE);
+        if(!(content[2] & FCGI_KEEP_CONN))
+          break;
+        continue;
+      }
+
+      req.id = id;
+      req.keep_conn = content[2] & FCGI_KEEP_CONN;
+      continue;
+    }
+
+    if(id != req.id)
+      continue; /* records for an unknown request are ignored */
+
+    if(type == FCGI_ABORT_REQUEST)
+    {
+      int keep_conn = req.keep_conn;
+      fcgi_write_end_request(fd, id, 1, FCGI_REQUEST_COMPLETE);
+      fcgi_request_reset(&req);
+      if(!keep_conn)
+        break;
+      continue;
+    }
+    else if(type == FCGI_PARAMS)
+    {
+      if(len == 0)
+        req.params_done = 1;
+      else if(fcgi_buffer_push(&req.params, content, len, FCGI_MAX_PARAMS_SIZE) != 0)
+      {
+        CosaPhpExtLog("fastcgi: request params exceed %d bytes\n", FCGI_MAX_PARAMS_SIZE);
+        break;
+      }
+    }
+    else if(type == FCGI_STDIN)
+    {
+      if(len == 0)
+        req.stdin_done = 1;
+      else if(fcgi_buffer_push(&req.body, content, len, FCGI_MAX_STDIN_SIZE) != 0)
+      {
+        CosaPhpExtLog("fastcgi: request body exceeds %d bytes\n", FCGI_MAX_STDIN_SIZE);
+        break;
+      }
+    }
+
+    if(req.params_done && req.stdin_done)
+    {
+      int keep_conn = req.keep_conn;
+
+      if(fcgi_run_request(fd, &req, handler, udata) != 0)
+        break;
+      fcgi_request_reset(&req);
+      if(!keep_conn)
+        break;
+    }
+  }
+
+  fcgi_request_reset(&req);
+}
+
+static void fcgi_worker(int lfd, jst_fastcgi_handler handler, void* udata)
+{
+  extern char** environ;
+  size_t count = 0;
+  size_t i;
+
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+
+  /* snapshot the environment we were started with; it is the base of every request env */
+  while(environ && environ[count])
+    count++;
+  g_base_env = (char**)calloc(count + 1, sizeof(char*));
+  if(g_base_env)
+  {
+    for(i = 0; i < count; ++i)
+      g_base_env[i] = strdup(environ[i]);
+  }
+
+  for(;;)
+  {
+    int cfd = accept(lfd, NULL, NULL);
+    if(cfd < 0)
+    {
+      if(errno != EINTR)
+        CosaPhpExtLog("fastcgi: accept failed: %s\n", strerror(errno));
+      continue;
+    }
+    fcgi_serve_connection(cfd, handler, udata);
+    close(cfd);
+  }
+}
+
+static pid_t fcgi_spawn_worker(int lfd, jst_fastcgi_handler handler, void* udata)
+{
+  pid_t pid = fork();
+  if(pid == 0)
+  {
+    fcgi_worker(lfd, handler, udata);
+    _exit(0);
+  }
+  if(pid < 0)
+    CosaPhpExtLog("fastcgi: fork failed: %s\n", strerror(errno));
+  return pid;
+}
+
+/* the next delay before restarting a worker that failed at startup */
+static unsigned int fcgi_backoff(unsigned int backoff)
+{
+  if(!backoff)
+    return 1;
+  return backoff * 2 > FCGI_MAX_BACKOFF ? FCGI_MAX_BACKOFF : backoff * 2;
+}
+
+int jst_fastcgi_run(const char* socket_path, int workers, jst_fastcgi_handler handler, void* udata)
+{
+  struct sigaction sa;
+  pid_t* pids;
+  time_t* started;
+  unsigned int backoff = 0;
+  int lfd;
+  int i;
+
+  if(workers <= 0)
+    workers = JST_FASTCGI_DEFAULT_WORKERS;
+
+  lfd = listen_unix_socket(socket_path, FCGI_LISTEN_BACKLOG);
+  if(lfd < 0)
+    return 1;
+
+  pids = (pid_t*)calloc(workers, sizeof(pid_t));
+  started = (time_t*)calloc(workers, sizeof(time_t));
+  if(!pids || !started)
+  {
+    free(pids);
+    free(started);
+    close(lfd);
+    unlink(socket_path);
+    return 1;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = fcgi_stop_handler;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  CosaPhpExtLog("fastcgi: listening on %s with %d workers\n", socket_path, workers);
+
+  for(i = 0; i < workers; ++i)
+  {
+    pids[i] = fcgi_spawn_worker(lfd, handler, udata);
+    started[i] = time(NULL);
+  }
+
+  /* supervise: restart any worker that dies until we are told to stop.
+     Workers that die right after they start (or can't be forked) are
+     restarted after a delay doubling up to FCGI_MAX_BACKOFF seconds, so
+     a page or module that crashes every worker doesn't keep the parent
+     forking; a worker that ran for a while resets the delay. */
+  while(!g_stop)
+  {
+    int status;
+    pid_t pid = wait(&status);
+
+    if(pid < 0)
+    {
+      if(errno == ECHILD)
+        sleep(1);
+    }
+    else
+    {
+      for(i = 0; i < workers; ++i)
+      {
+        if(pids[i] == pid)
+        {
+          CosaPhpExtLog("fastcgi: worker %d exited (status %d), restarting\n", (int)pid, status);
+          pids[i] = 0;
+          if(time(NULL) - started[i] < FCGI_MIN_UPTIME)
+            backoff = fcgi_backoff(backoff);
+          else
+            backoff = 0;
+        }
+      }
+    }
+
+    if(backoff && !g_stop)
+    {
+      CosaPhpExtLog("fastcgi: workers failing at startup, restarting in %u s\n", backoff);
+      sleep(backoff);
+    }
+
+    for(i = 0; i < workers && !g_stop; ++i)
+    {
+      if(pids[i] <= 0)
+      {
+        pids[i] = fcgi_spawn_worker(lfd, handler, udata);
+        started[i] = time(NULL);
+        if(pids[i] < 0)
+          backoff = fcgi_backoff(backoff);
+      }
+    }
+  }
+
+  for(i = 0; i < workers; ++i)
+  {
+    if(pids[i] > 0)
+      kill(pids[i], SIGTERM);
+  }
+  while(wait(NULL) > 0 || errno == EINTR)
+    ;
+
+  free(pids);
+  free(started);
+  close(lfd);
+  unlink(socket_path);
+  return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#ifndef JST_FASTCGI_H
+#define JST_FASTCGI_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define JST_FASTCGI_DEFAULT_WORKERS 2
+
+/* Called once per FastCGI request inside a worker process.
+   Before the call the request params have been installed as the process
+   environment, stdin reads the request body and stdout is captured;
+   whatever the handler writes to stdout is sent back as FCGI_STDOUT.
+   The return value is reported as the request's appStatus. */
+typedef int (*jst_fastcgi_handler)(void* udata);
+
+/* Listen on the unix socket at socket_path, pre-fork 'workers' worker
+   processes and serve requests until SIGTERM/SIGINT.
+   Returns 0 on clean shutdown, non-zero if the socket could not be set up. */
+int jst_fastcgi_run(const char* socket_path, int workers, jst_fastcgi_handler handler, void* udata);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -18,21 +18,121 @@
 */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include "jst_internal.h"
 #include "jst.h"
 
+#include "jst_plugin.h"
+
 /* OpenSSL includes */
 #include <openssl/evp.h>
 #include <openssl/pem.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
 
+/* curl_easy_setopt/getinfo are called through pointers, not the type checking macros */
+#define CURL_DISABLE_TYPECHECK
 #include <curl/curl.h>
 
-#include <libintl.h>
+/*
+  libcrypto, libcurl and libintl are not linked; they are loaded through
+  jst_plugin on the first call of a binding that needs them
+  (openssl_verify_with_cert, getSignKeys, the gettext family).
+*/
+
+typedef struct crypto_api
+{
+  BIO* (*bio_new_file)(const char* filename, const char* mode);
+  int (*bio_free)(BIO* bio);
+  X509* (*pem_read_bio_x509)(BIO* bio, X509** x, pem_password_cb* cb, void* u);
+  EVP_PKEY* (*pem_read_bio_pubkey)(BIO* bio, EVP_PKEY** x, pem_password_cb* cb, void* u);
+  EVP_PKEY* (*x509_get_pubkey)(X509* x);
+  void (*x509_free)(X509* x);
+  unsigned long (*err_peek_last_error)(void);
+  const char* (*err_reason_error_string)(unsigned long e);
+  int (*evp_add_digest)(const EVP_MD* digest);
+  const EVP_MD* (*evp_sha256)(void);
+  const EVP_MD* (*evp_get_digestbyname)(const char* name);
+  EVP_MD_CTX* (*evp_md_ctx_new)(void);
+  void (*evp_md_ctx_free)(EVP_MD_CTX* ctx);
+  int (*evp_digest_init)(EVP_MD_CTX* ctx, const EVP_MD* type);
+  int (*evp_digest_update)(EVP_MD_CTX* ctx, const void* d, size_t cnt);
+  int (*evp_verify_final)(EVP_MD_CTX* ctx, const unsigned char* sigbuf, unsigned int siglen, EVP_PKEY* pkey);
+  void (*evp_pkey_free)(EVP_PKEY* pkey);
+}crypto_api;
+
+static const char* const crypto_libs[] = { "libcrypto.so.3", "libcrypto.so.1.1", "libcrypto.so.1.0.0", "libcrypto.so", NULL };
+
+static const jst_plugin_symbol crypto_symbols[] = {
+  JST_PLUGIN_SYMBOL(crypto_api, bio_new_file, "BIO_new_file", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, bio_free, "BIO_free", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, pem_read_bio_x509, "PEM_read_bio_X509", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, pem_read_bio_pubkey, "PEM_read_bio_PUBKEY", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, x509_get_pubkey, "X509_get_pubkey", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, x509_free, "X509_free", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, err_peek_last_error, "ERR_peek_last_error", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, err_reason_error_string, "ERR_reason_error_string", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, evp_add_digest, "EVP_add_digest", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, evp_sha256, "EVP_sha256", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, evp_get_digestbyname, "EVP_get_digestbyname", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, evp_md_ctx_new, "EVP_MD_CTX_new", "EVP_MD_CTX_create"),
+  JST_PLUGIN_SYMBOL(crypto_api, evp_md_ctx_free, "EVP_MD_CTX_free", "EVP_MD_CTX_destroy"),
+  JST_PLUGIN_SYMBOL(crypto_api, evp_digest_init, "EVP_DigestInit", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, evp_digest_update, "EVP_DigestUpdate", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, evp_verify_final, "EVP_VerifyFinal", NULL),
+  JST_PLUGIN_SYMBOL(crypto_api, evp_pkey_free, "EVP_PKEY_free", NULL),
+};
+
+static crypto_api crypto;
+static jst_plugin crypto_plugin = { crypto_libs, crypto_symbols, sizeof(crypto_symbols) / sizeof(crypto_symbols[0]), &crypto, NULL, 0 };
+
+typedef struct curl_api
+{
+  CURLcode (*global_init)(long flags);
+  CURL* (*easy_init)(void);
+  CURLcode (*easy_setopt)(CURL* curl, CURLoption option, ...);
+  CURLcode (*easy_perform)(CURL* curl);
+  CURLcode (*easy_getinfo)(CURL* curl, CURLINFO info, ...);
+  void (*easy_cleanup)(CURL* curl);
+}curl_api;
+
+static const char* const curl_libs[] = { "libcurl.so.4", "libcurl.so", NULL };
+
+static const jst_plugin_symbol curl_symbols[] = {
+  JST_PLUGIN_SYMBOL(curl_api, global_init, "curl_global_init", NULL),
+  JST_PLUGIN_SYMBOL(curl_api, easy_init, "curl_easy_init", NULL),
+  JST_PLUGIN_SYMBOL(curl_api, easy_setopt, "curl_easy_setopt", NULL),
+  JST_PLUGIN_SYMBOL(curl_api, easy_perform, "curl_easy_perform", NULL),
+  JST_PLUGIN_SYMBOL(curl_api, easy_getinfo, "curl_easy_getinfo", NULL),
+  JST_PLUGIN_SYMBOL(curl_api, easy_cleanup, "curl_easy_cleanup", NULL),
+};
+
+static curl_api curl;
+static jst_plugin curl_plugin = { curl_libs, curl_symbols, sizeof(curl_symbols) / sizeof(curl_symbols[0]), &curl, NULL, 0 };
+
+/* with glibc (and musl) these live in the C library and resolve without a dlopen */
+typedef struct intl_api
+{
+  char* (*bindtextdomain)(const char* domainname, const char* dirname);
+  char* (*bind_textdomain_codeset)(const char* domainname, const char* codeset);
+  char* (*textdomain)(const char* domainname);
+  char* (*gettext)(const char* msgid);
+}intl_api;
+
+static const char* const intl_libs[] = { "libintl.so.8", "libintl.so", NULL };
+
+static const jst_plugin_symbol intl_symbols[] = {
+  JST_PLUGIN_SYMBOL(intl_api, bindtextdomain, "bindtextdomain", "libintl_bindtextdomain"),
+  JST_PLUGIN_SYMBOL(intl_api, bind_textdomain_codeset, "bind_textdomain_codeset", "libintl_bind_textdomain_codeset"),
+  JST_PLUGIN_SYMBOL(intl_api, textdomain, "textdomain", "libintl_textdomain"),
+  JST_PLUGIN_SYMBOL(intl_api, gettext, "gettext", "libintl_gettext"),
+};
+
+static intl_api intl;
+static jst_plugin intl_plugin = { intl_libs, intl_symbols, sizeof(intl_symbols) / sizeof(intl_symbols[0]), &intl, NULL, 0 };
 
 #define INITIAL_ALLOC 4     // arbitrary value, it will be realloc'd to the correct size later
 
@@ -51,7 +151,7 @@ static duk_ret_t do_getenv(duk_context *ctx)
   if (!parse_parameter(__FUNCTION__, ctx, "s", &sval))
     RETURN_STRING("failed to parse parameters");
 
-  ret = getenv(sval);
+  ret = (char*)jst_getenv(sval);
 
   if(ret)
   {
@@ -72,7 +172,10 @@ static duk_ret_t do_bindtextdomain(duk_context *ctx)
   if (!parse_parameter(__FUNCTION__, ctx, "ss", &domainname, &locale))
     RETURN_STRING("failed to parse parameters");
 
-  ret = bindtextdomain(domainname, locale);
+  if(!jst_plugin_load(&intl_plugin))
+    RETURN_FALSE;
+
+  ret = intl.bindtextdomain(domainname, locale);
 
   if(ret)
   {
@@ -93,7 +196,10 @@ static duk_ret_t do_bind_textdomain_codeset(duk_context *ctx)
   if (!parse_parameter(__FUNCTION__, ctx, "ss", &domainname, &codeset))
     RETURN_STRING("failed to parse parameters");
 
-  ret = bind_textdomain_codeset(domainname, codeset);
+  if(!jst_plugin_load(&intl_plugin))
+    RETURN_FALSE;
+
+  ret = intl.bind_textdomain_codeset(domainname, codeset);
 
   if(ret)
   {
@@ -113,7 +219,10 @@ static duk_ret_t do_textdomain(duk_context *ctx)
   if (!parse_parameter(__FUNCTION__, ctx, "s", &domainname))
     RETURN_STRING("failed to parse parameters");
 
-  ret = textdomain(domainname);
+  if(!jst_plugin_load(&intl_plugin))
+    RETURN_FALSE;
+
+  ret = intl.textdomain(domainname);
 
   if(ret)
   {
@@ -133,7 +242,11 @@ static duk_ret_t do_gettext(duk_context *ctx)
   if (!parse_parameter(__FUNCTION__, ctx, "s", &msgid))
     RETURN_STRING("failed to parse parameters");
 
-  ret = gettext(msgid);
+  /* untranslated, as gettext itself does when there is no catalog */
+  if(!jst_plugin_load(&intl_plugin))
+    RETURN_STRING(msgid);
+
+  ret = intl.gettext(msgid);
 
   if(ret)
   {
@@ -449,19 +562,20 @@ static duk_ret_t do_logger(duk_context *ctx)
 
 }
 
-static duk_ret_t do_include(duk_context *ctx)
+/* push the function for a loaded template, bytecode or source, and free
+   buffer; returns the duk_pcompile result, the error is left on the stack */
+static duk_int_t push_template(duk_context *ctx, const char* filename, char* buffer, size_t length)
 {
-  char* filename;
-  char* buffer;
-  size_t length;
+  duk_int_t rc = 0;
 
-  if (!parse_parameter(__FUNCTION__, ctx, "s", &filename))
+  length = jst_static_register(buffer, length);
+  if(length && buffer[0] == (char)0xbf)
   {
-    CosaPhpExtLog("Failed to do include\n");
-    RETURN_FALSE;
+    void* code = duk_push_fixed_buffer(ctx, length);
+    memcpy(code, buffer, length);
+    duk_load_function(ctx);
   }
-
-  if(load_template_file(filename, &buffer, &length, 0))
+  else
   {
 #ifdef DUMP_INCLUDE_FILES
     FILE* dmpFile = 0;
@@ -470,28 +584,112 @@ static duk_ret_t do_include(duk_context *ctx)
     sprintf(path, "/tmp/include%d.dmp", fileCount++);
     dmpFile = fopen(path, "w");
     if(dmpFile)
+    {
       fwrite(buffer, 1, length-1, dmpFile); 
-#endif
-    duk_push_string(ctx, buffer);
-    duk_push_string(ctx, filename);
-    if (duk_pcompile(ctx, 0) != 0) {
-      CosaPhpExtLog("do_include compile failed: %s\n", duk_safe_to_string(ctx, -1));
-    } else {
-      duk_call(ctx, 0);
-    }
-    duk_pop(ctx);
-    free(buffer);
-#ifdef DUMP_INCLUDE_FILES
-    if(dmpFile)
       fclose(dmpFile);
+    }
 #endif
-    RETURN_TRUE;
+    duk_push_string(ctx, filename);
+    rc = duk_pcompile_lstring_filename(ctx, 0, buffer, length);
   }
-  else
+  free(buffer);
+  return rc;
+}
+
+/* full path of an include and whether it may run: include once, shared
+   by include() and include_unit() */
+static int include_once(const char* filename, char* path, size_t pathlen)
+{
+  if(snprintf(path, pathlen, "%s%s", load_template_root(), filename) >= (int)pathlen)
+    return 0;
+
+  /*if its a jst that has already been loaded we'll come here so its not an error*/
+  if(load_template_included(path))
+  {
+    CosaPhpExtLog("skipping %s, already included once\n", filename);
+    return 0;
+  }
+  return load_template_mark_included(path);
+}
+
+static duk_ret_t do_include(duk_context *ctx)
+{
+  char* filename;
+  char path[512];
+  char* buffer;
+  size_t length;
+
+  if (!parse_parameter(__FUNCTION__, ctx, "s", &filename))
+  {
+    CosaPhpExtLog("Failed to do include\n");
+    RETURN_FALSE;
+  }
+
+  if(!include_once(filename, path, sizeof(path)) ||
+     !load_template_include(ctx, filename, &buffer, &length))
   {
-    /*if its a jst that has already been loaded we'll come here so its not an error*/
     RETURN_FALSE;
   }
+
+  if (push_template(ctx, filename, buffer, length) != 0) {
+    CosaPhpExtLog("do_include compile failed: %s\n", duk_safe_to_string(ctx, -1));
+  } else {
+    duk_call(ctx, 0);
+  }
+  duk_pop(ctx);
+  RETURN_TRUE;
+}
+
+/* a compile time include, run as a unit of its own (see load_template_unit) */
+static duk_ret_t do_include_unit(duk_context *ctx)
+{
+  char* filename;
+  char path[512];
+  char* buffer;
+  size_t length;
+
+  if (!parse_parameter(__FUNCTION__, ctx, "s", &filename))
+  {
+    CosaPhpExtLog("Failed to do include_unit\n");
+    RETURN_FALSE;
+  }
+
+  if(!include_once(filename, path, sizeof(path)))
+  {
+    RETURN_FALSE;
+  }
+
+  if(!load_template_unit(ctx, filename, &buffer, &length))
+  {
+    CosaPhpExtLog("include_unit cannot load %s\n", filename);
+    RETURN_FALSE;
+  }
+
+  if(push_template(ctx, filename, buffer, length) != 0)
+  {
+    /* fails the page like a syntax error in the page itself would */
+    duk_push_true(ctx);
+    duk_put_prop_string(ctx, -2, "_jst_compile_error");
+    return duk_throw(ctx);
+  }
+  duk_call(ctx, 0);
+  RETURN_TRUE;
+}
+
+/* runtime include() counters of this process, see load_template_include */
+static duk_ret_t do_include_stats(duk_context *ctx)
+{
+  jst_include_stats stats;
+
+  load_template_include_stats(&stats);
+  duk_push_object(ctx);
+  duk_push_number(ctx, (duk_double_t)stats.hits);
+  duk_put_prop_string(ctx, -2, "hits");
+  duk_push_number(ctx, (duk_double_t)stats.loads);
+  duk_put_prop_string(ctx, -2, "loads");
+  duk_push_number(ctx, (duk_double_t)stats.misses);
+  duk_put_prop_string(ctx, -2, "misses");
+  return 1;
 }
 
 static duk_ret_t do_openssl_verify_with_cert(duk_context *ctx)
@@ -517,6 +715,9 @@ static duk_ret_t do_openssl_verify_with_cert(duk_context *ctx)
     RETURN_FALSE;
   }
 
+  if(!jst_plugin_load(&crypto_plugin))
+    RETURN_FALSE;
+
   //open certificate file
   if(memcmp(filepath, "file://", sizeof("file://")-1) != 0)
   {
@@ -524,7 +725,7 @@ static duk_ret_t do_openssl_verify_with_cert(duk_context *ctx)
     RETURN_FALSE;
   }
   filepath += sizeof("file://") - 1;
-  bio = BIO_new_file(filepath, "rb") ;
+  bio = crypto.bio_new_file(filepath, "rb") ;
   if(!bio)
   {
     CosaPhpExtLog("openssl_verify_with_cert: failed open file %s\n", filepath);
@@ -532,22 +733,22 @@ static duk_ret_t do_openssl_verify_with_cert(duk_context *ctx)
   }
 
   //read public key
-  cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+  cert = crypto.pem_read_bio_x509(bio, NULL, NULL, NULL);
   if(cert)
   {
-    key = X509_get_pubkey(cert);
+    key = crypto.x509_get_pubkey(cert);
     if (!key) 
     {
-      CosaPhpExtLog("openssl_verify_with_cert: X509_get_pubkey failed with error: %d (%s)\n", ERR_peek_last_error(), ERR_reason_error_string(ERR_peek_last_error()));
+      CosaPhpExtLog("openssl_verify_with_cert: X509_get_pubkey failed with error: %d (%s)\n", crypto.err_peek_last_error(), crypto.err_reason_error_string(crypto.err_peek_last_error()));
     }
-    X509_free(cert);
+    crypto.x509_free(cert);
   }
   else
   {
-    key = PEM_read_bio_PUBKEY(bio, NULL, 0, NULL);
+    key = crypto.pem_read_bio_pubkey(bio, NULL, 0, NULL);
   }
 
-  BIO_free(bio);
+  crypto.bio_free(bio);
 
   if(!key)
   {
@@ -555,29 +756,29 @@ static duk_ret_t do_openssl_verify_with_cert(duk_context *ctx)
     RETURN_FALSE;
   }
 
-  EVP_add_digest(EVP_sha256());
+  crypto.evp_add_digest(crypto.evp_sha256());
 
-  mdtype = EVP_get_digestbyname(alg);
+  mdtype = crypto.evp_get_digestbyname(alg);
   if(!mdtype)
   {
     CosaPhpExtLog("openssl_verify_with_cert: EVP_get_digestbyname failed for %s\n", alg);
-    EVP_PKEY_free(key);
+    crypto.evp_pkey_free(key);
     RETURN_FALSE;
   }
 
-  md_ctx = EVP_MD_CTX_create();
+  md_ctx = crypto.evp_md_ctx_new();
   if(!md_ctx)
   {
     CosaPhpExtLog("openssl_verify_with_cert: EVP_MD_CTX_create failed\n");
-    EVP_PKEY_free(key);
+    crypto.evp_pkey_free(key);
     RETURN_FALSE;
   }
 
-  if(EVP_VerifyInit (md_ctx, mdtype))
+  if(crypto.evp_digest_init(md_ctx, mdtype))
   {
-    if(EVP_VerifyUpdate (md_ctx, token, strlen(token)))
+    if(crypto.evp_digest_update(md_ctx, token, strlen(token)))
     {
-      err = EVP_VerifyFinal(md_ctx, (unsigned char *)sig2verify, (unsigned int)strlen(sig2verify), key);
+      err = crypto.evp_verify_final(md_ctx, (unsigned char *)sig2verify, (unsigned int)strlen(sig2verify), key);
       if(err < 0)
       {
         CosaPhpExtLog("openssl_verify_with_cert: EVP_VerifyFinal failed error:%d\n", err);
@@ -597,8 +798,8 @@ static duk_ret_t do_openssl_verify_with_cert(duk_context *ctx)
   {
     CosaPhpExtLog("openssl_verify_with_cert: EVP_VerifyInit failed\n");
   }
-  EVP_MD_CTX_destroy(md_ctx);
-  EVP_PKEY_free(key);
+  crypto.evp_md_ctx_free(md_ctx);
+  crypto.evp_pkey_free(key);
   if(ok)
   {
     RETURN_TRUE;
@@ -658,6 +859,12 @@ static duk_ret_t do_getSignKeys(duk_context *ctx)
     CURLcode RetCode = 0xff;    // some error not used by curl
     int step = 0;
 
+    if( !jst_plugin_load(&curl_plugin) )
+    {
+        CosaPhpExtLog( "getSignKeys: Error, libcurl not available\n" ) ;
+        RETURN_LONG( (long)RetCode );
+    }
+
     if( parse_parameter(__FUNCTION__, ctx, "ss", &pURI, &pOut) )
     {
         if( pURI && pOut )
@@ -670,8 +877,8 @@ static duk_ret_t do_getSignKeys(duk_context *ctx)
             if( MyMem.pvOut != NULL )
             {
                 MyMem.memsize = INITIAL_ALLOC;          // same number as initial alloc above
-                curl_global_init(CURL_GLOBAL_ALL);
-                cp = curl_easy_init();
+                curl.global_init(CURL_GLOBAL_ALL);
+                cp = curl.easy_init();
                 if( cp != NULL )
                 {
 #ifndef _ATOM_NO_EROUTER0
@@ -680,36 +887,36 @@ static duk_ret_t do_getSignKeys(duk_context *ctx)
                     // if needed (e.g. XB3 updates), create a jst.bbappend in
                     // meta-rdk-soc-intel-gw/meta-intelce-atom/ and add this line;
                     // CFLAGS_append = " -D_ATOM_NO_EROUTER0_ "
-                    RetCode = curl_easy_setopt( cp, CURLOPT_INTERFACE, "erouter0" );
+                    RetCode = curl.easy_setopt( cp, CURLOPT_INTERFACE, "erouter0" );
                     if( RetCode == CURLE_OK )
                     {
                         step = 1;
-                        RetCode = curl_easy_setopt( cp, CURLOPT_URL, pURI );
+                        RetCode = curl.easy_setopt( cp, CURLOPT_URL, pURI );
                     }
 #else
                     step = 1;
-                    RetCode = curl_easy_setopt( cp, CURLOPT_URL, pURI );
+                    RetCode = curl.easy_setopt( cp, CURLOPT_URL, pURI );
 #endif
                     if( RetCode == CURLE_OK )
                     {
                         step = 2;
-                        RetCode = curl_easy_setopt( cp, CURLOPT_WRITEFUNCTION, curl_write_data );
+                        RetCode = curl.easy_setopt( cp, CURLOPT_WRITEFUNCTION, curl_write_data );
                     }
                     if( RetCode == CURLE_OK )
                     {
                         step = 3;
-                        RetCode = curl_easy_setopt( cp, CURLOPT_WRITEDATA, (void*)&MyMem );
+                        RetCode = curl.easy_setopt( cp, CURLOPT_WRITEDATA, (void*)&MyMem );
                     }
                     if( RetCode == CURLE_OK )
                     {
                         step = 4;
-                        RetCode = curl_easy_setopt( cp, CURLOPT_CONNECTTIMEOUT, 8L );
+                        RetCode = curl.easy_setopt( cp, CURLOPT_CONNECTTIMEOUT, 8L );
                     }
                     if( RetCode == CURLE_OK )
                     {
                         step = 5;
-                        RetCode = curl_easy_perform( cp );
-                        curl_easy_getinfo( cp, CURLINFO_RESPONSE_CODE, &lHttp_code );
+                        RetCode = curl.easy_perform( cp );
+                        curl.easy_getinfo( cp, CURLINFO_RESPONSE_CODE, &lHttp_code );
                     }
                     if( RetCode == CURLE_OK && lHttp_code == 200 )
                     {
@@ -728,7 +935,7 @@ static duk_ret_t do_getSignKeys(duk_context *ctx)
                     {
                         CosaPhpExtLog( "getSignKeys: Error, curl failed step %d with error:%ld\n", step, RetCode ) ;
                     }
-                    curl_easy_cleanup( cp );
+                    curl.easy_cleanup( cp );
                 }
                 else
                 {
@@ -793,6 +1000,8 @@ static const duk_function_list_entry ccsp_functions_funcs[] = {
   { "filesize", do_filesize, 1 },
   { "logger", do_logger, 1 },
   { "include", do_include, 1 },
+  { "include_unit", do_include_unit, 1 },
+  { "include_stats", do_include_stats, 0 },
   { "openssl_verify_with_cert", do_openssl_verify_with_cert, 4 },
   { "getSignKeys", do_getSignKeys, 2 },
   { "filemtime", do_filemtime, 1 },
@@ -803,6 +1012,6 @@ static const duk_function_list_entry ccsp_functions_funcs[] = {
 duk_ret_t ccsp_functions_module_open(duk_context *ctx)
 {
   duk_push_object(ctx);
-  duk_put_function_list(ctx, -1, ccsp_functions_funcs);
+  jst_put_function_list(ctx, -1, ccsp_functions_funcs);
   return 1;
 }
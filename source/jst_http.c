@@ -0,0 +1,1028 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "jst_http.h"
+#include "jst_internal.h"
+
+/*
+  Minimal HTTP/1.1 front end for builds without a web server.
+
+  One process, one epoll loop. Sockets are non-blocking; a request is
+  dispatched once its head and Content-Length body are buffered, .jst pages
+  are rendered synchronously through jst_render with the request mapped to
+  the usual CGI variables, other files of the static types below are sent
+  as they are, and the CGI style output (header lines, blank
+  line, body) is turned into an HTTP response with an explicit
+  Content-Length so the connection can be kept alive. Pipelined requests are
+  answered in order. Chunked request bodies are not supported (411).
+*/
+
+#define HTTP_MAX_HEAD           16384
+#define HTTP_MAX_BODY           (8 * 1048576) /* same limit as POST_MAX_SIZE in jst_post.c */
+#define HTTP_MAX_HEADERS        64
+#define HTTP_MAX_ENV            (HTTP_MAX_HEADERS + 24)
+#define HTTP_MAX_EVENTS         64
+#define HTTP_LISTEN_BACKLOG     64
+#define HTTP_READ_CHUNK         16384
+
+typedef struct http_buffer
+{
+  char* data;
+  size_t len;
+  size_t alloc;
+}http_buffer;
+
+typedef struct http_request
+{
+  char* head;               /* private copy of the request head, tokenized in place */
+  size_t head_len;          /* bytes of the head in the input buffer, blank line included */
+  size_t content_length;
+  char* method;
+  char* target;
+  char* version;
+  char* names[HTTP_MAX_HEADERS];
+  char* values[HTTP_MAX_HEADERS];
+  int header_count;
+  int keep_alive;
+}http_request;
+
+typedef struct http_conn
+{
+  int fd;
+  http_buffer in;
+  http_buffer out;
+  size_t out_pos;
+  http_request req;
+  int have_req;
+  int sent_continue;
+  int close_after_write;
+  int peer_closed;
+  time_t last_active;
+  char remote_addr[INET6_ADDRSTRLEN];
+  char remote_port[8];
+  struct http_conn* prev;
+  struct http_conn* next;
+}http_conn;
+
+typedef struct http_server
+{
+  int epfd;
+  int lfd;
+  char docroot[PATH_MAX];
+  char port[8];
+  jst_engine* engine;
+  http_conn* conns;
+  http_conn* closed;        /* freed once the current epoll batch is done */
+}http_server;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void http_stop_handler(int sig)
+{
+  (void)sig;
+  g_stop = 1;
+}
+
+static int http_buffer_push(http_buffer* buf, const char* data, size_t len)
+{
+  if(buf->len + len + 1 > buf->alloc)
+  {
+    size_t alloc = buf->alloc ? buf->alloc : 1024;
+    char* rbuf;
+
+    while(alloc < buf->len + len + 1)
+      alloc *= 2;
+
+    rbuf = (char*)realloc(buf->data, alloc);
+    if(!rbuf)
+      return -1;
+    buf->data = rbuf;
+    buf->alloc = alloc;
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  buf->data[buf->len] = 0;
+  return 0;
+}
+
+static int http_buffer_printf(http_buffer* buf, const char* format, ...)
+{
+  char line[1024];
+  va_list vl;
+  int n;
+
+  va_start(vl, format);
+  n = vsnprintf(line, sizeof(line), format, vl);
+  va_end(vl);
+
+  if(n < 0 || n >= (int)sizeof(line))
+    return -1;
+  return http_buffer_push(buf, line, n);
+}
+
+static void http_buffer_consume(http_buffer* buf, size_t len)
+{
+  memmove(buf->data, buf->data + len, buf->len - len);
+  buf->len -= len;
+  buf->data[buf->len] = 0;
+}
+
+static void http_buffer_free(http_buffer* buf)
+{
+  free(buf->data);
+  memset(buf, 0, sizeof(http_buffer));
+}
+
+static const char* http_header(http_request* req, const char* name)
+{
+  int i;
+  for(i = 0; i < req->header_count; ++i)
+  {
+    if(strcasecmp(req->names[i], name) == 0)
+      return req->values[i];
+  }
+  return NULL;
+}
+
+static const char* http_status_text(int status)
+{
+  switch(status)
+  {
+  case 200: return "OK";
+  case 301: return "Moved Permanently";
+  case 302: return "Found";
+  case 400: return "Bad Request";
+  case 403: return "Forbidden";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 411: return "Length Required";
+  case 413: return "Payload Too Large";
+  case 414: return "URI Too Long";
+  case 431: return "Request Header Fields Too Large";
+  case 500: return "Internal Server Error";
+  case 501: return "Not Implemented";
+  default:  return "Unknown";
+  }
+}
+
+/* the files served as they are. Not .js: includes and require()d modules
+   live under the docroot too, and their source is not for the client. */
+static const char* http_content_type(const char* path)
+{
+  static const struct { const char* ext; const char* type; } types[] = {
+    { ".html", "text/html" },
+    { ".htm",  "text/html" },
+    { ".css",  "text/css" },
+    { ".json", "application/json" },
+    { ".xml",  "text/xml" },
+    { ".txt",  "text/plain" },
+    { ".png",  "image/png" },
+    { ".jpg",  "image/jpeg" },
+    { ".jpeg", "image/jpeg" },
+    { ".gif",  "image/gif" },
+    { ".svg",  "image/svg+xml" },
+    { ".ico",  "image/x-icon" },
+    { ".woff", "font/woff" },
+    { ".woff2","font/woff2" },
+    { ".ttf",  "font/ttf" },
+  };
+  const char* ext = strrchr(path, '.');
+  size_t i;
+
+  if(ext)
+  {
+    for(i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+    {
+      if(strcasecmp(ext, types[i].ext) == 0)
+        return types[i].type;
+    }
+  }
+  return NULL;
+}
+
+static int http_set_nonblock(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if(flags < 0)
+    return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int http_listen(const char* listen_addr, char* port_out, size_t port_size)
+{
+  struct addrinfo hints;
+  struct addrinfo* res = NULL;
+  struct addrinfo* ai;
+  char host[256] = {0};
+  const char* port = listen_addr;
+  const char* colon = strrchr(listen_addr, ':');
+  int fd = -1;
+  int one = 1;
+  int rc;
+
+  if(colon)
+  {
+    size_t hlen = colon - listen_addr;
+    const char* h = listen_addr;
+
+    /* [::1]:8080 */
+    if(hlen >= 2 && h[0] == '[' && h[hlen - 1] == ']')
+    {
+      h++;
+      hlen -= 2;
+    }
+    if(hlen >= sizeof(host))
+    {
+      fprintf(stderr, "Error: http listen address too long: %s\n", listen_addr);
+      return -1;
+    }
+    memcpy(host, h, hlen);
+    port = colon + 1;
+  }
+  snprintf(port_out, port_size, "%s", port);
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  rc = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+  if(rc != 0)
+  {
+    fprintf(stderr, "Error: invalid http listen address %s: %s\n", listen_addr, gai_strerror(rc));
+    return -1;
+  }
+
+  for(ai = res; ai; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if(fd < 0)
+      continue;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, HTTP_LISTEN_BACKLOG) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if(fd < 0)
+  {
+    fprintf(stderr, "Error: failed to listen on %s: %s\n", listen_addr, strerror(errno));
+    return -1;
+  }
+
+  http_set_nonblock(fd);
+  return fd;
+}
+
+static void http_conn_close(http_server* srv, http_conn* conn)
+{
+  if(conn->fd < 0)
+    return;
+
+  epoll_ctl(srv->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  conn->fd = -1;
+
+  if(conn->prev)
+    conn->prev->next = conn->next;
+  else
+    srv->conns = conn->next;
+  if(conn->next)
+    conn->next->prev = conn->prev;
+
+  /* later events of the same epoll batch may still point at conn */
+  conn->prev = NULL;
+  conn->next = srv->closed;
+  srv->closed = conn;
+}
+
+static void http_conn_free_closed(http_server* srv)
+{
+  while(srv->closed)
+  {
+    http_conn* conn = srv->closed;
+    srv->closed = conn->next;
+    free(conn->req.head);
+    http_buffer_free(&conn->in);
+    http_buffer_free(&conn->out);
+    free(conn);
+  }
+}
+
+/* returns -1 if the connection had to be closed */
+static int http_conn_flush(http_server* srv, http_conn* conn)
+{
+  struct epoll_event ev;
+
+  while(conn->out_pos < conn->out.len)
+  {
+    ssize_t n = send(conn->fd, conn->out.data + conn->out_pos, conn->out.len - conn->out_pos, MSG_NOSIGNAL);
+    if(n < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      http_conn_close(srv, conn);
+      return -1;
+    }
+    conn->out_pos += n;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.data.ptr = conn;
+
+  if(conn->out_pos < conn->out.len)
+  {
+    ev.events = conn->peer_closed ? EPOLLOUT : EPOLLIN | EPOLLOUT;
+    epoll_ctl(srv->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+    return 0;
+  }
+
+  conn->out.len = 0;
+  conn->out_pos = 0;
+
+  if(conn->close_after_write)
+  {
+    http_conn_close(srv, conn);
+    return -1;
+  }
+
+  ev.events = EPOLLIN;
+  epoll_ctl(srv->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  return 0;
+}
+
+static void http_respond(http_conn* conn, int status, const char* status_text, const char* headers,
+                         const char* body, size_t body_len, int head_only)
+{
+  http_buffer_printf(&conn->out, "HTTP/1.1 %d %s\r\n", status, status_text ? status_text : http_status_text(status));
+  if(headers)
+    http_buffer_push(&conn->out, headers, strlen(headers));
+  http_buffer_printf(&conn->out, "Content-Length: %zu\r\nConnection: %s\r\n\r\n",
+                     body_len, conn->close_after_write ? "close" : "keep-alive");
+  if(!head_only && body_len)
+    http_buffer_push(&conn->out, body, body_len);
+}
+
+static void http_respond_error(http_conn* conn, int status)
+{
+  char body[128];
+  int n = snprintf(body, sizeof(body), "%d %s\n", status, http_status_text(status));
+  http_respond(conn, status, NULL, "Content-Type: text/plain\r\n", body, n, 0);
+}
+
+/* tokenize the request head; returns 0 on success or an HTTP error status */
+static int http_parse_head(http_conn* conn, size_t head_len)
+{
+  http_request* req = &conn->req;
+  const char* value;
+  char* line;
+  char* next;
+  char* p;
+
+  memset(req, 0, sizeof(http_request));
+  req->head = (char*)malloc(head_len + 1);
+  if(!req->head)
+    return 500;
+  memcpy(req->head, conn->in.data, head_len);
+  req->head[head_len] = 0;
+  req->head_len = head_len;
+
+  /* the head is parsed as a string */
+  if(memchr(req->head, 0, head_len))
+    return 400;
+
+  /* request line */
+  line = req->head;
+  next = strstr(line, "\r\n");
+  if(!next)
+    return 400;
+  *next = 0;
+  next += 2;
+
+  req->method = line;
+  p = strchr(line, ' ');
+  if(!p)
+    return 400;
+  *p++ = 0;
+  req->target = p;
+  p = strchr(p, ' ');
+  if(!p)
+    return 400;
+  *p++ = 0;
+  req->version = p;
+
+  if(strncmp(req->version, "HTTP/1.", 7) != 0 || req->target[0] != '/')
+    return 400;
+
+  /* header lines */
+  while(*next)
+  {
+    line = next;
+    next = strstr(line, "\r\n");
+    if(!next)
+      return 400;
+    *next = 0;
+    next += 2;
+    if(!*line)
+      break;
+
+    if(req->header_count == HTTP_MAX_HEADERS)
+      return 431;
+
+    p = strchr(line, ':');
+    if(!p)
+      return 400;
+    *p++ = 0;
+    while(*p == ' ' || *p == '\t')
+      p++;
+
+    req->names[req->header_count] = line;
+    req->values[req->header_count] = p;
+    req->header_count++;
+  }
+
+  if(http_header(req, "Transfer-Encoding"))
+    return 411;
+
+  value = http_header(req, "Content-Length");
+  if(value)
+  {
+    char* end;
+    unsigned long len = strtoul(value, &end, 10);
+    if(*end || end == value)
+      return 400;
+    if(len > HTTP_MAX_BODY)
+      return 413;
+    req->content_length = len;
+  }
+
+  value = http_header(req, "Connection");
+  if(strcmp(req->version, "HTTP/1.0") == 0)
+    req->keep_alive = value && strcasecmp(value, "keep-alive") == 0;
+  else
+    req->keep_alive = !(value && strcasecmp(value, "close") == 0);
+
+  return 0;
+}
+
+/* decode %XX escapes of the path and reject anything leaving the docroot;
+   0, or the HTTP error status */
+static int http_decode_path(const char* target, char* path, size_t size)
+{
+  size_t n = 0;
+  const char* p;
+
+  for(p = target; *p && *p != '?'; ++p)
+  {
+    char c = *p;
+    if(c == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2]))
+    {
+      char hex[3] = { p[1], p[2], 0 };
+      c = (char)strtol(hex, NULL, 16);
+      p += 2;
+    }
+    if(c == 0)
+      return 400;
+    if(n + 1 >= size)
+      return 414;
+    path[n++] = c;
+  }
+  path[n] = 0;
+
+  if(path[0] != '/' || strstr(path, "/../") || (n >= 3 && strcmp(path + n - 3, "/..") == 0))
+    return 400;
+  return 0;
+}
+
+static void http_env_add(char** env, int* count, const char* name, const char* value)
+{
+  size_t len;
+  char* s;
+
+  if(*count >= HTTP_MAX_ENV - 1 || !value)
+    return;
+
+  len = strlen(name) + strlen(value) + 2;
+  s = (char*)malloc(len);
+  if(!s)
+    return;
+  snprintf(s, len, "%s=%s", name, value);
+  env[(*count)++] = s;
+  env[*count] = NULL;
+}
+
+/* turn the page's CGI output into the HTTP response */
+static void http_respond_cgi(http_conn* conn, const char* data, size_t len, int head_only)
+{
+  http_buffer headers;
+  char status_text[128] = "OK";
+  int status = 200;
+  int have_location = 0;
+  const char* p = data;
+  const char* end = data + len;
+
+  memset(&headers, 0, sizeof(headers));
+
+  while(p < end)
+  {
+    const char* eol = memchr(p, '\n', end - p);
+    size_t line_len;
+
+    if(!eol)
+      break;
+    line_len = eol - p;
+    if(line_len && p[line_len - 1] == '\r')
+      line_len--;
+
+    if(line_len == 0)
+    {
+      p = eol + 1;
+      break;
+    }
+
+    if(line_len > 5 && strncmp(p, "HTTP/", 5) == 0)
+    {
+      /* status line written by header("Location: ...") */
+    }
+    else if(line_len > 7 && strncasecmp(p, "Status:", 7) == 0)
+    {
+      const char* s = p + 7;
+      while(s < p + line_len && *s == ' ')
+        s++;
+      status = atoi(s);
+      while(s < p + line_len && *s != ' ')
+        s++;
+      while(s < p + line_len && *s == ' ')
+        s++;
+      snprintf(status_text, sizeof(status_text), "%.*s", (int)(p + line_len - s), s);
+    }
+    else if((line_len > 15 && strncasecmp(p, "Content-Length:", 15) == 0) ||
+            (line_len > 11 && strncasecmp(p, "Connection:", 11) == 0))
+    {
+      /* set by us */
+    }
+    else
+    {
+      if(line_len > 9 && strncasecmp(p, "Location:", 9) == 0)
+        have_location = 1;
+      http_buffer_push(&headers, p, line_len);
+      http_buffer_push(&headers, "\r\n", 2);
+    }
+    p = eol + 1;
+  }
+
+  if(have_location && status == 200)
+  {
+    status = 302;
+    snprintf(status_text, sizeof(status_text), "%s", http_status_text(302));
+  }
+  if(status < 100 || status > 999)
+    status = 500;
+
+  http_respond(conn, status, status_text, headers.data, p, end - p, head_only);
+  http_buffer_free(&headers);
+}
+
+static void http_serve_page(http_server* srv, http_conn* conn, const char* filepath, const char* script_name)
+{
+  http_request* req = &conn->req;
+  char* env[HTTP_MAX_ENV];
+  int count = 0;
+  const char* query;
+  jst_request request;
+  jst_response response;
+  char name[128];
+  int i;
+
+  env[0] = NULL;
+  query = strchr(req->target, '?');
+
+  http_env_add(env, &count, "GATEWAY_INTERFACE", "CGI/1.1");
+  http_env_add(env, &count, "SERVER_SOFTWARE", "jst");
+  http_env_add(env, &count, "SERVER_PROTOCOL", req->version);
+  http_env_add(env, &count, "SERVER_PORT", srv->port);
+  http_env_add(env, &count, "REQUEST_METHOD", req->method);
+  http_env_add(env, &count, "REQUEST_URI", req->target);
+  http_env_add(env, &count, "DOCUMENT_ROOT", srv->docroot);
+  http_env_add(env, &count, "SCRIPT_NAME", script_name);
+  http_env_add(env, &count, "SCRIPT_FILENAME", filepath);
+  http_env_add(env, &count, "QUERY_STRING", query ? query + 1 : "");
+  http_env_add(env, &count, "REMOTE_ADDR", conn->remote_addr);
+  http_env_add(env, &count, "REMOTE_PORT", conn->remote_port);
+
+  for(i = 0; i < req->header_count; ++i)
+  {
+    const char* src = req->names[i];
+    size_t n;
+
+    if(strcasecmp(src, "Content-Length") == 0)
+    {
+      http_env_add(env, &count, "CONTENT_LENGTH", req->values[i]);
+      continue;
+    }
+    if(strcasecmp(src, "Content-Type") == 0)
+    {
+      http_env_add(env, &count, "CONTENT_TYPE", req->values[i]);
+      continue;
+    }
+
+    n = snprintf(name, sizeof(name), "HTTP_");
+    for(; *src && n + 1 < sizeof(name); ++src)
+      name[n++] = *src == '-' ? '_' : toupper((unsigned char)*src);
+    name[n] = 0;
+    http_env_add(env, &count, name, req->values[i]);
+  }
+
+  request.env = (const char* const*)env;
+  request.body = conn->in.data + req->head_len;
+  request.body_len = req->content_length;
+  request.cookies = http_header(req, "Cookie");
+
+  if(jst_render(srv->engine, &request, &response) != 0 && response.len == 0)
+    http_respond_error(conn, 500);
+  else
+    http_respond_cgi(conn, response.data, response.len, strcmp(req->method, "HEAD") == 0);
+
+  jst_response_free(&response);
+  for(i = 0; i < count; ++i)
+    free(env[i]);
+}
+
+static void http_serve_static(http_conn* conn, const char* filepath, const char* path)
+{
+  char headers[256];
+  const char* type = http_content_type(path);
+  jst_file file;
+  int head_only = strcmp(conn->req.method, "HEAD") == 0;
+
+  /* nothing but the static types, and no dotfiles (.htpasswd, .git/...) */
+  if(!type || strstr(path, "/."))
+  {
+    http_respond_error(conn, 404);
+    return;
+  }
+
+  if(strcmp(conn->req.method, "GET") != 0 && !head_only)
+  {
+    http_respond_error(conn, 405);
+    return;
+  }
+
+  if(!map_file(filepath, &file))
+  {
+    http_respond_error(conn, 403);
+    return;
+  }
+
+  snprintf(headers, sizeof(headers), "Content-Type: %s\r\n", type);
+  http_respond(conn, 200, NULL, headers, file.data, file.len, head_only);
+  unmap_file(&file);
+}
+
+static void http_dispatch(http_server* srv, http_conn* conn)
+{
+  http_request* req = &conn->req;
+  char path[PATH_MAX + sizeof("index.html")];
+  char filepath[PATH_MAX];
+  struct stat st;
+  size_t plen;
+  int status;
+
+  if(strcmp(req->method, "GET") && strcmp(req->method, "HEAD") && strcmp(req->method, "POST"))
+  {
+    http_respond_error(conn, 501);
+    return;
+  }
+
+  status = http_decode_path(req->target, path, PATH_MAX);
+  if(status)
+  {
+    http_respond_error(conn, status);
+    return;
+  }
+
+  plen = strlen(path);
+  if(path[plen - 1] == '/')
+  {
+    if(snprintf(filepath, sizeof(filepath), "%s%sindex.jst", srv->docroot, path) < (int)sizeof(filepath) &&
+       access(filepath, R_OK) == 0)
+      strcat(path, "index.jst");
+    else
+      strcat(path, "index.html");
+  }
+
+  /* a path longer than the docroot leaves room for can't be a file */
+  if(snprintf(filepath, sizeof(filepath), "%s%s", srv->docroot, path) >= (int)sizeof(filepath) ||
+     stat(filepath, &st) != 0)
+  {
+    http_respond_error(conn, 404);
+    return;
+  }
+
+  if(S_ISDIR(st.st_mode))
+  {
+    char location[sizeof(path) + 16];
+    snprintf(location, sizeof(location), "Location: %s/\r\n", path);
+    http_respond(conn, 301, NULL, location, NULL, 0, 0);
+    return;
+  }
+
+  plen = strlen(path);
+  if(plen > 4 && strcmp(path + plen - 4, ".jst") == 0)
+    http_serve_page(srv, conn, filepath, path);
+  else
+    http_serve_static(conn, filepath, path);
+}
+
+/* handle every complete request in the input buffer; returns -1 if the connection was closed */
+static int http_conn_process(http_server* srv, http_conn* conn)
+{
+  while(!conn->close_after_write)
+  {
+    if(!conn->have_req)
+    {
+      char* end = conn->in.data ? (char*)memmem(conn->in.data, conn->in.len, "\r\n\r\n", 4) : NULL;
+      int status;
+
+      if(!end)
+      {
+        if(conn->in.len > HTTP_MAX_HEAD)
+        {
+          conn->close_after_write = 1;
+          http_respond_error(conn, 431);
+        }
+        break;
+      }
+
+      status = http_parse_head(conn, end + 4 - conn->in.data);
+      conn->have_req = 1;
+      conn->sent_continue = 0;
+      if(status)
+      {
+        conn->close_after_write = 1;
+        http_respond_error(conn, status);
+        break;
+      }
+    }
+
+    if(conn->in.len < conn->req.head_len + conn->req.content_length)
+    {
+      const char* expect = http_header(&conn->req, "Expect");
+      if(expect && strcasecmp(expect, "100-continue") == 0 && !conn->sent_continue)
+      {
+        http_buffer_printf(&conn->out, "HTTP/1.1 100 Continue\r\n\r\n");
+        conn->sent_continue = 1;
+      }
+      break;
+    }
+
+    if(!conn->req.keep_alive)
+      conn->close_after_write = 1;
+
+    http_dispatch(srv, conn);
+
+    http_buffer_consume(&conn->in, conn->req.head_len + conn->req.content_length);
+    free(conn->req.head);
+    memset(&conn->req, 0, sizeof(http_request));
+    conn->have_req = 0;
+  }
+
+  /* the client half-closed: answer what it sent, then close */
+  if(conn->peer_closed)
+  {
+    conn->close_after_write = 1;
+    if(conn->out.len == 0)
+    {
+      http_conn_close(srv, conn);
+      return -1;
+    }
+  }
+
+  return http_conn_flush(srv, conn);
+}
+
+static void http_conn_read(http_server* srv, http_conn* conn)
+{
+  char chunk[HTTP_READ_CHUNK];
+
+  for(;;)
+  {
+    ssize_t n = recv(conn->fd, chunk, sizeof(chunk), 0);
+    if(n < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      http_conn_close(srv, conn);
+      return;
+    }
+    if(n == 0)
+    {
+      conn->peer_closed = 1;
+      break;
+    }
+    if(http_buffer_push(&conn->in, chunk, n) != 0)
+    {
+      http_conn_close(srv, conn);
+      return;
+    }
+    if(conn->in.len > HTTP_MAX_HEAD + HTTP_MAX_BODY)
+      break;
+  }
+
+  conn->last_active = time(NULL);
+  http_conn_process(srv, conn);
+}
+
+static void http_accept(http_server* srv)
+{
+  for(;;)
+  {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    struct epoll_event ev;
+    http_conn* conn;
+    int fd;
+
+    fd = accept4(srv->lfd, (struct sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0)
+    {
+      if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        CosaPhpExtLog("http: accept failed: %s\n", strerror(errno));
+      return;
+    }
+
+    conn = (http_conn*)calloc(1, sizeof(http_conn));
+    if(!conn)
+    {
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+    conn->last_active = time(NULL);
+    getnameinfo((struct sockaddr*)&addr, addrlen,
+                conn->remote_addr, sizeof(conn->remote_addr),
+                conn->remote_port, sizeof(conn->remote_port),
+                NI_NUMERICHOST | NI_NUMERICSERV);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    if(epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+      close(fd);
+      free(conn);
+      continue;
+    }
+
+    conn->next = srv->conns;
+    if(srv->conns)
+      srv->conns->prev = conn;
+    srv->conns = conn;
+  }
+}
+
+static void http_close_idle(http_server* srv)
+{
+  time_t now = time(NULL);
+  http_conn* conn = srv->conns;
+
+  while(conn)
+  {
+    http_conn* next = conn->next;
+    if(now - conn->last_active > JST_HTTP_IDLE_TIMEOUT)
+      http_conn_close(srv, conn);
+    conn = next;
+  }
+}
+
+int jst_http_run(const char* listen_addr, const char* docroot, jst_engine* engine)
+{
+  http_server srv;
+  struct epoll_event ev;
+  struct epoll_event events[HTTP_MAX_EVENTS];
+  struct sigaction sa;
+  size_t len;
+
+  memset(&srv, 0, sizeof(srv));
+  srv.engine = engine;
+
+  if(!realpath(docroot, srv.docroot))
+  {
+    fprintf(stderr, "Error: invalid docroot %s: %s\n", docroot, strerror(errno));
+    return 1;
+  }
+  /* the request path always starts with '/' */
+  len = strlen(srv.docroot);
+  if(len && srv.docroot[len - 1] == '/')
+    srv.docroot[len - 1] = 0;
+
+  srv.lfd = http_listen(listen_addr, srv.port, sizeof(srv.port));
+  if(srv.lfd < 0)
+    return 1;
+
+  srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(srv.epfd < 0)
+  {
+    fprintf(stderr, "Error: epoll_create1 failed: %s\n", strerror(errno));
+    close(srv.lfd);
+    return 1;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(srv.epfd, EPOLL_CTL_ADD, srv.lfd, &ev);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = http_stop_handler;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  CosaPhpExtLog("http: listening on %s docroot %s\n", listen_addr, srv.docroot);
+
+  while(!g_stop)
+  {
+    int n = epoll_wait(srv.epfd, events, HTTP_MAX_EVENTS, 1000);
+    int i;
+
+    if(n < 0 && errno != EINTR)
+    {
+      CosaPhpExtLog("http: epoll_wait failed: %s\n", strerror(errno));
+      break;
+    }
+
+    for(i = 0; i < n; ++i)
+    {
+      http_conn* conn = (http_conn*)events[i].data.ptr;
+
+      if(!conn)
+        http_accept(&srv);
+      else if(conn->fd < 0)
+        continue;
+      else if(events[i].events & EPOLLIN)
+        http_conn_read(&srv, conn);
+      else if(events[i].events & (EPOLLERR | EPOLLHUP))
+        http_conn_close(&srv, conn);
+      else if(events[i].events & EPOLLOUT)
+      {
+        conn->last_active = time(NULL);
+        if(http_conn_flush(&srv, conn) == 0)
+          http_conn_process(&srv, conn);
+      }
+    }
+
+    http_close_idle(&srv);
+    http_conn_free_closed(&srv);
+  }
+
+  while(srv.conns)
+    http_conn_close(&srv, srv.conns);
+  http_conn_free_closed(&srv);
+  close(srv.epfd);
+  close(srv.lfd);
+  return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#ifndef JST_HTTP_H
+#define JST_HTTP_H
+
+#include "jst_engine.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define JST_HTTP_IDLE_TIMEOUT 30 /* seconds a keep-alive connection may sit idle */
+
+/* Serve HTTP/1.1 on listen_addr ("[host]:port" or "port") until SIGTERM/SIGINT.
+   .jst files under docroot are rendered with engine; other files are sent
+   as they are if their type is a known static one (not .js, which may be
+   a server side include or module) and no part of the path starts with '.'.
+   Returns 0 on clean shutdown, non-zero if the server could not be set up. */
+int jst_http_run(const char* listen_addr, const char* docroot, jst_engine* engine);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
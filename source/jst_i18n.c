@@ -0,0 +1,228 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+/*
+  Compile time translation catalog.
+
+  With JST_TEXTDOMAIN set, the parser replaces _("literal") and
+  ccsp.gettext("literal") in run pages by the translation from the .mo
+  catalog of that text domain, see template_translate in jst_parser.c.
+  The catalog is looked up as gettext does:
+
+    $JST_LOCALEDIR/<locale>/LC_MESSAGES/$JST_TEXTDOMAIN.mo
+
+  JST_LOCALEDIR defaults to /usr/share/locale; the locale is the first
+  entry of LANGUAGE, else LC_ALL, LC_MESSAGES or LANG, tried as it is,
+  without the codeset and modifier, and as the language alone. Without a
+  catalog nothing is replaced and _() translates at run time as before.
+
+  The code of a page then depends on the catalog: the bytecode cache
+  keeps an entry per catalog and a bundle is only used with the catalog
+  it was built with. The key of a page's static content (jst_output.c)
+  holds a hash of the catalog's content, so a process that still has an
+  older version of it mapped never pairs code translated with the new
+  one with a table it registered before.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "jst.h"
+#include "jst_internal.h"
+
+#define MO_MAGIC         0x950412deU
+#define MO_MAGIC_SWAPPED 0xde120495U
+
+#ifndef JST_LOCALEDIR
+#define JST_LOCALEDIR "/usr/share/locale"
+#endif
+
+static char g_catalog_path[512];
+static jst_file g_catalog_file;  /* mapped for the life of the process */
+static const char* g_catalog = NULL;
+static size_t g_catalog_len = 0;
+static uint64_t g_catalog_hash = 0;
+static int g_swapped = 0;
+static uint32_t g_count = 0;
+static uint32_t g_orig = 0;    /* offset of the msgid table */
+static uint32_t g_trans = 0;   /* offset of the translation table */
+
+static uint32_t mo_u32(size_t off)
+{
+  uint32_t v;
+
+  memcpy(&v, g_catalog + off, sizeof(v));
+  if(g_swapped)
+    v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+  return v;
+}
+
+/* string n of the table at off, NULL if it isn't inside the file */
+static const char* mo_string(uint32_t table, uint32_t n, size_t* len)
+{
+  uint32_t l = mo_u32(table + n * 8);
+  uint32_t o = mo_u32(table + n * 8 + 4);
+
+  if((uint64_t)o + l >= g_catalog_len || g_catalog[o + l] != 0)
+    return NULL;
+  *len = l;
+  return g_catalog + o;
+}
+
+static int catalog_load(const char* path)
+{
+  uint32_t magic;
+
+  if(!map_file(path, &g_catalog_file))
+    return 0;
+  g_catalog = g_catalog_file.data;
+  g_catalog_len = g_catalog_file.len;
+
+  if(g_catalog_len >= 20)
+  {
+    memcpy(&magic, g_catalog, sizeof(magic));
+    g_swapped = magic == MO_MAGIC_SWAPPED;
+    if(magic == MO_MAGIC || magic == MO_MAGIC_SWAPPED)
+    {
+      g_count = mo_u32(8);
+      g_orig = mo_u32(12);
+      g_trans = mo_u32(16);
+      if((uint64_t)g_orig + (uint64_t)g_count * 8 <= g_catalog_len &&
+         (uint64_t)g_trans + (uint64_t)g_count * 8 <= g_catalog_len)
+      {
+        snprintf(g_catalog_path, sizeof(g_catalog_path), "%s", path);
+        g_catalog_hash = jst_hash(g_catalog, g_catalog_len);
+        return 1;
+      }
+    }
+  }
+
+  CosaPhpExtLog("i18n: %s is not a gettext catalog\n", path);
+  unmap_file(&g_catalog_file);
+  g_catalog = NULL;
+  g_catalog_len = 0;
+  return 0;
+}
+
+/* try the catalog for locale, cut at the first of the characters in cut */
+static int catalog_try(const char* dir, const char* locale, const char* cut, const char* domain)
+{
+  char path[512];
+  size_t len = strcspn(locale, cut);
+
+  if(!len)
+    return 0;
+  if(snprintf(path, sizeof(path), "%s/%.*s/LC_MESSAGES/%s.mo", dir, (int)len, locale, domain) >= (int)sizeof(path) ||
+     access(path, R_OK) != 0)
+    return 0;
+  return catalog_load(path);
+}
+
+static void catalog_init(void)
+{
+  static int checked = 0;
+  const char* domain;
+  const char* dir;
+  const char* locale = NULL;
+  const char* env;
+  char first[64];
+
+  if(checked)
+    return;
+  checked = 1;
+
+  domain = getenv("JST_TEXTDOMAIN");
+  if(!domain || !domain[0] || strchr(domain, '/'))
+    return;
+  dir = getenv("JST_LOCALEDIR");
+  if(!dir || !dir[0])
+    dir = JST_LOCALEDIR;
+
+  if((env = getenv("LANGUAGE")) && env[0])
+  {
+    snprintf(first, sizeof(first), "%.*s", (int)strcspn(env, ":"), env);
+    locale = first;
+  }
+  else if((env = getenv("LC_ALL")) && env[0])
+    locale = env;
+  else if((env = getenv("LC_MESSAGES")) && env[0])
+    locale = env;
+  else if((env = getenv("LANG")) && env[0])
+    locale = env;
+
+  if(!locale || strcmp(locale, "C") == 0 || strcmp(locale, "POSIX") == 0 || strchr(locale, '/'))
+    return;
+
+  if(!catalog_try(dir, locale, "", domain) &&
+     !catalog_try(dir, locale, ".@", domain) &&
+     !catalog_try(dir, locale, "_.@", domain))
+    CosaPhpExtLog("i18n: no catalog of %s for %s in %s\n", domain, locale, dir);
+}
+
+const char* jst_i18n_catalog(void)
+{
+  catalog_init();
+  return g_catalog ? g_catalog_path : NULL;
+}
+
+uint64_t jst_i18n_catalog_hash(void)
+{
+  catalog_init();
+  return g_catalog ? g_catalog_hash : 0;
+}
+
+int jst_i18n_lookup(const char* msgid, size_t msgid_len, const char** str, size_t* len)
+{
+  uint32_t lo = 0;
+  uint32_t hi;
+
+  catalog_init();
+  if(!g_catalog || !msgid_len)
+    return 0;
+
+  /* msgids are sorted; a plural entry's is "singular\0plural" */
+  hi = g_count;
+  while(lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    size_t orig_len;
+    const char* orig = mo_string(g_orig, mid, &orig_len);
+    int cmp;
+
+    if(!orig)
+      return 0;
+    orig_len = strlen(orig);
+    cmp = memcmp(msgid, orig, msgid_len < orig_len ? msgid_len : orig_len);
+    if(!cmp)
+      cmp = msgid_len < orig_len ? -1 : msgid_len > orig_len;
+    if(!cmp)
+    {
+      *str = mo_string(g_trans, mid, len);
+      if(!*str)
+        return 0;
+      *len = strlen(*str);
+      return *len != 0;
+    }
+    if(cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return 0;
+}
@@ -18,14 +18,31 @@
 */
 #include "jst_internal.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #define COSA_PHP_EXT_LOG_FILE_NAME  "/var/log/cosa_php_ext.log"
 #define COSA_PHP_EXT_DEBUG_FILE "/tmp/cosa_php_debug"
 static int debugFlag = 0;
 
+char* jst_debug_file_name = NULL;
+int jst_use_lightfuncs = 0;
+
+static const char* const* g_request_env = NULL;
+static const char* g_request_cookies = NULL;
+static const char* g_request_body = NULL;
+static size_t g_request_body_len = 0;
+static size_t g_request_body_pos = 0;
+static int g_request_set = 0;
+
 void CosaPhpExtLog(const char* format, ...)
 {
   if (debugFlag)
@@ -209,3 +226,205 @@ int read_file(const char *filename, char** bufout, size_t* lenout)
   return *lenout;
 }
 
+/* smaller files are read: below this, mapping and unmapping them costs
+   more than the copy */
+#define MAP_FILE_MIN (256 * 1024)
+
+int map_file(const char *filename, jst_file* file)
+{
+  struct stat st;
+  void* data = MAP_FAILED;
+  int fd;
+
+  CosaPhpExtLog( "map_file %s\n", filename );
+  memset(file, 0, sizeof(jst_file));
+
+  errno = 0;
+  fd = open(filename, O_RDONLY);
+  if(fd < 0)
+  {
+    int err = errno;
+    CosaPhpExtLog( "map_file cannot open file:%s error:%s\n", filename, strerror(err) );
+    errno = err;
+    return 0;
+  }
+
+  /* empty like read_file, which returns 0 for it too */
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    close(fd);
+    return 0;
+  }
+
+  /* all of it is read right away: fault it in with the mapping */
+  if(st.st_size >= MAP_FILE_MIN)
+  {
+#ifdef MAP_POPULATE
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+  }
+
+  if(data != MAP_FAILED)
+  {
+    file->data = (const char*)data;
+    file->len = (size_t)st.st_size;
+    file->mapped = 1;
+  }
+  else
+  {
+    /* small, or a file system that can't map it */
+    size_t size = (size_t)st.st_size;
+    size_t len = 0;
+    ssize_t rc = 1;
+    char* buf = (char*)malloc(size + 1);
+
+    while(buf && len < size && (rc = read(fd, buf + len, size - len)) > 0)
+      len += (size_t)rc;
+    if(!buf || len < size)
+    {
+      free(buf);
+      close(fd);
+      CosaPhpExtLog( "map_file read failed %s\n", filename );
+      return 0;
+    }
+    buf[len] = 0;
+    file->data = buf;
+    file->len = len;
+  }
+  close(fd);
+  return 1;
+}
+
+void unmap_file(jst_file* file)
+{
+  if(file->mapped)
+    munmap((void*)file->data, file->len);
+  else
+    free((void*)file->data);
+  memset(file, 0, sizeof(jst_file));
+}
+
+uint64_t jst_hash(const void* s, size_t len)
+{
+  const char* buf = (const char*)s;
+  uint64_t h = 0xcbf29ce484222325ULL ^ len;
+  uint64_t w;
+  size_t i;
+
+  /* 8 bytes a step, the high half folded back so every byte reaches the
+     low bits, and mixed once more at the end */
+  for(i = 0; i < len; i += 8)
+  {
+    w = 0;
+    memcpy(&w, buf + i, len - i < 8 ? len - i : 8);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+int listen_unix_socket(const char *path, int backlog)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "Error: socket path too long:%s\n", path);
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+  {
+    fprintf(stderr, "Error: socket failed:%s\n", strerror(errno));
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, backlog) != 0)
+  {
+    fprintf(stderr, "Error: cannot listen on %s error:%s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+void jst_put_function_list(duk_context *ctx, duk_idx_t obj_idx, const duk_function_list_entry *funcs)
+{
+  const duk_function_list_entry* f;
+
+  if(!jst_use_lightfuncs)
+  {
+    duk_put_function_list(ctx, obj_idx, funcs);
+    return;
+  }
+
+  obj_idx = duk_require_normalize_index(ctx, obj_idx);
+  for(f = funcs; f->key; ++f)
+  {
+    /* length mirrors what a full function would report */
+    duk_push_c_lightfunc(ctx, f->value, f->nargs, f->nargs == DUK_VARARGS ? 0 : f->nargs, 0);
+    duk_put_prop_string(ctx, obj_idx, f->key);
+  }
+}
+
+void jst_set_request_input(const char* const* env, const char* cookies, const char* body, size_t body_len)
+{
+  g_request_env = env;
+  g_request_cookies = cookies;
+  g_request_body = body;
+  g_request_body_len = body ? body_len : 0;
+  g_request_body_pos = 0;
+  g_request_set = env || cookies || body;
+}
+
+const char* jst_getenv(const char* name)
+{
+  size_t name_len;
+  int i;
+
+  if(!g_request_set)
+    return getenv(name);
+
+  if(g_request_cookies && strcmp(name, "HTTP_COOKIE") == 0)
+    return g_request_cookies;
+
+  if(!g_request_env)
+    return NULL;
+
+  name_len = strlen(name);
+  for(i = 0; g_request_env[i]; ++i)
+  {
+    if(strncmp(g_request_env[i], name, name_len) == 0 && g_request_env[i][name_len] == '=')
+      return g_request_env[i] + name_len + 1;
+  }
+  return NULL;
+}
+
+size_t jst_read_body(char* buf, size_t len)
+{
+  size_t avail;
+
+  if(!g_request_set)
+    return fread(buf, 1, len, stdin);
+
+  avail = g_request_body_len - g_request_body_pos;
+  if(len > avail)
+    len = avail;
+  if(len)
+    memcpy(buf, g_request_body + g_request_body_pos, len);
+  g_request_body_pos += len;
+  return len;
+}
@@ -19,8 +19,18 @@
 #ifndef CCSP_DUKTAPE_INTERNAL_H
 #define CCSP_DUKTAPE_INTERNAL_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <duktape.h>
 
+/* set by the build, identifies bytecode caches and bundles */
+#ifndef JST_VERSION
+#define JST_VERSION "unknown"
+#endif
+
+/* the prelude every page runs after, see load_template_prelude */
+#define JST_PRELUDE_PATH "/usr/video_analytics/jst_prefix.js"
+
 #define RETURN_LSTRING(res, len) { duk_push_lstring(ctx, res, len); return 1; }
 #define RETURN_STRING(res) { duk_push_string(ctx, res); return 1; }
 #define RETURN_TRUE { duk_push_true(ctx); return 1; }
@@ -32,4 +42,52 @@ void CosaPhpExtLog(const char* format, ...);
 int parse_parameter(const char* func, duk_context *ctx, const char* types, ...);
 int read_file(const char *filename, char** bufout, size_t* lenout);
 
+/* A file to read only: a large one is mapped (shared with every process
+   mapping it), a small one or one that can't be mapped is read into the
+   heap, see map_file. Unlike read_file mapped data is not NUL terminated.
+   Replace a file by rename, not by writing it in place: a reader of a
+   mapped file truncated under it gets SIGBUS. */
+typedef struct jst_file
+{
+  const char* data;
+  size_t len;
+  int mapped;       /* else data is a malloc'd copy, NUL terminated */
+}jst_file;
+
+/* 1 if the file was read, 0 if it can't be (errno is set if it can't be
+   opened) or is empty; nothing is written to stderr, that is up to the
+   caller */
+int map_file(const char *filename, jst_file* file);
+void unmap_file(jst_file* file);
+
+/* 64 bit hash of len bytes at s, for the static content keys, the
+   include registry and the content of the bytecode cache dependencies */
+uint64_t jst_hash(const void* s, size_t len);
+
+/* jst_hash of the translation catalog's content, 0 without one; the static
+   content of a run page depends on it (see jst_i18n.c) */
+uint64_t jst_i18n_catalog_hash(void);
+int listen_unix_socket(const char *path, int backlog);
+
+/* Byte scanning for the template parser, see jst_scan.c; each returns
+   end if there is no match. jst_scan_pair finds the first s[0] == a with
+   s[1] == b, jst_scan_any the first byte that is one of a, b, c or d. */
+const char* jst_scan_pair(const char* s, const char* end, char a, char b);
+const char* jst_scan_any(const char* s, const char* end, char a, char b, char c, char d);
+size_t jst_scan_count(const char* s, const char* end, char c);
+
+/* duk_put_function_list replacement used by the ccsp modules. When
+   jst_use_lightfuncs is set (jst_heap_init with JST_HEAP_CGI) the bindings
+   are pushed as lightfuncs: no function object is allocated per binding,
+   which matters for one-shot CGI processes that call only a few of them. */
+extern int jst_use_lightfuncs;
+void jst_put_function_list(duk_context *ctx, duk_idx_t obj_idx, const duk_function_list_entry *funcs);
+
+/* Request input. By default the CGI variables come from the process
+   environment and the body from stdin; an embedder (jst_render) installs
+   its own request with jst_set_request_input and clears it with NULLs. */
+void jst_set_request_input(const char* const* env, const char* cookies, const char* body, size_t body_len);
+const char* jst_getenv(const char* name);
+size_t jst_read_body(char* buf, size_t len);
+
 #endif
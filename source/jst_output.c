@@ -0,0 +1,275 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+/*
+  Page output and static content.
+
+  What a page echoes is collected in a native buffer rather than a JS
+  string, and written by _jst_finish (jst_prefix.js) through _jst_flush.
+
+  The content blocks of a run page are not JS string literals: the parser
+  puts them in a side table and emits _jst_static(key, n), which copies
+  entry n of the table straight into the buffer. The table is appended to
+  the page's code (source or bytecode) by the parser and the loaders:
+
+    key[16]            hex jst_hash of the template source and catalog
+    uint32_t count
+    uint32_t off[count + 1]   entry n is data[off[n]..off[n + 1])
+    data
+    uint32_t table_len        bytes from key to the end of data
+    "JSTS"
+
+  and registered under its key when the code is loaded (jst_static_register).
+  The key is taken from the source and the translation catalog, so code
+  and table loaded for the same template always match, and a function
+  defined by an include still finds its table when it runs later from the
+  page. Tables of the current page are never dropped: only those not used
+  since jst_output_reset make room for new ones.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "jst.h"
+#include "jst_internal.h"
+
+#define STATIC_MAGIC "JSTS"
+#define STATIC_HEAD  (JST_STATIC_KEY_LEN + 4)
+
+/* tables kept of the templates loaded before the current page; the
+   page's own are kept however many it loads */
+#define JST_STATIC_TABLES_MAX 64
+
+typedef struct static_table
+{
+  char* data;           /* from the key to the end of the content */
+  size_t len;
+  uint32_t count;
+  unsigned int page;    /* g_page when last registered or used */
+  struct static_table* next;
+}static_table;
+
+static static_table* g_tables = NULL;
+static int g_tables_count = 0;
+static unsigned int g_page = 0;   /* counts jst_output_reset */
+
+static char* g_out = NULL;
+static size_t g_out_len = 0;
+static size_t g_out_alloc = 0;
+
+static int out_push(const char* s, size_t len)
+{
+  if(g_out_len + len > g_out_alloc)
+  {
+    size_t alloc = g_out_alloc ? g_out_alloc : 16384;
+    char* out;
+
+    while(alloc < g_out_len + len)
+      alloc *= 2;
+    out = (char*)realloc(g_out, alloc);
+    if(!out)
+    {
+      CosaPhpExtLog("failed to grow the output buffer\n");
+      return 0;
+    }
+    g_out = out;
+    g_out_alloc = alloc;
+  }
+  memcpy(g_out + g_out_len, s, len);
+  g_out_len += len;
+  return 1;
+}
+
+static uint32_t table_u32(const char* p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/* length of the table trailing code, 0 if there is none */
+static size_t static_trailer(const char* code, size_t len)
+{
+  size_t table_len;
+  uint32_t count;
+
+  if(len < 8 || memcmp(code + len - 4, STATIC_MAGIC, 4) != 0)
+    return 0;
+  table_len = table_u32(code + len - 8);
+  if(table_len < STATIC_HEAD || table_len > len - 8)
+    return 0;
+
+  count = table_u32(code + len - 8 - table_len + JST_STATIC_KEY_LEN);
+  if(count > (table_len - STATIC_HEAD) / 4 - 1 ||
+     table_u32(code + len - 8 - table_len + STATIC_HEAD + count * 4) !=
+       table_len - STATIC_HEAD - (count + 1) * 4)
+    return 0;
+  return table_len + 8;
+}
+
+size_t jst_static_code_len(const char* code, size_t len)
+{
+  return len - static_trailer(code, len);
+}
+
+size_t jst_static_register(const char* code, size_t len)
+{
+  size_t trailer = static_trailer(code, len);
+  const char* table = code + len - trailer;
+  static_table* t;
+  static_table** last;
+
+  if(!trailer)
+    return len;
+
+  for(t = g_tables; t; t = t->next)
+  {
+    if(memcmp(t->data, table, JST_STATIC_KEY_LEN) == 0)
+    {
+      t->page = g_page;
+      return len - trailer;
+    }
+  }
+
+  t = (static_table*)calloc(1, sizeof(static_table));
+  if(!t || !(t->data = (char*)malloc(trailer - 8)))
+  {
+    free(t);
+    return len - trailer;
+  }
+  memcpy(t->data, table, trailer - 8);
+  t->len = trailer - 8;
+  t->count = table_u32(table + JST_STATIC_KEY_LEN);
+  t->page = g_page;
+  t->next = g_tables;
+  g_tables = t;
+  g_tables_count++;
+
+  /* drop the oldest table the current page hasn't used, if any */
+  if(g_tables_count > JST_STATIC_TABLES_MAX)
+  {
+    static_table** drop = NULL;
+
+    for(last = &g_tables; *last; last = &(*last)->next)
+      if((*last)->page != g_page)
+        drop = last;
+    if(drop)
+    {
+      t = *drop;
+      *drop = t->next;
+      free(t->data);
+      free(t);
+      g_tables_count--;
+    }
+  }
+  return len - trailer;
+}
+
+/* write a value as _jst_echo_buffer += value did */
+static void out_push_value(duk_context *ctx, duk_idx_t idx)
+{
+  const char* s;
+  duk_size_t len;
+
+  if(duk_is_undefined(ctx, idx))
+    return;
+  duk_to_primitive(ctx, idx, DUK_HINT_NONE);
+  s = duk_to_lstring(ctx, idx, &len);
+  out_push(s, len);
+}
+
+/* echo(str) */
+static duk_ret_t output_echo(duk_context *ctx)
+{
+  out_push_value(ctx, 0);
+  return 0;
+}
+
+/* _jst_echo(a, b, ...): the <?%= ?> values of a run page, in order */
+static duk_ret_t output_echo_values(duk_context *ctx)
+{
+  duk_idx_t nargs = duk_get_top(ctx);
+  duk_idx_t i;
+
+  for(i = 0; i < nargs; ++i)
+    out_push_value(ctx, i);
+  return 0;
+}
+
+/* _jst_static(key, n): content entry n of the template with key */
+static duk_ret_t output_static(duk_context *ctx)
+{
+  const char* key = duk_require_string(ctx, 0);
+  duk_uint_t n = duk_require_uint(ctx, 1);
+  static_table* t;
+  const char* off;
+
+  for(t = g_tables; t; t = t->next)
+    if(strncmp(t->data, key, JST_STATIC_KEY_LEN) == 0)
+      break;
+  if(!t || n >= t->count)
+    return duk_error(ctx, DUK_ERR_REFERENCE_ERROR, "static content %s/%u is not loaded", key, (unsigned)n);
+  t->page = g_page;
+
+  off = t->data + STATIC_HEAD;
+  out_push(off + (t->count + 1) * 4 + table_u32(off + n * 4),
+           table_u32(off + (n + 1) * 4) - table_u32(off + n * 4));
+  return 0;
+}
+
+/* _jst_flush(headers): print() the headers, then the output and a line
+   feed, as print(headers + output) did, and empty the buffer */
+static duk_ret_t output_flush(duk_context *ctx)
+{
+  duk_get_global_string(ctx, "print");
+  duk_dup(ctx, -1);
+  duk_dup(ctx, 0);
+  duk_to_buffer(ctx, -1, NULL);
+  duk_call(ctx, 1);
+  duk_pop(ctx);
+
+  if(!out_push("\n", 1))
+    return duk_error(ctx, DUK_ERR_ERROR, "out of memory");
+  duk_push_external_buffer(ctx);
+  duk_config_buffer(ctx, -1, g_out, g_out_len);
+  duk_call(ctx, 1);
+  g_out_len = 0;
+  return 0;
+}
+
+static const duk_function_list_entry output_funcs[] = {
+  { "echo", output_echo, 1 },
+  { "_jst_echo", output_echo_values, DUK_VARARGS },
+  { "_jst_static", output_static, 2 },
+  { "_jst_flush", output_flush, 1 },
+  { NULL, NULL, 0 }
+};
+
+void jst_output_init(duk_context *ctx)
+{
+  duk_push_global_object(ctx);
+  jst_put_function_list(ctx, -1, output_funcs);
+  duk_pop(ctx);
+}
+
+void jst_output_reset(void)
+{
+  g_out_len = 0;
+  g_page++;
+}
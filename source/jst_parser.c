@@ -16,10 +16,13 @@
  See the License for the specific language governing permissions and
  limitations under the License.
 */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <memory.h>
+#include <errno.h>
 #include <unistd.h>
 #include "jst.h"
 #include "jst_internal.h"
@@ -52,7 +55,6 @@ typedef struct template_block
   char* start;
   size_t len;
   template_block_type type;
-  int need_free;
 }template_block;
 
 typedef struct growing_buffer
@@ -62,48 +64,64 @@ typedef struct growing_buffer
   size_t alloc_len;
 }growing_buffer;
 
-#define GB_BLOCK_SIZE 100000
+#define GB_BLOCK_SIZE 4096
 
 void buffer_init(growing_buffer* buf)
 {
   memset(buf, 0, sizeof(growing_buffer));
-  buf->data = (char*)calloc(GB_BLOCK_SIZE, 1);
+  buf->data = (char*)malloc(GB_BLOCK_SIZE);
   if(!buf->data)
   {
     log_debug_message("failed to alloc buffer data\n");
+    return;
   }
+  buf->data[0] = 0;
   buf->alloc_len = GB_BLOCK_SIZE;
-  buf->write_len = 0;
 }
 
-void buffer_push(growing_buffer* buf, const char* s, size_t len)
+/* room for len more bytes and the null terminator; unless exact it at
+   least doubles, so pushing n bytes in pieces copies O(n) bytes in all */
+static int buffer_grow(growing_buffer* buf, size_t len, int exact)
 {
-  if(buf->alloc_len < buf->write_len + len + 1) /*+ 1 is space for null terminator*/
+  size_t need = buf->write_len + len + 1;
+  size_t alloc;
+  char* rbuf;
+
+  if(!buf->data)
+    return 0;
+  if(buf->alloc_len >= need)
+    return 1;
+
+  alloc = exact ? need : buf->alloc_len * 2;
+  if(alloc < need)
+    alloc = need;
+  rbuf = (char*)realloc(buf->data, alloc);
+  if(!rbuf)
   {
-    if(!buf->data)
-      return;
+    free(buf->data);
+    memset(buf, 0, sizeof(growing_buffer));/*all future calls to buffer_push will return after the if(!buf->data) check above*/
+    log_debug_message("failed to realloc growing buffer\n");
+    return 0;
+  }
+  buf->data = rbuf;
+  buf->alloc_len = alloc;
+  return 1;
+}
 
-    while(buf->alloc_len < buf->write_len + len + 1)
-    {
-      buf->alloc_len += GB_BLOCK_SIZE;
-    }
+/* make room for len more bytes at once, when the size is known */
+void buffer_reserve(growing_buffer* buf, size_t len)
+{
+  buffer_grow(buf, len, 1);
+}
 
-    char* rbuf = (char*)realloc(buf->data, buf->alloc_len);
-    if(rbuf)
-    {
-      buf->data = rbuf;
-      memset(buf->data + buf->write_len, 0, buf->alloc_len - buf->write_len);
-    }
-    else
-    {
-      free(buf->data);
-      memset(buf, 0, sizeof(growing_buffer));/*all future calls to buffer_push will return after the if(!buf->data) check above*/
-      log_debug_message("failed to realloc growing buffer\n");
-      return;
-    }
-  }
-  strncpy(buf->data + buf->write_len, s, len);
+/* the data stays null terminated */
+void buffer_push(growing_buffer* buf, const char* s, size_t len)
+{
+  if(!buffer_grow(buf, len, 0))
+    return;
+  memcpy(buf->data + buf->write_len, s, len);
   buf->write_len += len;
+  buf->data[buf->write_len] = 0;
 }
 
 void buffer_free(growing_buffer* buf)
@@ -114,36 +132,124 @@ void buffer_free(growing_buffer* buf)
 
 
 #define MAX_PATH_LEN 256
-#define MAX_INCLUDE_FILE 16
+
+/* the include registry: full paths in the order they were registered,
+   the top level template first, and an open addressing hash table of
+   them, so an include once check doesn't depend on how many there are */
+typedef struct template_registry
+{
+  char** paths;
+  int count;
+  int alloc;
+  int* index;       /* 1 + the index of a path in paths, 0 if free */
+  int index_size;   /* a power of 2, at least twice count */
+}template_registry;
+
 static int g_is_cgi = 1;
 static char g_document_root_path[MAX_PATH_LEN] = {0};
-static char g_include_paths[MAX_INCLUDE_FILE][MAX_PATH_LEN] = {{0}};
-static int g_include_paths_count = 0;
+static template_registry g_registry;
+static int g_include_units = 0;
+static int g_optimize = 0;
+static int g_static = 0;        /* LOAD_TEMPLATE_STATIC parse */
+static char g_table_key[JST_STATIC_KEY_LEN + 1];  /* see template_table_begin */
+static growing_buffer g_table_data;   /* content not in the source: literals */
+static growing_buffer g_table_off;
+static growing_buffer g_table_slices; /* template_slice, see template_table_slice */
+static size_t g_table_len = 0;
+static const char* g_table_src = NULL;
+static size_t g_table_src_len = 0;
+static uint32_t g_table_count = 0;
+static growing_buffer g_prefetch;   /* see template_prefetch */
+static int g_code_blocks = 0;   /* see load_template_is_static */
+static growing_buffer g_units;  /* see load_template_units */
 
 static void template_write_block(growing_buffer* bufout, template_block* block);
-static int template_make_include(char** bufcur, size_t* buflen, template_block* block, char* bufstart);
-static int template_make_block(char** bufcur, size_t* buflen, template_block* block);
-static void process_includes(char* buf, size_t buflen, growing_buffer* bufout);
-static void process_jst(char* buf, size_t buflen, growing_buffer* bufout);
-static int template_process(char** buf, size_t* buflen, int top);
+static int template_process(const char* src, size_t srclen, char** bufout, size_t* lenout, int top);
+static int template_regex_keyword(const char* s, size_t len);
 
-static void log_syntax_error(char* err, char* s1, char* cur, char* end)
+static void log_syntax_error(char* err, const char* s1, const char* cur, const char* end)
 {
-  char ch;
-
   while(cur != end && *cur != '\n' && *cur != '\r')
     cur++;
 
-  ch = *cur;
-  *cur = 0;
-  log_debug_message("syntax error. malformed include: %s. line: %s src:%s\n", err, s1, cur);
-  *cur = ch;
+  log_debug_message("syntax error. malformed include: %s. line: %.*s src:\n", err, (int)(cur - s1), s1);
 }
 
-static void template_write_block(growing_buffer* bufout, template_block* block)
+/* write text as the inside of a single quoted string literal. With
+   continue_lines a line feed also ends the line of code, so the generated
+   code keeps the line numbers of the template. */
+static void template_write_text(growing_buffer* bufout, const char* s, size_t len, int continue_lines)
+{
+  const char* end = s + len;
+  const char* p = s;
+
+  for(;;)
+  {
+    const char* esc;
+    size_t esc_len = 2;
+
+    /* the runs between the bytes that need escaping are copied as they are */
+    p = jst_scan_any(p, end, '\n', '\r', '\'', '\\');
+    if(p == end)
+      break;
+
+    /*line feeds: 
+      in order to build a string that is broken by line feeds,
+      and in order to preserve the line feed in the string
+      so that the client gets back the exact content we have in our file,
+      we need to embed an escaped line feed into the string,
+      and we need to end the line with an escaped backslash.
+        example:
+          input : '...foo\n...'
+          output: '...foo\\n\\\n ...'
+    */
+    if(*p == '\n')
+    {
+      esc = continue_lines ? "\\n\\\n" : "\\n";
+      esc_len = continue_lines ? 4 : 2;
+    }
+    /* carriage returns only come from string literals (see template_fold_literal) */
+    else if(*p == '\r')
+    {
+      if(continue_lines)
+      {
+        p++;
+        continue;
+      }
+      esc = "\\r";
+    }
+    /* single quotes must be escaped because we are putting 
+       content in a single quoted string */
+    else if(*p == '\'')
+      esc = "\\'";
+    /* backslash must be escaped because a single backslash 
+        inside a string is an escape character prefix.
+       This happens if content javascript is escaping something
+      and the jst javascript we send to duk needs to print
+        the content javascript exactly */
+    else
+      esc = "\\\\";
+
+    buffer_push(bufout, s, p - s);
+    buffer_push(bufout, esc, esc_len);
+    s = ++p;
+  }
+  buffer_push(bufout, s, end - s);
+}
+
+/* 1 if the block is empty or only whitespace */
+static int template_block_blank(template_block* block)
 {
   size_t i;
 
+  for(i = 0; i < block->len; ++i)
+    if(!isspace(block->start[i]))
+      return 0;
+  return 1;
+}
+
+static void template_write_block(growing_buffer* bufout, template_block* block)
+{
   /*
   char tmp = *(block->start + block->len);
   *(block->start + block->len) = 0;
@@ -152,15 +258,7 @@ static void template_write_block(growing_buffer* bufout, template_block* block)
   */
 
   /* ignore whitespace only blocks */
-  if(block->len == 0)
-  {
-    //printf("skipping 0 len block\n");
-    return;
-  }
-  for(i = 0; i < block->len; ++i)
-    if(!isspace(block->start[i]))
-      break;
-  if(i == block->len)
+  if(template_block_blank(block))
   {
     //printf("skipping block which is all whitespace\n");
     return;
@@ -169,720 +267,1691 @@ static void template_write_block(growing_buffer* bufout, template_block* block)
   if(block->type == template_block_content)
   {
     buffer_push(bufout, "echo('", 6);
+    template_write_text(bufout, block->start, block->len, 1);
+    buffer_push(bufout, "');", 3);
   }
   else if(block->type == template_block_string)
   {
     buffer_push(bufout, "echo(", 5);
-  }
-
-  if(block->type == template_block_content)
-  {
-    for(i = 0; i < block->len; ++i)
-    {
-      /*line feeds: 
-        in order to build a string that is broken by line feeds,
-        and in order to preserve the line feed in the string
-        so that the client gets back the exact content we have in our file,
-        we need to embed an escaped line feed into the string,
-        and we need to end the line with an escaped backslash.
-          example:
-            input : '...foo\n...'
-            output: '...foo\\n\\\n ...'
-      */
-      if(block->start[i] == '\n')
-      {
-        buffer_push(bufout, "\\n\\", 3);
-      }
-      /* single quotes must be escaped because we are putting 
-         content in a single quoted string */
-      else if(block->start[i] == '\'')
-      {
-        buffer_push(bufout, "\\", 1);
-      }
-      /* backslash must be escaped because a single backslash 
-          inside a string is an escape character prefix.
-         This happens if content javascript is escaping something
-        and the jst javascript we send to duk needs to print
-          the content javascript exactly */
-      else if(block->start[i] == '\\')
-      {
-        buffer_push(bufout, "\\", 1);
-      }
-      buffer_push(bufout, &block->start[i], 1);
-    }
+    buffer_push(bufout, block->start, block->len);
+    buffer_push(bufout, ");", 2);
   }
   else
   {
     buffer_push(bufout, block->start, block->len);
   }
-
-  if(block->type == template_block_content)
-  {
-    buffer_push(bufout, "');", 3);
-  }
-  else if(block->type == template_block_string)
-  {
-    buffer_push(bufout, ");", 2);
-  }
 }
 
-static int template_make_include(char** bufcur, size_t* buflen, template_block* block, char* bufstart)
+/*
+  Code generation for pages that are run (LOAD_TEMPLATE_BODY/UNIT); the
+  output of 'jst --parse-only' is left as it is.
+
+  Content is not turned into string literals: runs of content and literal
+  expressions go into the template's static content table (jst_output.c),
+  and the code writes them with _jst_static. Runs of <?%= ?> values become
+  one call to _jst_echo, which writes its arguments in order:
+    a<?%= x ?><?%= y ?>b<?%= "c" ?>  ->  _jst_static('<key>',0);_jst_echo(x, y);_jst_static('<key>',1);
+  with entries "a" and "bc". The arguments are evaluated before anything
+  is written, so only plain names (x, a.b, a[0]) are joined after another
+  value: any other expression might echo itself and starts a call of its
+  own to keep the output in order. Comments and indentation of the
+  generated code are dropped by template_minify. Line feeds are kept, so
+  the line numbers in errors are still those of the template.
+*/
+#define TEMPLATE_MAX_PARTS 16
+
+typedef enum template_part_type
 {
-  char* buff;
-  char* s1;
-  char* cur;
-  char* end;
-  int valid;
-  int quotes;
-  int i;
-  char include_path[TMPL_MAX_INC_SZ];
-  size_t ilen;
+  template_part_text,     /* content */
+  template_part_literal,  /* string literal(s) or integer, see template_fold_literal */
+  template_part_name,     /* plain name, see template_is_name */
+  template_part_expr      /* any other expression, only as the first part */
+}template_part_type;
 
-  buff = *bufcur;
-  end = buff + *buflen;
+typedef struct template_part
+{
+  template_part_type type;
+  const char* start;
+  size_t len;
+}template_part;
 
-  s1 = buff;
+/* a run of static table content: in the template source at src, or at
+   off in g_table_data if src is NULL */
+typedef struct template_slice
+{
+  const char* src;
+  size_t off;
+  size_t len;
+}template_slice;
 
-  block->need_free = 0;
+static int template_is_ident(int c)
+{
+  return isalnum(c) || c == '_' || c == '$';
+}
 
-  for(;;)
+/* skip a JS string literal at s; returns the end, or NULL if it isn't
+   one this code can copy as text (only \\ \' \" \n \r \t escapes) */
+static const char* template_skip_literal(const char* s, const char* end)
+{
+  char q = *s++;
+
+  while(s < end && *s != q)
   {
-    valid = 0;
-    
-    if(s1 >= end || 
-      (s1 = strstr(s1, "include")) == NULL)
+    if(*s == '\n' || *s == '\r')
+      return NULL;
+    if(*s == '\\')
     {
-      block->type = template_block_code;
-      block->start = buff;
-      block->len = *buflen;
-      *bufcur += *buflen;
-      *buflen = 0;
-      return block->len;
+      if(++s == end || !*s || !strchr("\\'\"nrt", *s))
+        return NULL;
     }
+    s++;
+  }
+  return s < end ? s + 1 : NULL;
+}
 
-    /*determine if this include is in a js tag 
-      by searching backwards and looking for the open tag*/
+static void template_trim(const char** s, size_t* len)
+{
+  while(*len && isspace((unsigned char)**s))
+  {
+    (*s)++;
+    (*len)--;
+  }
+  while(*len && isspace((unsigned char)(*s)[*len - 1]))
+    (*len)--;
+}
 
-    if(s1 - bufstart < JST_OPEN_LEN)
-    {
-      /*too close to start of file to have an open tag
-        but its possible this is some kind of html so continue*/
-      break;
-    }
-    else
-    {
-      cur = s1 - JST_OPEN_LEN;
+/* "lit" + 'lit' ... or an integer JS prints as written, up to 2^53 - 1
+   (larger ones are rounded, and from 1e21 on printed with an exponent):
+   returns 1 and trims the expression */
+static int template_is_literal(const char** s, size_t* len)
+{
+  const char* cur;
+  const char* end;
 
-      for(;;)
-      {
-        if(!strncmp(cur, JST_OPEN_TAG, JST_OPEN_LEN))
-        {
-          /*we found the open tag which mean we are inside a tag*/
-          valid = 1;
-          break;
-        }
-        else if(!strncmp(cur, JST_CLOSE_TAG, JST_CLOSE_LEN))
-        {
-          /*we found a close tag which means we aren't in a tag */
-          break;
-        }
-        if(cur == bufstart)
-        {
-          /*if we hit the start of the file thus we aren't in a tag*/
-          break;
-        } 
-        cur--;
-      }
-    }
+  if(memchr(*s, '\n', *len))
+    return 0;
+  template_trim(s, len);
+  cur = *s;
+  end = *s + *len;
+  if(cur == end)
+    return 0;
+
+  if(isdigit((unsigned char)*cur))
+  {
+    if(*cur == '0' && *len > 1)
+      return 0;
+    while(cur < end && isdigit((unsigned char)*cur))
+      cur++;
+    if(cur != end)
+      return 0;
+    return *len < 16 || (*len == 16 && memcmp(*s, "9007199254740991", 16) <= 0);
+  }
 
-    ilen = strlen("include");
+  for(;;)
+  {
+    if(*cur != '\'' && *cur != '"')
+      return 0;
+    cur = template_skip_literal(cur, end);
+    if(!cur)
+      return 0;
+    while(cur < end && (*cur == ' ' || *cur == '\t'))
+      cur++;
+    if(cur == end)
+      return 1;
+    if(*cur++ != '+')
+      return 0;
+    while(cur < end && (*cur == ' ' || *cur == '\t'))
+      cur++;
+    if(cur == end)
+      return 0;
+  }
+}
 
-    if(!valid)
-    {
-      /* this include wasn't inside a js tag, so skip and search for next*/
-      s1 += ilen;
-      continue; 
-    }
+/* a[.b|[0]|['c']|[d]]... on one line: reading it can't echo anything */
+static int template_is_name(const char** s, size_t* len)
+{
+  const char* cur;
+  const char* end;
 
-    /*we have an include that's inside a js tag
-      now check that its not commented out 
-      by searching backwards for comment tags*/
+  if(memchr(*s, '\n', *len))
+    return 0;
+  template_trim(s, len);
+  cur = *s;
+  end = *s + *len;
+  if(cur == end || isdigit((unsigned char)*cur))
+    return 0;
 
+  for(;;)
+  {
+    if(cur == end || !template_is_ident(*cur))
+      return 0;
+    while(cur < end && template_is_ident(*cur))
+      cur++;
 
-    /* check if this include is in a single line comment */
-    cur = s1-2;
-    for(;;)
+    while(cur < end && *cur == '[')
     {
-      if(cur[0] == '/' && cur[1] == '/')
-      {
-        /* found the // on the same line so its commented out*/
-        valid = 0;
-        break;
-      }
-      else if(cur[0] == '\n' || cur[1] == '\n')
+      cur++;
+      if(cur < end && (*cur == '\'' || *cur == '"'))
       {
-        /* we are on the previous line now so we are good */
-        break;
+        cur = template_skip_literal(cur, end);
+        if(!cur)
+          return 0;
       }
-      else if(cur == bufstart)
+      else
       {
-        /* we have reach the start of the file so we are good */
-        break;
+        const char* word = cur;
+        while(cur < end && template_is_ident(*cur))
+          cur++;
+        if(cur == word)
+          return 0;
       }
-      cur--;
+      if(cur == end || *cur++ != ']')
+        return 0;
     }
 
-    if(!valid)
-    {
-      /* this include was commented out so search for the next */
-      s1 += ilen;
-      continue;
-    }
+    if(cur == end)
+      return 1;
+    if(*cur++ != '.')
+      return 0;
+  }
+}
 
-    /* check if this include is in a block comment */
-    cur = s1-2;
-    for(;;)
-    {
-      if(cur[0] == '/' && cur[1] == '*')
-      {
-        /*we found the start of a comment thus we are in a comment*/
-        valid = 0;
-        break;
-      }
-      else if(cur[0] == '*' && cur[1] == '/')
-      {
-        /*we found the end of a comment thus we are not in a comment*/
-        break;
-      }
-      else if(cur == bufstart)
-      {
-        break;
-      }
-      cur--;
-    }
+/* an expression that can be passed as an argument as it is: echo(a, b)
+   only wrote a, so anything with a comma (or a comment) stays on its own */
+static int template_is_expr(const char* s, size_t len)
+{
+  size_t i;
 
-    if(!valid)
-    {
-      /* this include was commented out so search for the next */
-      s1 += ilen;
-      continue;
-    }
+  for(i = 0; i < len; ++i)
+    if(s[i] == ',' || s[i] == ';' || (s[i] == '/' && i + 1 < len && (s[i + 1] == '/' || s[i + 1] == '*')))
+      return 0;
+  return 1;
+}
+
+/* append the value of a literal part to the static content table */
+static void template_fold_literal(growing_buffer* bufout, const char* s, size_t len)
+{
+  const char* end = s + len;
+
+  if(isdigit((unsigned char)*s))
+  {
+    buffer_push(bufout, s, len);
+    return;
+  }
 
-    /* The only valid chars in front should be whitespace or semicolon */  
-    /* FIXME - i'm not sure this captures every possible syntax correctly */
-    cur = s1;
-    cur--;
-    if(*cur != ' ' && *cur != '\t' && *cur != ';' && *cur != '\n')
+  while(s < end)
+  {
+    char q;
+    const char* run;
+
+    if(*s != '\'' && *s != '"')
     {
-      /* this could be a variable or another function */
-      s1 += ilen;
+      s++;
       continue;
     }
 
-    /*search ahead for ( */
-    cur = s1+7;
-    for(;;)
+    q = *s++;
+    run = s;
+    while(*s != q)
     {
-      if(cur >= end)
-      {
-        /*reached end of file*/
-        valid = 0;
-        break;
-      }
-      if(*cur == '(')
+      if(*s == '\\')
       {
-        break;
+        char c = s[1];
+
+        buffer_push(bufout, run, s - run);
+        if(c == 'n')
+          c = '\n';
+        else if(c == 'r')
+          c = '\r';
+        else if(c == 't')
+          c = '\t';
+        buffer_push(bufout, &c, 1);
+        s += 2;
+        run = s;
+        continue;
       }
-      if(*cur != ' ')/*only a space is allowed*/
-      {
-        /*this could be a function which starts with include, like includeFoo()*/
-        valid = 0;
-        break;
-      }
-      cur++;
+      s++;
     }
+    buffer_push(bufout, run, s - run);
+    s++;
+  }
+}
 
-    if(!valid)
-    {
-      s1 += ilen;
-      continue;
-    }
-    cur++;
+/* 1 if the word from s to e is the function name, or object followed by
+   .method; call is set to what follows */
+static int template_is_call(const char* s, const char* e, const char* end, const char* name,
+                            const char* object, const char* method, const char** call)
+{
+  size_t len = strlen(method);
 
-    /* at this point we know its ' include(' */
+  if((size_t)(e - s) == strlen(name) && memcmp(s, name, e - s) == 0)
+  {
+    *call = e;
+    return 1;
+  }
+  if((size_t)(e - s) == strlen(object) && memcmp(s, object, e - s) == 0 &&
+     (size_t)(end - e) > len + 1 && *e == '.' && memcmp(e + 1, method, len) == 0 &&
+     !template_is_ident((unsigned char)e[1 + len]))
+  {
+    *call = e + 1 + len;
+    return 1;
+  }
+  return 0;
+}
 
-    /*if there is stuff before the include that hasn't been written
-      send it back to get written */
-    if(s1 != buff)
-    {
-      block->type = template_block_code;
-      block->start = buff;
-      block->len = s1 - buff;
-      *bufcur = s1;
-      *buflen -= block->len;
-      return block->len;
-    }
+/* the single string literal argument of the call at s, decoded into
+   g_literal (NUL terminated); returns the end of the call, or NULL if it
+   isn't one */
+static growing_buffer g_literal;
 
-    /* now look for syntax errors that should kill the load 
-       for anything not valid, log a syntax error and return 0 */
+static const char* template_literal_arg(const char* s, const char* end)
+{
+  const char* lit;
+
+  while(s < end && isspace((unsigned char)*s))
+    s++;
+  if(s == end || *s++ != '(')
+    return NULL;
+  while(s < end && isspace((unsigned char)*s))
+    s++;
+  if(s == end || (*s != '\'' && *s != '"'))
+    return NULL;
+  lit = s;
+  s = template_skip_literal(s, end);
+  if(!s)
+    return NULL;
+  while(s < end && isspace((unsigned char)*s))
+    s++;
+  if(s == end || *s++ != ')')
+    return NULL;
+
+  if(!g_literal.data)
+    buffer_init(&g_literal);
+  g_literal.write_len = 0;
+  template_fold_literal(&g_literal, lit, s - lit);
+  buffer_push(&g_literal, "", 1);
+  g_literal.write_len--;
+  return g_literal.data ? s : NULL;
+}
 
-    /* search ahead for single or double quote */
-    for(;;)
-    {
-      if(cur >= end)
-      {
-        /*reached end of file*/
-        valid = 0;
-        break;
-      }
-      if(*cur == '\'')
-      {
-        quotes = 1;
-        break;
-      }
-      else if(*cur == '\"')
-      {
-        quotes = 2;
-        break;
-      }
+/* the translation of the call to _ or ccsp.gettext at s, written as a
+   literal; returns the end of the call, or NULL to leave it to run time */
+static const char* template_translate_call(growing_buffer* bufout, const char* s, const char* end)
+{
+  const char* str;
+  size_t len;
 
-      /*if anything other then a space exist before the quote, then it could be a variable,
-        in which case we let the 'include' function (in jst_functions.c) to process it at runtime*/
-      if(*cur != ' ')
-      {
-        log_debug_message("runtime include statement found\n");
-        valid = 0;
-        break;
-      }
+  s = template_literal_arg(s, end);
+  /* U+2028 and U+2029 would end the line inside the literal */
+  if(!s || !jst_i18n_lookup(g_literal.data, g_literal.write_len, &str, &len) ||
+     memmem(str, len, "\xe2\x80\xa8", 3) || memmem(str, len, "\xe2\x80\xa9", 3))
+    return NULL;
 
-      cur++;
-    }
+  buffer_push(bufout, "'", 1);
+  template_write_text(bufout, str, len, 0);
+  buffer_push(bufout, "'", 1);
+  return s;
+}
 
-    if(!valid)
-    {
-      s1 += ilen;
-      continue;
-    }
+/* add the parameter of the call to getStr at s to g_prefetch */
+static void template_prefetch_call(const char* s, const char* end)
+{
+  size_t i;
 
-    cur++;
+  if(!template_literal_arg(s, end) || !g_literal.write_len ||
+     memchr(g_literal.data, 0, g_literal.write_len))
+    return;
 
-    /* now copy the include path characters while searching for the end quote */
-    i = 0; 
-    for(;;)
-    {
-      if(cur >= end)
-      {
-        log_syntax_error("include path at eof", s1, cur, end);
-        valid = 0;
-        break;
-      }
+  for(i = 0; i < g_prefetch.write_len; i += strlen(g_prefetch.data + i) + 1)
+    if(strcmp(g_prefetch.data + i, g_literal.data) == 0)
+      return;
+  if(!g_prefetch.data)
+    buffer_init(&g_prefetch);
+  buffer_push(&g_prefetch, g_literal.data, g_literal.write_len + 1);
+}
 
-      if((quotes == 1 && *cur == '\'') || 
-         (quotes == 2 && *cur == '\"'))
-      {
-        break;
-      }
+/*
+  Calls with a single string literal argument in the code of a run page:
 
-      if(i == TMPL_MAX_INC_SZ)
-      {
-        log_syntax_error("include path too long", s1, cur, end);
-        valid = 0;
-        break;
-      }
+  - compile time translation (jst_i18n.c): _("literal") and
+    ccsp.gettext("literal") become the translated literal, so
+    <?%= _("Save") ?> is content like any other. Calls with any other
+    argument, and msgids without a translation, are left to do_gettext.
+  - getStr("literal") and ccsp_cosa.getStr("literal") add the parameter
+    to g_prefetch, see template_prefetch.
 
-      if((quotes == 1 && *cur == '\"') || 
-         (quotes == 2 && *cur == '\''))
-      {
-        log_syntax_error("include quotes missmatch", s1, cur, end);
-        valid = 0;
-        break;
-      }
+  With translate and any call replaced the block is set to a copy, which
+  is returned for the caller to free; else NULL.
+*/
+static char* template_scan_code(template_block* block, int translate)
+{
+  growing_buffer out;
+  const char* s = block->start;
+  const char* end = block->start + block->len;
+  const char* run = s;
+  char last = 0;    /* last character that isn't whitespace, for '/' */
+
+  memset(&out, 0, sizeof(out));
+  while(s < end)
+  {
+    char c = *s;
 
-      include_path[i++] = *(cur++);
+    if(c == '\'' || c == '"' || c == '`' ||
+       (c == '/' && s + 1 < end && s[1] != '/' && s[1] != '*' && (!last || strchr("(,=:[!&|?{};+-*%<>~^", last))))
+    {
+      /* strings and regular expressions */
+      for(s++; s < end && *s != c; s++)
+        if(*s == '\\')
+          s++;
+      s++;
+      last = c;
+      continue;
     }
-
-    if(!valid)
+    if(c == '/' && s + 1 < end && s[1] == '/')
     {
-      s1 += ilen;
+      while(s < end && *s != '\n')
+        s++;
       continue;
     }
-
-    cur++;
-
-    /* nul terminate the path */
-    include_path[i] = 0;
-
-    /* check for closing ) */
-    for(;;)
+    if(c == '/' && s + 1 < end && s[1] == '*')
+    {
+      const char* close = s + 2 < end ? memmem(s + 2, end - s - 2, "*/", 2) : NULL;
+      s = close ? close + 2 : end;
+      continue;
+    }
+    if(template_is_ident((unsigned char)c) && last != '.')
     {
-      if(cur >= end)
+      const char* word = s;
+      const char* call = NULL;
+      const char* next;
+
+      while(s < end && template_is_ident((unsigned char)*s))
+        s++;
+      if(template_is_call(word, s, end, "getStr", "ccsp_cosa", "getStr", &call))
+        template_prefetch_call(call, end);
+      else if(translate && template_is_call(word, s, end, "_", "ccsp", "gettext", &call))
       {
-        log_syntax_error("include path at eof", s1, cur, end);
-        valid = 0;
-        break;
+        size_t mark;
+
+        if(!out.data)
+          buffer_init(&out);
+        mark = out.write_len;
+        buffer_push(&out, run, word - run);
+        next = template_translate_call(&out, call, end);
+        if(next)
+        {
+          s = run = next;
+          last = '\'';
+          continue;
+        }
+        out.write_len = mark;
       }
+      last = template_regex_keyword(word, s - word) ? '(' : 'a';
+      continue;
+    }
+    if(!isspace((unsigned char)c))
+      last = c;
+    s++;
+  }
+
+  if(run == block->start || !out.data)
+  {
+    buffer_free(&out);
+    return NULL;
+  }
+  buffer_push(&out, run, end - run);
+  block->start = out.data;
+  block->len = out.write_len;
+  return out.data;
+}
+
+/* start the static content table of a template with source buf: the key
+   is a hash of the source and of the catalog _() is resolved with, so the
+   same template always gets the same, and another table only if its
+   content can differ */
+static void template_table_begin(const char* buf, size_t len)
+{
+  snprintf(g_table_key, sizeof(g_table_key), "%016llx",
+           (unsigned long long)(jst_hash(buf, len) ^ jst_i18n_catalog_hash()));
+
+  if(!g_table_data.data)
+    buffer_init(&g_table_data);
+  if(!g_table_off.data)
+    buffer_init(&g_table_off);
+  if(!g_table_slices.data)
+    buffer_init(&g_table_slices);
+  g_table_data.write_len = 0;
+  g_table_off.write_len = 0;
+  g_table_slices.write_len = 0;
+  g_table_len = 0;
+  g_table_src = buf;
+  g_table_src_len = len;
+  g_table_count = 0;
+}
+
+/* add len bytes at s to the content of the table. Content of the template
+   itself isn't copied until template_table_end, which writes the table
+   into the code in one go: the source is kept until then. Anything else
+   (an inlined template's content) is copied to g_table_data now, as are
+   the literals template_fold_literal has written there already, s NULL. */
+static void template_table_slice(const char* s, size_t len)
+{
+  template_slice slice;
+  template_slice* last = NULL;
+
+  if(!len || !g_table_data.data || !g_table_slices.data)
+    return;
+  if(s && !(s >= g_table_src && s + len <= g_table_src + g_table_src_len))
+  {
+    buffer_push(&g_table_data, s, len);
+    if(!g_table_data.data)
+      return;
+    s = NULL;
+  }
+  slice.src = s;
+  slice.off = s ? 0 : g_table_data.write_len - len;
+  slice.len = len;
+  g_table_len += len;
+
+  /* runs next to each other are one */
+  if(g_table_slices.write_len >= sizeof(slice))
+    last = (template_slice*)(g_table_slices.data + g_table_slices.write_len - sizeof(slice));
+  if(last && !s && !last->src && last->off + last->len == slice.off)
+    last->len += len;
+  else if(last && s && last->src && last->src + last->len == s)
+    last->len += len;
+  else
+    buffer_push(&g_table_slices, (const char*)&slice, sizeof(slice));
+}
+
+/* append the table to the code of the template, see jst_output.c */
+static void template_table_end(growing_buffer* bufout)
+{
+  uint32_t v;
 
-      if(*cur == ')')
+  size_t table_len = JST_STATIC_KEY_LEN + 4 + g_table_off.write_len + 4 + g_table_len;
+  size_t i;
+
+  g_table_src = NULL;
+  g_table_src_len = 0;
+  if(!g_table_count || !g_table_data.data || !g_table_slices.data)
+    return;
+
+  buffer_reserve(bufout, table_len + 8);
+  buffer_push(bufout, g_table_key, JST_STATIC_KEY_LEN);
+  buffer_push(bufout, (const char*)&g_table_count, 4);
+  buffer_push(bufout, g_table_off.data, g_table_off.write_len);
+  v = (uint32_t)g_table_len;
+  buffer_push(bufout, (const char*)&v, 4);
+  for(i = 0; i + sizeof(template_slice) <= g_table_slices.write_len; i += sizeof(template_slice))
+  {
+    template_slice* slice = (template_slice*)(g_table_slices.data + i);
+    buffer_push(bufout, slice->src ? slice->src : g_table_data.data + slice->off, slice->len);
+  }
+  v = (uint32_t)table_len;
+  buffer_push(bufout, (const char*)&v, 4);
+  buffer_push(bufout, "JSTS", 4);
+}
+
+static void template_flush_parts(growing_buffer* bufout, template_part* parts, int* count)
+{
+  int i = 0;
+  int j;
+
+  while(i < *count)
+  {
+    if(parts[i].type == template_part_text || parts[i].type == template_part_literal)
+    {
+      /* adjacent content and literals are one entry of the table */
+      uint32_t start = (uint32_t)g_table_len;
+      int lines = 0;
+      char call[64];
+
+      for(; i < *count && (parts[i].type == template_part_text || parts[i].type == template_part_literal); ++i)
       {
-        break;
+        if(parts[i].type == template_part_literal)
+        {
+          size_t mark = g_table_data.write_len;
+          template_fold_literal(&g_table_data, parts[i].start, parts[i].len);
+          template_table_slice(NULL, g_table_data.write_len - mark);
+          continue;
+        }
+        template_table_slice(parts[i].start, parts[i].len);
+        lines += (int)jst_scan_count(parts[i].start, parts[i].start + parts[i].len, '\n');
       }
 
-      if(*cur != ' ')
+      if(g_table_len > start)
       {
-        log_syntax_error("invalid character in include", s1, cur, end);
-        valid = 0;
-        break;
+        buffer_push(&g_table_off, (const char*)&start, 4);
+        snprintf(call, sizeof(call), "_jst_static('%s',%u);", g_table_key, (unsigned)g_table_count++);
+        buffer_push(bufout, call, strlen(call));
       }
-      cur++;
+      while(lines--)
+        buffer_push(bufout, "\n", 1);
+      continue;
     }
 
-    if(!valid)
+    for(j = i; j < *count && (parts[j].type == template_part_name || parts[j].type == template_part_expr); ++j)
+      ;
+    buffer_push(bufout, j - i == 1 ? "echo(" : "_jst_echo(", j - i == 1 ? 5 : 10);
+    for(; i < j; ++i)
     {
-      s1 += ilen;
-      continue;
+      buffer_push(bufout, parts[i].start, parts[i].len);
+      if(i + 1 < j)
+        buffer_push(bufout, ", ", 2);
     }
+    buffer_push(bufout, ");", 2);
+  }
+  *count = 0;
+}
 
-    cur++;
+/* template_write_block for run pages, collecting output parts in parts */
+static void template_optimize_block(growing_buffer* bufout, template_block* block, template_part* parts, int* count)
+{
+  template_part* part = &parts[*count];
+
+  if(template_block_blank(block))
+    return;
 
+  part->start = block->start;
+  part->len = block->len;
+
+  if(block->type == template_block_content)
+    part->type = template_part_text;
+  else if(block->type == template_block_string && template_is_literal(&part->start, &part->len))
+    part->type = template_part_literal;
+  else if(block->type == template_block_string && template_is_name(&part->start, &part->len))
+    part->type = template_part_name;
+  else if(block->type == template_block_string && template_is_expr(block->start, block->len))
+  {
+    /* it may have side effects: it runs after everything collected so
+       far is written */
+    template_part expr = *part;
+
+    expr.type = template_part_expr;
+    template_flush_parts(bufout, parts, count);
+    parts[0] = expr;
+    *count = 1;
+    return;
+  }
+  else
+  {
+    template_flush_parts(bufout, parts, count);
+    template_write_block(bufout, block);
+    return;
+  }
 
-    /* check for the ending ; or ?>*/
-    for(;;)
+  if(++*count == TEMPLATE_MAX_PARTS)
+    template_flush_parts(bufout, parts, count);
+}
+
+/* keywords after which a '/' starts a regular expression */
+static int template_regex_keyword(const char* s, size_t len)
+{
+  static const char* words[] = { "return", "typeof", "instanceof", "in", "new", "delete",
+                                 "void", "throw", "case", "do", "else", NULL };
+  int i;
+
+  for(i = 0; words[i]; ++i)
+    if(strlen(words[i]) == len && memcmp(words[i], s, len) == 0)
+      return 1;
+  return 0;
+}
+
+/* a space between l and r can go if either is punctuation that can't
+   merge with the other into a different token */
+static int template_need_space(char l, char r)
+{
+  static const char* punct = "{}()[];,:=<>!&|?*%^~'\"+-/";
+
+  if((l == '+' || l == '-') && (r == '+' || r == '-'))
+    return 1;
+  if(l == '/' && (r == '/' || r == '*'))
+    return 1;
+  return !strchr(punct, l) && !strchr(punct, r);
+}
+
+/* Drop comments and redundant whitespace from generated code in place
+   and return the new length. Strings and regular expressions are copied
+   as they are, and line feeds are kept. */
+static size_t template_minify(char* buf, size_t len)
+{
+  size_t i = 0;
+  size_t o = 0;
+  int space = 0;
+  int line_start = 1;
+  char last = 0;      /* last token character written, 0 at the start */
+  int keyword = 0;    /* last token was a keyword from template_regex_keyword */
+
+  while(i < len)
+  {
+    char c = buf[i];
+
+    if(c == '\n' || c == '\r')
     {
-      if(cur >= end)
+      buf[o++] = c;
+      i++;
+      space = 0;
+      line_start = 1;
+      continue;
+    }
+    if(c == ' ' || c == '\t' || c == '\v' || c == '\f')
+    {
+      space = 1;
+      i++;
+      continue;
+    }
+    if(c == '/' && i + 1 < len && buf[i + 1] == '/')
+    {
+      while(i < len && buf[i] != '\n' && buf[i] != '\r')
+        i++;
+      continue;
+    }
+    if(c == '/' && i + 1 < len && buf[i + 1] == '*')
+    {
+      size_t j = i + 2;
+      int lines = 0;
+
+      while(j + 1 < len && !(buf[j] == '*' && buf[j + 1] == '/'))
+        j++;
+      if(j + 1 >= len)
       {
-        log_syntax_error("include path at eof", s1, cur, end);
-        valid = 0;
-        break;
+        /* unterminated: a syntax error anyway, keep it as it is */
+        memmove(buf + o, buf + i, len - i);
+        return o + len - i;
       }
-
-      if(*cur == ';')
+      for(; i < j; ++i)
+        if(buf[i] == '\n' || buf[i] == '\r')
+          buf[o++] = buf[i], lines = 1;
+      i = j + 2;
+      if(lines)
       {
-        break;
+        space = 0;
+        line_start = 1;
       }
+      else
+        space = 1;
+      continue;
+    }
+
+    if(space && !line_start && template_need_space(last, c))
+      buf[o++] = ' ';
+    space = 0;
+    line_start = 0;
 
-      if(strncmp(cur, "?>", 2) == 0)
+    if(c == '\'' || c == '"' || c == '`')
+    {
+      buf[o++] = buf[i++];
+      while(i < len && buf[i] != c)
       {
-        cur--;/*back out so that template tag stays*/
-        break;
+        if(buf[i] == '\\' && i + 1 < len)
+          buf[o++] = buf[i++];
+        else if(c != '`' && (buf[i] == '\n' || buf[i] == '\r'))
+          break;
+        buf[o++] = buf[i++];
       }
+      if(i < len && buf[i] == c)
+        buf[o++] = buf[i++];
+      last = c;
+      keyword = 0;
+    }
+    else if(c == '/' && (!last || keyword || strchr("(,=:[!&|?{};+-*%<>~^", last)))
+    {
+      int in_class = 0;
 
-      if(*cur != ' ')
+      buf[o++] = buf[i++];
+      while(i < len && buf[i] != '\n' && buf[i] != '\r' && (buf[i] != '/' || in_class))
       {
-        log_syntax_error("invalid character in include", s1, cur, end);
-        valid = 0;
-        break;
+        if(buf[i] == '\\' && i + 1 < len && buf[i + 1] != '\n' && buf[i + 1] != '\r')
+          buf[o++] = buf[i++];
+        else if(buf[i] == '[')
+          in_class = 1;
+        else if(buf[i] == ']')
+          in_class = 0;
+        buf[o++] = buf[i++];
       }
-      cur++;
+      if(i < len && buf[i] == '/')
+        buf[o++] = buf[i++];
+      /* flags are copied as a word */
+      last = ')';
+      keyword = 0;
     }
+    else if(template_is_ident((unsigned char)c) || (unsigned char)c >= 0x80)
+    {
+      size_t word = o;
 
-    if(!valid)
+      while(i < len && (template_is_ident((unsigned char)buf[i]) || (unsigned char)buf[i] >= 0x80))
+        buf[o++] = buf[i++];
+      keyword = template_regex_keyword(buf + word, o - word);
+      last = 'a';
+    }
+    else
     {
-      s1 += ilen;
-      continue;
+      buf[o++] = buf[i++];
+      last = c;
+      keyword = 0;
     }
+  }
+  return o;
+}
+
+/* replace a compile time include by a call to the unit loader (do_include_unit
+   in jst_functions.c), which runs the file compiled on its own */
+static int template_make_unit_call(const char* include_path, template_block* block)
+{
+  static const char open[] = "ccsp.include_unit('";
+  static const char close[] = "');";
+  size_t len = strlen(include_path);
+  char* call;
+  char* p;
+  size_t i;
 
+  call = (char*)malloc(sizeof(open) + len * 2 + sizeof(close));
+  if(!call)
+    return 0;
+
+  p = call;
+  memcpy(p, open, sizeof(open) - 1);
+  p += sizeof(open) - 1;
+  for(i = 0; i < len; ++i)
+  {
+    if(include_path[i] == '\\' || include_path[i] == '\'')
+      *p++ = '\\';
+    *p++ = include_path[i];
+  }
+  memcpy(p, close, sizeof(close) - 1);
+  p += sizeof(close) - 1;
+
+  block->type = template_block_code;
+  block->start = call;
+  block->len = p - call;
+
+  if(!g_units.data)
+    buffer_init(&g_units);
+  buffer_push(&g_units, include_path, len + 1);
+  return 1;
+}
+
+/* 1 if a code block only holds calls from template_make_unit_call */
+static int template_block_units(template_block* block)
+{
+  static const char call[] = "ccsp.include_unit('";
+  const char* s = block->start;
+  const char* end = block->start + block->len;
+
+  for(;;)
+  {
+    while(s < end && isspace((unsigned char)*s))
+      s++;
+    if(s == end)
+      return 1;
+    if((size_t)(end - s) < sizeof(call) - 1 || memcmp(s, call, sizeof(call) - 1) != 0)
+      return 0;
+    s += sizeof(call) - 1;
+    while(s < end && *s != '\'')
+      s += *s == '\\' ? 2 : 1;
+    if(end - s < 3 || memcmp(s, "');", 3) != 0)
+      return 0;
+    s += 3;
+  }
+}
+
+/*
+  The template parser: one forward pass over the template that writes the
+  generated code of each block as soon as it has been read.
+
+  Content runs up to the next <?%. A code block, <?% code ?> or
+  <?%= value ?>, ends at the next ?> wherever that is, even in a string
+  or a comment. Inside the block the scan keeps track of strings,
+  comments and regular expressions, so only a live compile time include
+  is expanded; a block comment may go on in the next block:
+
+    include("path");   or   include('path') ?>
+
+  after whitespace or ';'. The file is inlined into the block, a .jst file
+  parsed into code first; in a run page it becomes a call to the unit
+  loader instead (template_make_unit_call). Any other include() is left
+  to run time.
+*/
+typedef enum template_lex_state
+{
+  template_lex_code,
+  template_lex_string,
+  template_lex_line_comment,
+  template_lex_block_comment,
+  template_lex_regex
+}template_lex_state;
+
+typedef struct template_parser
+{
+  growing_buffer* out;                    /* the generated code */
+  template_part parts[TEMPLATE_MAX_PARTS];
+  int count;
+  growing_buffer owned;                   /* blocks the parts may point into */
+  growing_buffer code;                    /* a code block with includes inlined */
+  int in_comment;                         /* the last code block ended in a comment */
+}template_parser;
+
+/* free data with the parser, when no part points into it anymore */
+static void template_parser_keep(template_parser* p, char* data)
+{
+  if(!p->owned.data)
+    buffer_init(&p->owned);
+  buffer_push(&p->owned, (const char*)&data, sizeof(data));
+}
+
+static void template_parser_free(template_parser* p)
+{
+  size_t i;
+
+  for(i = 0; i + sizeof(char*) <= p->owned.write_len; i += sizeof(char*))
+  {
+    char* data;
+    memcpy(&data, p->owned.data + i, sizeof(data));
+    free(data);
+  }
+  buffer_free(&p->owned);
+  buffer_free(&p->code);
+}
+
+static void template_parser_code(template_parser* p, const char* s, size_t len)
+{
+  if(!p->code.data)
+    buffer_init(&p->code);
+  buffer_push(&p->code, s, len);
+}
+
+static void template_emit_block(template_parser* p, template_block* block)
+{
+  if(block->type != template_block_content && !template_block_blank(block) &&
+     !template_block_units(block))
+    g_code_blocks++;
+
+  /* a static parse only keeps the content, as _jst_finish would write it */
+  if(g_static)
+  {
+    if(block->type == template_block_content && !template_block_blank(block))
+      buffer_push(p->out, block->start, block->len);
+  }
+  else if(g_optimize)
+  {
+    if(block->type != template_block_content)
+    {
+      char* copy = template_scan_code(block, jst_i18n_catalog() != NULL);
+      if(copy)
+        template_parser_keep(p, copy);
+    }
+    template_optimize_block(p->out, block, p->parts, &p->count);
+  }
+  else
+    template_write_block(p->out, block);
+}
+
+/* the path of the compile time include at s1, which starts with the word
+   include; returns the end of the statement (after the ';' or at the ?>),
+   or NULL if it isn't one */
+static char* template_include_path(char* s1, char* end, char* include_path)
+{
+  char* cur = s1 + 7;
+  char quote;
+  int i = 0;
+
+  /* only spaces before (, else it is a function like includeFoo() */
+  while(cur < end && *cur == ' ')
     cur++;
+  if(cur >= end || *cur != '(')
+    return NULL;
+  cur++;
 
-    /* the include was parsed successfully
-       now load the file path recursively */
-    if(load_template_file(include_path, &block->start, &block->len, 0))
+  /* if anything other than a space is before the quote it could be a
+     variable, which the include function (jst_functions.c) gets at run time */
+  while(cur < end && *cur == ' ')
+    cur++;
+  if(cur >= end)
+    return NULL;
+  if(*cur != '\'' && *cur != '"')
+  {
+    log_debug_message("runtime include statement found\n");
+    return NULL;
+  }
+  quote = *cur++;
+
+  /* from here on anything unexpected is a syntax error */
+  for(;;)
+  {
+    if(cur >= end)
     {
-//TODO - does the data alloced for block->start ever get freed ????
-      //printf("=============================\ninclude file contents:\n%s\n=============================\n", block->start);
-      block->type = template_block_code;
-      block->need_free = 1;
-      *bufcur = cur;
-      *buflen -= cur - buff;
-      return block->len;
+      log_syntax_error("include path at eof", s1, cur, end);
+      return NULL;
     }
-    else
+    if(*cur == quote)
+      break;
+    if(i == TMPL_MAX_INC_SZ)
     {
-      /*if include had previously been included once*/
-      block->type = template_block_code;
-      *bufcur = cur;
-      *buflen -= cur - buff;
-      return 1;
+      log_syntax_error("include path too long", s1, cur, end);
+      return NULL;
     }
+    if(*cur == '\'' || *cur == '"')
+    {
+      log_syntax_error("include quotes missmatch", s1, cur, end);
+      return NULL;
+    }
+    include_path[i++] = *cur++;
   }
+  include_path[i] = 0;
+  cur++;
 
-  return 0;
+  /* the closing ) */
+  for(;;)
+  {
+    if(cur >= end)
+    {
+      log_syntax_error("include path at eof", s1, cur, end);
+      return NULL;
+    }
+    if(*cur == ')')
+      break;
+    if(*cur != ' ')
+    {
+      log_syntax_error("invalid character in include", s1, cur, end);
+      return NULL;
+    }
+    cur++;
+  }
+  cur++;
+
+  /* the ending ; or ?>, which stays to end the block */
+  for(;;)
+  {
+    if(cur >= end)
+    {
+      log_syntax_error("include path at eof", s1, cur, end);
+      return NULL;
+    }
+    if(*cur == ';')
+      return cur + 1;
+    if(end - cur >= JST_CLOSE_LEN && memcmp(cur, JST_CLOSE_TAG, JST_CLOSE_LEN) == 0)
+      return cur;
+    if(*cur != ' ')
+    {
+      log_syntax_error("invalid character in include", s1, cur, end);
+      return NULL;
+    }
+    cur++;
+  }
 }
 
-static int template_make_block(char** bufcur, size_t* buflen, template_block* block)
+/* inline the file at include_path into the code block */
+static void template_expand_include(template_parser* p, const char* include_path, template_block_type type)
 {
-  char* buff;
-  char* s1;
-  char* s2;
-  template_block_type type;
+  template_block block;
+  size_t len = strlen(include_path);
+
+  if(g_include_units && template_make_unit_call(include_path, &block))
+  {
+    template_parser_code(p, block.start, block.len);
+    free(block.start);
+    return;
+  }
+
+  /* nothing if it was included before */
+  if(!load_template_file(include_path, &block.start, &block.len, 0))
+    return;
+
+  /* in a static parse the output of an included template is content of
+     the including page, between the code before and after the include */
+  if(g_static && len > 4 && strcmp(include_path + len - 4, ".jst") == 0)
+  {
+    template_block code;
 
-  buff = *bufcur;
+    code.type = type;
+    code.start = p->code.data;
+    code.len = p->code.write_len;
+    template_emit_block(p, &code);
+    p->code.write_len = 0;
 
-  s1 = strstr(buff, JST_OPEN_TAG);
+    block.type = template_block_content;
+    template_emit_block(p, &block);
+  }
+  else if(!template_block_blank(&block))
+    template_parser_code(p, block.start, block.len);
+  free(block.start);
+}
 
-  if(s1)
+/* parse the code block starting at s, after the <?% or <?%=; returns the
+   end of its ?>, or NULL if there is none */
+static char* template_parse_code(template_parser* p, char* s, char* end, template_block_type type)
+{
+  char* start = s;
+  char* run = s;        /* code not yet in p->code, once an include is inlined */
+  int inlined = 0;
+  template_lex_state state = p->in_comment ? template_lex_block_comment : template_lex_code;
+  char quote = 0;
+  int in_class = 0;
+  char last = 0;        /* last token character, 0 at the start */
+  int keyword = 0;      /* last token was a keyword from template_regex_keyword */
+  template_block block;
+  char include_path[TMPL_MAX_INC_SZ + 1];
+
+  for(; s < end; ++s)
   {
-    if(s1 != buff)
+    char c = *s;
+
+    if(c == '?' && s + 1 < end && s[1] == '>')
+      break;
+
+    if(state == template_lex_line_comment)
     {
-      block->type = template_block_content;
-      block->start = buff;
-      block->len = s1 - buff;
-      *bufcur = s1;
-      *buflen -= block->len;
-      return block->len;
+      if(c == '\n')
+        state = template_lex_code;
     }
-    else
+    else if(state == template_lex_block_comment)
     {
-      if(s1[JST_OPEN_LEN] == '=')
+      if(c == '*' && s + 1 < end && s[1] == '/')
       {
-        s1 += JST_OPEN_LEN+1;
-        type = template_block_string;
+        state = template_lex_code;
+        s++;
       }
-      else
+    }
+    else if(state == template_lex_string)
+    {
+      if(c == '\\' && s + 1 < end && s[1] != '?')
+        s++;
+      else if(c == quote || (quote != '`' && (c == '\n' || c == '\r')))
+        state = template_lex_code;
+    }
+    else if(state == template_lex_regex)
+    {
+      if(c == '\\' && s + 1 < end && s[1] != '\n' && s[1] != '?')
+        s++;
+      else if(c == '[')
+        in_class = 1;
+      else if(c == ']')
+        in_class = 0;
+      else if(c == '\n' || (c == '/' && !in_class))
+        state = template_lex_code;
+    }
+    else if(c == '/' && s + 1 < end && s[1] == '/')
+    {
+      state = template_lex_line_comment;
+      s++;
+    }
+    else if(c == '/' && s + 1 < end && s[1] == '*')
+    {
+      state = template_lex_block_comment;
+      s++;
+    }
+    else if(c == '\'' || c == '"' || c == '`')
+    {
+      state = template_lex_string;
+      quote = c;
+      last = c;
+      keyword = 0;
+    }
+    else if(c == '/' && (!last || keyword || strchr("(,=:[!&|?{};+-*%<>~^", last)))
+    {
+      state = template_lex_regex;
+      in_class = 0;
+      last = ')';
+      keyword = 0;
+    }
+    else if(template_is_ident((unsigned char)c) || (unsigned char)c >= 0x80)
+    {
+      char* word = s;
+      char* next;
+
+      while(s + 1 < end && (template_is_ident((unsigned char)s[1]) || (unsigned char)s[1] >= 0x80))
+        s++;
+      keyword = template_regex_keyword(word, s + 1 - word);
+      last = 'a';
+
+#ifndef NO_PROCESS_INCLUDES
+      /* only whitespace or ; before it, else it could be a.include or such */
+      if(s + 1 - word == 7 && memcmp(word, "include", 7) == 0 &&
+         (word[-1] == ' ' || word[-1] == '\t' || word[-1] == ';' || word[-1] == '\n') &&
+         (next = template_include_path(word, end, include_path)) != NULL)
       {
-        s1 += JST_OPEN_LEN;
-        type = template_block_code;
+        /* whitespace alone between two includes has always been dropped */
+        block.start = run;
+        block.len = word - run;
+        if(!inlined || !template_block_blank(&block))
+          template_parser_code(p, run, word - run);
+        template_expand_include(p, include_path, type);
+        inlined = 1;
+        run = next;
+        s = next - 1;
+        last = ';';
+        keyword = 0;
       }
+#endif
+    }
+    else if(!isspace((unsigned char)c))
+    {
+      last = c;
+      keyword = 0;
+    }
+  }
 
-      s2 = strstr(s1, JST_CLOSE_TAG);
+  if(s >= end)
+  {
+    /* no ?>: the block is dropped */
+    if(inlined)
+      p->code.write_len = 0;
+    return NULL;
+  }
 
-      if(s2)
-      {
-        block->type = type;
-        block->start = s1;
-        block->len = s2-s1;
-        *bufcur = s2+JST_CLOSE_LEN;
-        *buflen -= *bufcur - buff;
-        return block->len;
-      }
-      else
-      {
-        //error no closing ?> found
-        return 0;
-      }
-    }
+  /* the blocks are one program: a comment goes on in the next block */
+  p->in_comment = state == template_lex_block_comment;
+  block.type = type;
+  if(!inlined)
+  {
+    block.start = start;
+    block.len = s - start;
   }
   else
   {
-    block->type = template_block_content;
-    block->start = buff;
-    block->len = *buflen;
-    *bufcur += *buflen;
-    *buflen = 0;
-    return block->len;
+    /* a copy: the parts may point into it until they are written */
+    template_parser_code(p, run, s - run);
+    block.len = p->code.write_len;
+    block.start = (char*)malloc(block.len + 1);
+    p->code.write_len = 0;
+    if(!block.start)
+      return s + JST_CLOSE_LEN;
+    memcpy(block.start, p->code.data, block.len);
+    block.start[block.len] = 0;
+    template_parser_keep(p, block.start);
   }
-  return 0;
+  template_emit_block(p, &block);
+  return s + JST_CLOSE_LEN;
 }
 
-static void process_jst(char* buf, size_t buflen, growing_buffer* tbuf)
+/* the first tag (JST_OPEN_TAG or JST_CLOSE_TAG) from s, NULL if there is none */
+static char* template_find_tag(char* s, char* end, const char* tag, size_t len)
 {
-  char* bufcur;
-  size_t bufcurlen;
+  while((s = (char*)jst_scan_pair(s, end, tag[0], tag[1])) != end)
+  {
+    if((size_t)(end - s) >= len && memcmp(s, tag, len) == 0)
+      return s;
+    s++;
+  }
+  return NULL;
+}
+
+static void template_parse(const char* buf, size_t buflen, growing_buffer* out)
+{
+  template_parser p;
   template_block block;
+  /* the blocks point into the template, which is only ever read */
+  char* cur = (char*)buf;
+  char* end = cur + buflen;
 
-  bufcur = buf;
-  bufcurlen = buflen;
+  memset(&p, 0, sizeof(p));
+  p.out = out;
 
-  for(;;)
+  while(cur < end)
   {
-    if(template_make_block(&bufcur, &bufcurlen, &block))
+    char* open = template_find_tag(cur, end, JST_OPEN_TAG, JST_OPEN_LEN);
+    template_block_type type = template_block_code;
+
+    block.type = template_block_content;
+    block.start = cur;
+    block.len = (open ? open : end) - cur;
+    if(block.len)
+      template_emit_block(&p, &block);
+    if(!open)
+      break;
+
+    cur = open + JST_OPEN_LEN;
+    if(cur < end && *cur == '=')
     {
-      template_write_block(tbuf, &block);
+      type = template_block_string;
+      cur++;
     }
-    else
-    {
+    cur = template_parse_code(&p, cur, end, type);
+    if(!cur)
       break;
-    }
+  }
+  template_flush_parts(out, p.parts, &p.count);
+  template_parser_free(&p);
+
+  if(g_optimize && out->data)
+  {
+    out->write_len = template_minify(out->data, out->write_len);
+    out->data[out->write_len] = 0;
   }
 }
 
-static void process_includes(char* buf, size_t buflen, growing_buffer* tbuf)
+/*
+  Data model prefetch: the parameters a run page reads with
+  getStr("literal"), in its own code and in the code of the files it
+  includes, are fetched in as few bus calls as possible before the page
+  runs: the code starts with _jst_prefetch(['Device.X.Y', ...]);, on the
+  first line so the line numbers stay those of the template (see
+  _jst_prefetch in jst_prefix.js, prefetch in jst_cosa.c). Only the files
+  the template includes itself are scanned; the includes of those are
+  prefetched when their unit runs.
+*/
+static void template_prefetch_file(const char* unit)
 {
-  char* bufcur;
-  size_t bufcurlen;
+  char path[MAX_PATH_LEN * 2];
+  jst_file file;
   template_block block;
+  size_t unit_len = strlen(unit);
 
-  bufcur = buf;
-  bufcurlen = buflen;
+  snprintf(path, sizeof(path), "%s%s", g_document_root_path, unit);
+  if(access(path, R_OK) != 0 || !map_file(path, &file))
+    return;
 
-  for(;;)
+  if(unit_len > 4 && strcmp(unit + unit_len - 4, ".jst") == 0)
   {
-    if(template_make_include(&bufcur, &bufcurlen, &block, buf))
-    {
-      template_write_block(tbuf, &block);
-      if(block.need_free)
-        free(block.start);
-    }
-    else
+    char* cur = (char*)file.data;
+    char* end = cur + file.len;
+    char* open;
+    char* close;
+
+    while((open = template_find_tag(cur, end, JST_OPEN_TAG, JST_OPEN_LEN)) &&
+          (close = template_find_tag(open + JST_OPEN_LEN, end, JST_CLOSE_TAG, JST_CLOSE_LEN)))
     {
-      break;
+      block.start = open + JST_OPEN_LEN;
+      block.len = close - block.start;
+      template_scan_code(&block, 0);
+      cur = close + JST_CLOSE_LEN;
     }
   }
+  else
+  {
+    block.start = (char*)file.data;
+    block.len = file.len;
+    template_scan_code(&block, 0);
+  }
+  unmap_file(&file);
 }
 
-static int template_process(char** buf, size_t* buflen, int top)
+static void template_prefetch(growing_buffer* code, size_t units_start)
 {
-  /*make 2 passes 
-    1) process include statements into intermediary jst
-    2) process intermediary jst into final js code
-  */
-  char* prefix;
-  size_t prefix_len;
-  char* suffix;
-  size_t suffix_len;
+  growing_buffer out;
+  size_t len;
+  size_t i;
+
+  for(i = units_start; i < g_units.write_len; i += strlen(g_units.data + i) + 1)
+    template_prefetch_file(g_units.data + i);
+  if(!g_prefetch.write_len)
+    return;
+
+  buffer_init(&out);
+  buffer_push(&out, "_jst_prefetch([", 15);
+  for(i = 0; i < g_prefetch.write_len; i += strlen(g_prefetch.data + i) + 1)
+  {
+    if(i)
+      buffer_push(&out, ",", 1);
+    buffer_push(&out, "'", 1);
+    template_write_text(&out, g_prefetch.data + i, strlen(g_prefetch.data + i), 0);
+    buffer_push(&out, "'", 1);
+  }
+  buffer_push(&out, "]);", 3);
+  if(!out.data)
+    return;
+
+  /* in front of the code, moved up in its buffer */
+  len = code->write_len;
+  buffer_push(code, out.data, out.write_len);
+  if(code->data)
+  {
+    memmove(code->data + out.write_len, code->data, len);
+    memcpy(code->data, out.data, out.write_len);
+  }
+  buffer_free(&out);
+}
+
+static int template_process(const char* src, size_t srclen, char** bufout, size_t* lenout, int top)
+{
+  /* one pass, see template_parse */
+  jst_file prefix;
+  jst_file suffix;
   char filepath[MAX_PATH_LEN];
-  growing_buffer tbuf1;
   growing_buffer tbuf2;
   char TEMPL_PATH[MAX_PATH_LEN] = "/usr/video_analytics/";
-  buffer_init(&tbuf1);
-  buffer_init(&tbuf2);
+  size_t units_start = g_units.write_len;
 
-#ifdef NO_PROCESS_INCLUDES
-  buffer_push(&tbuf1, *buf, *buflen);
-#else
-  process_includes(*buf, *buflen, &tbuf1);
-#endif
+  *bufout = 0;
+  *lenout = 0;
+  buffer_init(&tbuf2);
+  /* the code is about as long as the template, or shorter in a run page
+     where the content goes to the table */
+  buffer_reserve(&tbuf2, srclen + srclen / 8);
 
-#if 0
-  printf("----------- after processing includes -----------\n");
-  printf("%s\n", tbuf1.data);
-  printf("-------------------------------------------------\n");
-#endif
+  if(top == LOAD_TEMPLATE_BODY || top == LOAD_TEMPLATE_UNIT)
+  {
+    template_table_begin(src, srclen);
+    g_prefetch.write_len = 0;
+  }
 
-  if(top)
+  if(top == LOAD_TEMPLATE_PAGE)
   {
     snprintf(filepath, MAX_PATH_LEN, "%sjst_prefix.js", TEMPL_PATH);
-    if(!read_file(filepath, &prefix, &prefix_len))
+    if(!map_file(filepath, &prefix))
     {
       log_debug_message("failed to open %s\n", filepath);
-      buffer_free(&tbuf1);
-      free(*buf);
-      *buf = 0;
-      *buflen = 0;
+      fprintf(stderr, "Error: cannot open file:%s error:%s\n", filepath, strerror(errno));
+      buffer_free(&tbuf2);
       return 0;
     }
 
     snprintf(filepath, MAX_PATH_LEN, "%sjst_suffix.js", TEMPL_PATH);
-    if(!read_file(filepath, &suffix, &suffix_len))
+    if(!map_file(filepath, &suffix))
     {
       log_debug_message("failed to open %s\n", filepath);
-      buffer_free(&tbuf1);
-      free(prefix);
-      free(*buf);
-      *buf = 0;
-      *buflen = 0;
+      fprintf(stderr, "Error: cannot open file:%s error:%s\n", filepath, strerror(errno));
+      buffer_free(&tbuf2);
+      unmap_file(&prefix);
       return 0;
     }
     
-    buffer_push(&tbuf2, prefix, prefix_len);
+    buffer_push(&tbuf2, prefix.data, prefix.len);
+  }
+  template_parse(src, srclen, &tbuf2);
+  if(top == LOAD_TEMPLATE_BODY || top == LOAD_TEMPLATE_UNIT)
+  {
+    template_prefetch(&tbuf2, units_start);
+    template_table_end(&tbuf2);
   }
-  process_jst(tbuf1.data, tbuf1.write_len, &tbuf2);
 
-  if(top)
+  if(top == LOAD_TEMPLATE_PAGE)
   {
-    buffer_push(&tbuf2, suffix, suffix_len);
-    //buffer_push(&tbuf2, "\0", 1); /*not needed as growing_buffer memsets its buffer to 0*/
+    buffer_push(&tbuf2, suffix.data, suffix.len);
+    //buffer_push(&tbuf2, "\0", 1); /*not needed as buffer_push null terminates*/
 
-    free(prefix);
-    free(suffix);
+    unmap_file(&prefix);
+    unmap_file(&suffix);
   }
 
-  free(*buf);
-  *buf = tbuf2.data;
-  *buflen = tbuf2.write_len;
-
-  buffer_free(&tbuf1);
+  *bufout = tbuf2.data;
+  *lenout = tbuf2.write_len;
 
   /*we pass tbuf2 data back so don't call buffer_free on it*/
-  return *buflen;
+  return *lenout;
 }
 
-int load_template_file(const char *filename, char** bufout, size_t* lenout, int top)
+/* slot of path in the index of r, or the free one it would go to */
+static int template_registry_slot(const template_registry* r, const char* path)
 {
-  char* buf;
-  size_t buflen;
-  size_t rc;
+  int mask = r->index_size - 1;
+  int slot = (int)(jst_hash(path, strlen(path)) & (uint64_t)mask);
+
+  while(r->index[slot] && strcmp(r->paths[r->index[slot] - 1], path) != 0)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+static int template_registry_find(const template_registry* r, const char* path)
+{
+  return r->index_size && r->index[template_registry_slot(r, path)];
+}
+
+/* add path unless it is there already; 0 if out of memory */
+static int template_registry_add(template_registry* r, const char* path)
+{
+  char* copy;
+  int slot;
   int i;
-  char filepath[MAX_PATH_LEN];
-  const char* pscriptname = filename;
-  log_debug_message("load_template_file filename=%s top=%d\n", filename, top);
 
-  *bufout = NULL;
-  *lenout = 0;
+  if((r->count + 1) * 2 > r->index_size)
+  {
+    int size = r->index_size ? r->index_size * 2 : 32;
+    int* index = (int*)calloc(size, sizeof(int));
 
-  if(top)
+    if(!index)
+      return 0;
+    free(r->index);
+    r->index = index;
+    r->index_size = size;
+    for(i = 0; i < r->count; ++i)
+      r->index[template_registry_slot(r, r->paths[i])] = i + 1;
+  }
+
+  slot = template_registry_slot(r, path);
+  if(r->index[slot])
+    return 1;
+
+  if(r->count == r->alloc)
   {
-    char* pgi;
+    int alloc = r->alloc ? r->alloc * 2 : 16;
+    char** paths = (char**)realloc(r->paths, alloc * sizeof(char*));
 
-    /*cleanup any previous passes through here*/
-    g_document_root_path[0] = 0;
-    for(i = 0; i < g_include_paths_count; ++i)
-      g_include_paths[i][0] = 0;
-    g_include_paths_count = 0;
-    
-    /*are we running as cgi or stand-alone*/
-    pgi = getenv("GATEWAY_INTERFACE");
-    if(pgi && strncmp(pgi, "CGI/", 4) == 0)
-      g_is_cgi = 1;
-    else
-      g_is_cgi = 0;
+    if(!paths)
+      return 0;
+    r->paths = paths;
+    r->alloc = alloc;
+  }
+
+  copy = strdup(path);
+  if(!copy)
+    return 0;
+  r->paths[r->count++] = copy;
+  r->index[slot] = r->count;
+  return 1;
+}
+
+static void template_registry_clear(template_registry* r)
+{
+  int i;
+
+  for(i = 0; i < r->count; ++i)
+    free(r->paths[i]);
+  r->count = 0;
+  if(r->index)
+    memset(r->index, 0, r->index_size * sizeof(int));
+}
+
+static void template_registry_free(template_registry* r)
+{
+  template_registry_clear(r);
+  free(r->paths);
+  free(r->index);
+  memset(r, 0, sizeof(template_registry));
+}
+
+void load_template_reset(void)
+{
+  g_document_root_path[0] = 0;
+  template_registry_clear(&g_registry);
+  g_units.write_len = 0;
+}
 
-    /*determine document root
-    this is where the jst_prefix.js/jst_suffix.js files should live 
-    and any include path is treated as relative to this */
+/* determine the document root for a top level template and point
+   *pscriptname at the script path relative to it */
+static int template_set_root(const char** pscriptname)
+{
+  const char* pgi;
+
+  /*cleanup any previous passes through here*/
+  load_template_reset();
+  
+  /*are we running as cgi or stand-alone*/
+  pgi = jst_getenv("GATEWAY_INTERFACE");
+  if(pgi && strncmp(pgi, "CGI/", 4) == 0)
+    g_is_cgi = 1;
+  else
+    g_is_cgi = 0;
 
-    if(g_is_cgi)
+  /*determine document root
+  this is where the jst_prefix.js/jst_suffix.js files should live 
+  and any include path is treated as relative to this */
+
+  if(g_is_cgi)
+  {
+    /*for cgi we can use cgi env vars to figure it out*/
+    const char* pscriptfile = jst_getenv("SCRIPT_FILENAME");  /* eg: /tmp/www/actionHandler/ajaxSet_index_userbar.jst */
+    *pscriptname = jst_getenv("SCRIPT_NAME");            /* eg: /actionHandler/ajaxSet_index_userbar.jst */
+    if(*pscriptname && pscriptfile)
     {
-      /*for cgi we can use cgi env vars to figure it out*/
-      char* pscriptfile = getenv("SCRIPT_FILENAME");  /* eg: /tmp/www/actionHandler/ajaxSet_index_userbar.jst */
-      pscriptname = getenv("SCRIPT_NAME");            /* eg: /actionHandler/ajaxSet_index_userbar.jst */
-      if(pscriptname && pscriptfile)
-      {
-        char* p1;
+      char* p1;
 
-        if(pscriptname[0] == '/')
-          pscriptname++;
+      if((*pscriptname)[0] == '/')
+        (*pscriptname)++;
 
-        if(strlen(pscriptfile) > MAX_PATH_LEN)
-        {
-          log_debug_message("SCRIPT_FILENAME exceeds our max supported path len\n");
-          return 0;
-        }
+      if(strlen(pscriptfile) > MAX_PATH_LEN)
+      {
+        log_debug_message("SCRIPT_FILENAME exceeds our max supported path len\n");
+        return 0;
+      }
 
-        p1 = strstr(pscriptfile, pscriptname);
-        if(p1)
+      p1 = strstr(pscriptfile, *pscriptname);
+      if(p1)
+      {
+        size_t rootlen = p1 - pscriptfile;
+        if(rootlen < MAX_PATH_LEN)
         {
-          size_t rootlen = p1 - pscriptfile;
-          if(rootlen < MAX_PATH_LEN)
-          {
-            strncpy(g_document_root_path, pscriptfile, rootlen);
-          }
-        }
-        else
-        {
-          log_debug_message("SCRIPT_NAME not found in SCRIPT_FILENAME\n");
-          return 0;
+          strncpy(g_document_root_path, pscriptfile, rootlen);
         }
       }
       else
       {
-        log_debug_message("SCRIPT_NAME/FILENAME env var missing\n");
+        log_debug_message("SCRIPT_NAME not found in SCRIPT_FILENAME\n");
         return 0;
       }
-
-      log_debug_message("cgi root directory is %s\n", g_document_root_path);
     }
     else
     {
-      /*for stand alone use the current work directory*/
-      if(!getcwd(g_document_root_path, MAX_PATH_LEN-1))
-      {
-        log_debug_message("failed to get current working directory\n");
-        return 0;
-      }
-      strcat(g_document_root_path, "/");
+      log_debug_message("SCRIPT_NAME/FILENAME env var missing\n");
+      return 0;
+    }
 
-      log_debug_message("non-cgi root directory is %s\n", g_document_root_path);
+    log_debug_message("cgi root directory is %s\n", g_document_root_path);
+  }
+  else
+  {
+    /*for stand alone use the current work directory*/
+    if(!getcwd(g_document_root_path, MAX_PATH_LEN-1))
+    {
+      log_debug_message("failed to get current working directory\n");
+      return 0;
     }
+    strcat(g_document_root_path, "/");
+
+    log_debug_message("non-cgi root directory is %s\n", g_document_root_path);
+  }
+  return 1;
+}
+
+int load_template_resolve(const char *filename, char* path, size_t pathlen)
+{
+  const char* pscriptname = filename;
+  int i;
+
+  if(!template_set_root(&pscriptname))
+    return 0;
+
+  i = snprintf(path, pathlen, "%s%s", g_document_root_path, pscriptname);
+  if(i < 0 || (size_t)i >= pathlen)
+  {
+    log_debug_message("file path too long %s\n", filename);
+    return 0;
+  }
+  return 1;
+}
+
+const char* load_template_root(void)
+{
+  return g_document_root_path;
+}
+
+const char* load_template_page(void)
+{
+  return g_registry.count ? g_registry.paths[0] : "";
+}
+
+int load_template_included(const char* path)
+{
+  return template_registry_find(&g_registry, path);
+}
+
+const char* load_template_units(size_t* len)
+{
+  *len = g_units.write_len;
+  return g_units.data ? g_units.data : "";
+}
+
+const char* load_template_registry(int i)
+{
+  return i >= 0 && i < g_registry.count ? g_registry.paths[i] : NULL;
+}
+
+int load_template_is_static(void)
+{
+  return g_code_blocks == 0;
+}
+
+int load_template_static(const char *filename, char** bufout, size_t* lenout)
+{
+  template_registry registry = g_registry;
+  growing_buffer units = g_units;
+  int include_units = g_include_units;
+  int optimize = g_optimize;
+  int code_blocks = g_code_blocks;
+  int rc;
+
+  /* the static parse starts a registry of its own */
+  memset(&g_registry, 0, sizeof(g_registry));
+  memset(&g_units, 0, sizeof(g_units));
+
+  rc = load_template_file(filename, bufout, lenout, LOAD_TEMPLATE_STATIC) && !g_code_blocks;
+  g_include_units = include_units;
+  g_optimize = optimize;
+  g_static = 0;
+  if(rc)
+  {
+    template_registry_free(&registry);
+    buffer_free(&units);
+    return 1;
+  }
+
+  free(*bufout);
+  *bufout = NULL;
+  *lenout = 0;
+
+  /* back to the state of the parse before, the page runs after all */
+  template_registry_free(&g_registry);
+  buffer_free(&g_units);
+  g_registry = registry;
+  g_units = units;
+  g_code_blocks = code_blocks;
+  return 0;
+}
+
+int load_template_mark_included(const char* path)
+{
+  return template_registry_add(&g_registry, path);
+}
+
+int load_template_file(const char *filename, char** bufout, size_t* lenout, int top)
+{
+  jst_file src;
+  char* buf;
+  size_t buflen;
+  size_t rc;
+  int i;
+  char filepath[MAX_PATH_LEN];
+  const char* pscriptname = filename;
+  log_debug_message("load_template_file filename=%s top=%d\n", filename, top);
+
+  *bufout = NULL;
+  *lenout = 0;
+
+  if(top && top != LOAD_TEMPLATE_UNIT)
+  {
+    if(!template_set_root(&pscriptname))
+      return 0;
+  }
+
+  /* only the parse for --parse-only inlines includes and keeps the
+     generated code as it is; a static parse inlines them too, but keeps
+     just the content */
+  if(top)
+  {
+    g_include_units = g_optimize = top == LOAD_TEMPLATE_BODY || top == LOAD_TEMPLATE_UNIT;
+    g_static = top == LOAD_TEMPLATE_STATIC;
+    g_code_blocks = 0;
   }
 
   log_debug_message("root=%s  path=%s\n", g_document_root_path, pscriptname);
@@ -898,33 +1967,57 @@ int load_template_file(const char *filename, char** bufout, size_t* lenout, int
   if(!top)
   {
     log_debug_message("checking if %s has already been included\n", filepath);
-    for(i = 0; i < g_include_paths_count; ++i)
+    if(load_template_included(filepath))
     {
-      if(strcmp(g_include_paths[i], filepath) == 0)
-      {
-        log_debug_message("skipping %s, already included once\n", filename);
-        return 0;
-      }
+      log_debug_message("skipping %s, already included once\n", filename);
+      return 0;
     }
   }
 
-  if(g_include_paths_count == MAX_INCLUDE_FILE-2)
+  /* units are registered by their loader when they run, a cached page
+     by load_template_bytecode */
+  if(top != LOAD_TEMPLATE_UNIT && !load_template_mark_included(filepath))
   {
-    log_debug_message("max number includes %d has been reached\n", MAX_INCLUDE_FILE);
+    log_debug_message("failed to register %s\n", filepath);
     return 0;
   }
 
-  strcpy(g_include_paths[g_include_paths_count++], filepath);
-
   log_debug_message("load_template_file:%s filepath=%s root:%s top:%d\n", filename, filepath, g_document_root_path, top);
-  if(!read_file(filepath, &buf, &buflen))
+  if(!map_file(filepath, &src))
   {
+    if(errno)
+      fprintf(stderr, "Error: cannot open file:%s error:%s\n", filepath, strerror(errno));
     return 0;
   }
+
   rc = strlen(filename);
   if(rc > 4 && !strcmp(filename + rc - 4, ".jst"))
-    if(!template_process(&buf, &buflen, top))
+  {
+    /* the template is parsed where it is mapped, only the code is copied */
+    rc = template_process(src.data, src.len, &buf, &buflen, top);
+    unmap_file(&src);
+    if(!rc)
       return 0;
+  }
+  else if(!src.mapped)
+  {
+    /* a .js file is inlined as it is: the copy map_file read is ours */
+    buf = (char*)src.data;
+    buflen = src.len;
+  }
+  else
+  {
+    buf = (char*)malloc(src.len + 1);
+    buflen = src.len;
+    if(buf)
+    {
+      memcpy(buf, src.data, src.len);
+      buf[src.len] = 0;
+    }
+    unmap_file(&src);
+    if(!buf)
+      return 0;
+  }
 
   *bufout = buf;
   *lenout = buflen;
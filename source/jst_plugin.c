@@ -0,0 +1,83 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <dlfcn.h>
+#include "jst_plugin.h"
+#include "jst_internal.h"
+
+/* resolve every symbol from handle into the api struct; 0 if any is missing */
+static int plugin_resolve(jst_plugin* plugin, void* handle)
+{
+  int i;
+
+  for(i = 0; i < plugin->symbol_count; ++i)
+  {
+    const jst_plugin_symbol* sym = &plugin->symbols[i];
+    void* addr = dlsym(handle, sym->name);
+
+    if(!addr && sym->fallback)
+      addr = dlsym(handle, sym->fallback);
+    if(!addr)
+      return 0;
+
+    /* stored through void* so no object to function pointer cast is needed */
+    *(void**)((char*)plugin->api + sym->offset) = addr;
+  }
+  return 1;
+}
+
+int jst_plugin_load(jst_plugin* plugin)
+{
+  const char* err;
+  int i;
+
+  if(plugin->state)
+    return plugin->state > 0;
+
+  plugin->state = -1;
+
+  if(plugin_resolve(plugin, RTLD_DEFAULT))
+  {
+    plugin->state = 1;
+    return 1;
+  }
+
+  for(i = 0; plugin->libnames[i]; ++i)
+  {
+    void* handle = dlopen(plugin->libnames[i], RTLD_NOW | RTLD_LOCAL);
+    if(!handle)
+      continue;
+
+    if(plugin_resolve(plugin, handle))
+    {
+      CosaPhpExtLog("plugin: loaded %s\n", plugin->libnames[i]);
+      plugin->handle = handle;
+      plugin->state = 1;
+      return 1;
+    }
+    dlclose(handle);
+  }
+
+  err = dlerror();
+  CosaPhpExtLog("plugin: %s not available: %s\n", plugin->libnames[0], err ? err : "missing symbols");
+  fprintf(stderr, "Error: cannot load %s\n", plugin->libnames[0]);
+  return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#ifndef JST_PLUGIN_H
+#define JST_PLUGIN_H
+
+#include <stddef.h>
+
+/*
+  Lazily loaded shared libraries. Bindings that need a heavy library
+  (libcrypto, libcurl, libintl) describe the functions they call as a
+  struct of function pointers; the library is dlopen'ed and the struct
+  filled in the first time a binding runs, so processes that never call
+  them never pay for loading and relocating the library.
+*/
+
+typedef struct jst_plugin_symbol
+{
+  const char* name;
+  const char* fallback;   /* older name of the same function, or NULL */
+  size_t offset;          /* offset of the function pointer in the api struct */
+}jst_plugin_symbol;
+
+typedef struct jst_plugin
+{
+  const char* const* libnames;        /* NULL terminated sonames, tried in order */
+  const jst_plugin_symbol* symbols;
+  int symbol_count;
+  void* api;                          /* struct of function pointers to fill in */
+  void* handle;
+  int state;                          /* 0 not tried yet, 1 loaded, -1 unavailable */
+}jst_plugin;
+
+#define JST_PLUGIN_SYMBOL(api_type, field, name, fallback) { name, fallback, offsetof(api_type, field) }
+
+/* Returns 1 when every symbol of the plugin is resolved. Symbols already
+   present in the process (e.g. gettext in the C library) are used as is,
+   otherwise the first loadable library of libnames is opened. The outcome
+   is remembered, so only the first call does any work. */
+int jst_plugin_load(jst_plugin* plugin);
+
+#endif
@@ -163,7 +163,7 @@ static int parse_content_type_header(char** boundary, int* boundary_len)
   *boundary = NULL;
   *boundary_len = 0;
 
-  stype = getenv("CONTENT_TYPE");
+  stype = jst_getenv("CONTENT_TYPE");
 
   if(stype && strstr(stype, "multipart/form-data"))
   {
@@ -919,9 +919,9 @@ duk_ret_t ccsp_post_module_open(duk_context *ctx)
   int content_type = 0;
 
   duk_push_object(ctx);
-  duk_put_function_list(ctx, -1, ccsp_post_funcs);
+  jst_put_function_list(ctx, -1, ccsp_post_funcs);
 
-  env_content_len = getenv("CONTENT_LENGTH");
+  env_content_len = jst_getenv("CONTENT_LENGTH");
   if(env_content_len)
   {
     content_len = atoi(env_content_len);
@@ -945,7 +945,7 @@ duk_ret_t ccsp_post_module_open(duk_context *ctx)
         read_len = load_debug_post_data(content_data, content_len);
       else
 #endif
-      read_len = fread(content_data, 1, content_len, stdin);
+      read_len = jst_read_body(content_data, content_len);
       content_data[content_len] = 0;
       if(read_len != content_len)
       {
@@ -962,7 +962,9 @@ duk_ret_t ccsp_post_module_open(duk_context *ctx)
         {
           process_multipart_form_data(content_data, content_len, boundary, boundary_len);
           free(boundary);
-          free(content_data);
+          /*post_data may have been pointed at content_data if there were no plain parts*/
+          if(post_data != content_data)
+            free(content_data);
         }
         else
         {
@@ -983,4 +985,19 @@ duk_ret_t ccsp_post_module_open(duk_context *ctx)
   return 1;
 }
 
-
+/* release any post/files data the script did not consume so nothing
+   carries over into the next request served by this process */
+void ccsp_post_module_close(void)
+{
+  if(post_data)
+  {
+    free(post_data);
+    post_data = NULL;
+  }
+  if(files_data)
+  {
+    free(files_data);
+    files_data = NULL;
+  }
+  file_count = 0;
+}
@@ -0,0 +1,175 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+/*
+  Byte scanning for the template parser (jst_parser.c): the tags in
+  content, the bytes of content that need escaping and the line feeds in
+  it. With SSE2 (x86) or NEON (ARM) these look at 16 or 32 bytes at a
+  time, else at one; -DJST_NO_SIMD forces the plain C versions.
+*/
+#include <stdint.h>
+#include "jst_internal.h"
+
+#if !defined(JST_NO_SIMD) && defined(__SSE2__)
+#define JST_SCAN_SSE2
+#include <emmintrin.h>
+#elif !defined(JST_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define JST_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef JST_SCAN_NEON
+/* NEON has no movemask: narrowing each 16 bit lane by 4 leaves 4 bits
+   per byte of the comparison in a 64 bit mask */
+static inline uint64_t scan_mask(uint8x16_t eq)
+{
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+#endif
+
+const char* jst_scan_pair(const char* s, const char* end, char a, char b)
+{
+#if defined(JST_SCAN_SSE2)
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+
+  while(end - s > 32)
+  {
+    __m128i x0 = _mm_loadu_si128((const __m128i*)s);
+    __m128i y0 = _mm_loadu_si128((const __m128i*)(s + 1));
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(s + 16));
+    __m128i y1 = _mm_loadu_si128((const __m128i*)(s + 17));
+    uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x0, va), _mm_cmpeq_epi8(y0, vb))) |
+                 (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x1, va), _mm_cmpeq_epi8(y1, vb))) << 16;
+
+    if(m)
+      return s + __builtin_ctz(m);
+    s += 32;
+  }
+#elif defined(JST_SCAN_NEON)
+  const uint8x16_t va = vdupq_n_u8((uint8_t)a);
+  const uint8x16_t vb = vdupq_n_u8((uint8_t)b);
+
+  while(end - s > 32)
+  {
+    uint64_t m0 = scan_mask(vandq_u8(vceqq_u8(vld1q_u8((const uint8_t*)s), va),
+                                     vceqq_u8(vld1q_u8((const uint8_t*)s + 1), vb)));
+    uint64_t m1 = scan_mask(vandq_u8(vceqq_u8(vld1q_u8((const uint8_t*)s + 16), va),
+                                     vceqq_u8(vld1q_u8((const uint8_t*)s + 17), vb)));
+
+    if(m0)
+      return s + (__builtin_ctzll(m0) >> 2);
+    if(m1)
+      return s + 16 + (__builtin_ctzll(m1) >> 2);
+    s += 32;
+  }
+#endif
+  for(; end - s > 1; ++s)
+    if(s[0] == a && s[1] == b)
+      return s;
+  return end;
+}
+
+const char* jst_scan_any(const char* s, const char* end, char a, char b, char c, char d)
+{
+#if defined(JST_SCAN_SSE2)
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  const __m128i vc = _mm_set1_epi8(c);
+  const __m128i vd = _mm_set1_epi8(d);
+
+  while(end - s >= 32)
+  {
+    __m128i x0 = _mm_loadu_si128((const __m128i*)s);
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(s + 16));
+    __m128i e0 = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x0, va), _mm_cmpeq_epi8(x0, vb)),
+                              _mm_or_si128(_mm_cmpeq_epi8(x0, vc), _mm_cmpeq_epi8(x0, vd)));
+    __m128i e1 = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x1, va), _mm_cmpeq_epi8(x1, vb)),
+                              _mm_or_si128(_mm_cmpeq_epi8(x1, vc), _mm_cmpeq_epi8(x1, vd)));
+    uint32_t m = (uint32_t)_mm_movemask_epi8(e0) | (uint32_t)_mm_movemask_epi8(e1) << 16;
+
+    if(m)
+      return s + __builtin_ctz(m);
+    s += 32;
+  }
+#elif defined(JST_SCAN_NEON)
+  const uint8x16_t va = vdupq_n_u8((uint8_t)a);
+  const uint8x16_t vb = vdupq_n_u8((uint8_t)b);
+  const uint8x16_t vc = vdupq_n_u8((uint8_t)c);
+  const uint8x16_t vd = vdupq_n_u8((uint8_t)d);
+
+  while(end - s >= 32)
+  {
+    uint8x16_t x0 = vld1q_u8((const uint8_t*)s);
+    uint8x16_t x1 = vld1q_u8((const uint8_t*)s + 16);
+    uint64_t m0 = scan_mask(vorrq_u8(vorrq_u8(vceqq_u8(x0, va), vceqq_u8(x0, vb)),
+                                     vorrq_u8(vceqq_u8(x0, vc), vceqq_u8(x0, vd))));
+    uint64_t m1 = scan_mask(vorrq_u8(vorrq_u8(vceqq_u8(x1, va), vceqq_u8(x1, vb)),
+                                     vorrq_u8(vceqq_u8(x1, vc), vceqq_u8(x1, vd))));
+
+    if(m0)
+      return s + (__builtin_ctzll(m0) >> 2);
+    if(m1)
+      return s + 16 + (__builtin_ctzll(m1) >> 2);
+    s += 32;
+  }
+#endif
+  for(; s < end; ++s)
+    if(*s == a || *s == b || *s == c || *s == d)
+      return s;
+  return end;
+}
+
+size_t jst_scan_count(const char* s, const char* end, char c)
+{
+  size_t n = 0;
+
+  /* the matches are counted in bytes, added up before those can overflow */
+#if defined(JST_SCAN_SSE2)
+  const __m128i vc = _mm_set1_epi8(c);
+
+  while(end - s >= 16)
+  {
+    __m128i acc = _mm_setzero_si128();
+    int k;
+
+    for(k = 0; k < 255 && end - s >= 16; ++k, s += 16)
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)s), vc));
+    acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+    n += (size_t)_mm_cvtsi128_si32(acc) + (size_t)_mm_extract_epi16(acc, 4);
+  }
+#elif defined(JST_SCAN_NEON)
+  const uint8x16_t vc = vdupq_n_u8((uint8_t)c);
+
+  while(end - s >= 16)
+  {
+    uint8x16_t acc = vdupq_n_u8(0);
+    uint64x2_t sum;
+    int k;
+
+    for(k = 0; k < 255 && end - s >= 16; ++k, s += 16)
+      acc = vsubq_u8(acc, vceqq_u8(vld1q_u8((const uint8_t*)s), vc));
+    sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+    n += (size_t)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+  }
+#endif
+  for(; s < end; ++s)
+    if(*s == c)
+      n++;
+  return n;
+}
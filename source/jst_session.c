@@ -96,7 +96,7 @@ static duk_ret_t session_start(duk_context *ctx)
   }
   memset(session_identifier, 0, SESSION_ID_LENGTH+1);
 
-  cookie = getenv("HTTP_COOKIE");
+  cookie = jst_getenv("HTTP_COOKIE");
   if(cookie)
   {
     CosaPhpExtLog("%s: cookie %s\n", __PRETTY_FUNCTION__, cookie);
@@ -452,6 +452,17 @@ static const duk_function_list_entry ccsp_session_funcs[] = {
 duk_ret_t ccsp_session_module_open(duk_context *ctx)
 {
   duk_push_object(ctx);
-  duk_put_function_list(ctx, -1, ccsp_session_funcs);
+  jst_put_function_list(ctx, -1, ccsp_session_funcs);
   return 1;
 }
+
+/* forget the session of the request that just finished so a long-lived
+   process never hands one client's session id to the next client */
+void ccsp_session_module_close(void)
+{
+  if(session_identifier)
+  {
+    free(session_identifier);
+    session_identifier = NULL;
+  }
+}
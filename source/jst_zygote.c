@@ -0,0 +1,284 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "jst_zygote.h"
+#include "jst_internal.h"
+
+/*
+  Fork server: the parent owns a fully initialized heap and only accepts
+  connections. Each connection is handed to a forked child, which receives
+  the jst-cgi client's argv, env and stdio fds, runs the page on its
+  copy-on-write copy of the heap and exits; nothing a request does can leak
+  into the parent or into another request.
+*/
+
+#define ZYGOTE_LISTEN_BACKLOG 64
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void zygote_stop_handler(int sig)
+{
+  (void)sig;
+  g_stop = 1;
+}
+
+static int zygote_recv_header(int fd, jst_zygote_header* header, int* fds)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr* cmsg;
+  char control[CMSG_SPACE(sizeof(int) * JST_ZYGOTE_NUM_FDS)];
+  ssize_t n;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = header;
+  iov.iov_len = sizeof(jst_zygote_header);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  do
+  {
+    n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  } while(n < 0 && errno == EINTR);
+
+  if(n != (ssize_t)sizeof(jst_zygote_header) || header->magic != JST_ZYGOTE_MAGIC)
+  {
+    CosaPhpExtLog("zygote: malformed request header\n");
+    return -1;
+  }
+
+  for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+       cmsg->cmsg_len == CMSG_LEN(sizeof(int) * JST_ZYGOTE_NUM_FDS))
+    {
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * JST_ZYGOTE_NUM_FDS);
+      return 0;
+    }
+  }
+
+  CosaPhpExtLog("zygote: request without stdio descriptors\n");
+  return -1;
+}
+
+static int zygote_read_payload(int fd, char* buf, size_t len)
+{
+  while(len)
+  {
+    ssize_t n = read(fd, buf, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* split 'count' NUL terminated strings out of the payload into a NULL terminated vector */
+static char** zygote_split_strings(char** cursor, char* end, uint32_t count)
+{
+  char** vec;
+  uint32_t i;
+
+  if(count > JST_ZYGOTE_MAX_PAYLOAD)
+    return NULL;
+
+  vec = (char**)calloc(count + 1, sizeof(char*));
+  if(!vec)
+    return NULL;
+
+  for(i = 0; i < count; ++i)
+  {
+    char* nul = memchr(*cursor, 0, end - *cursor);
+    if(!nul)
+    {
+      free(vec);
+      return NULL;
+    }
+    vec[i] = *cursor;
+    *cursor = nul + 1;
+  }
+  return vec;
+}
+
+static void zygote_child(int cfd, jst_zygote_handler handler, void* udata)
+{
+  extern char** environ;
+  jst_zygote_header header;
+  int fds[JST_ZYGOTE_NUM_FDS];
+  char* payload;
+  char* cursor;
+  char** argv;
+  char** envp;
+  int32_t status;
+  int i;
+
+  if(zygote_recv_header(cfd, &header, fds) != 0)
+    _exit(1);
+
+  if(header.payload_len > JST_ZYGOTE_MAX_PAYLOAD)
+  {
+    CosaPhpExtLog("zygote: request payload too large %u\n", header.payload_len);
+    _exit(1);
+  }
+
+  payload = (char*)malloc(header.payload_len + 1);
+  if(!payload || zygote_read_payload(cfd, payload, header.payload_len) != 0)
+    _exit(1);
+  payload[header.payload_len] = 0;
+
+  cursor = payload;
+  argv = zygote_split_strings(&cursor, payload + header.payload_len, header.argc);
+  envp = zygote_split_strings(&cursor, payload + header.payload_len, header.envc);
+  if(!argv || !envp || header.argc == 0)
+  {
+    CosaPhpExtLog("zygote: malformed request payload\n");
+    _exit(1);
+  }
+
+  for(i = 0; i < JST_ZYGOTE_NUM_FDS; ++i)
+  {
+    if(dup2(fds[i], i) < 0)
+      _exit(1);
+    close(fds[i]);
+  }
+
+  environ = envp;
+
+  status = handler((int)header.argc, argv, udata);
+
+  fflush(stdout);
+  fflush(stderr);
+
+  if(write(cfd, &status, sizeof(status)) != sizeof(status))
+    CosaPhpExtLog("zygote: failed to report exit status\n");
+
+  _exit(status);
+}
+
+/* the directory of the socket, created if needed, must be ours alone */
+static int zygote_private_dir(const char* socket_path)
+{
+  char dir[PATH_MAX];
+  char* slash;
+  struct stat st;
+
+  if(snprintf(dir, sizeof(dir), "%s", socket_path) >= (int)sizeof(dir))
+  {
+    fprintf(stderr, "Error: socket path too long:%s\n", socket_path);
+    return 0;
+  }
+  slash = strrchr(dir, '/');
+  if(!slash)
+    strcpy(dir, ".");
+  else if(slash == dir)
+    dir[1] = 0;
+  else
+    *slash = 0;
+
+  if(mkdir(dir, 0700) != 0 && errno != EEXIST)
+  {
+    fprintf(stderr, "Error: cannot create %s error:%s\n", dir, strerror(errno));
+    return 0;
+  }
+  if(lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+     st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+  {
+    fprintf(stderr, "Error: %s must be a directory of this user that no one else can write to\n", dir);
+    return 0;
+  }
+  return 1;
+}
+
+int jst_zygote_run(const char* socket_path, jst_zygote_handler handler, void* udata)
+{
+  struct sigaction sa;
+  int lfd;
+
+  if(!zygote_private_dir(socket_path))
+    return 1;
+
+  lfd = listen_unix_socket(socket_path, ZYGOTE_LISTEN_BACKLOG);
+  if(lfd < 0)
+    return 1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = zygote_stop_handler;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+
+  /* children report their status to the client themselves; let the kernel reap them */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_IGN;
+  sa.sa_flags = SA_NOCLDWAIT;
+  sigaction(SIGCHLD, &sa, NULL);
+
+  CosaPhpExtLog("zygote: listening on %s\n", socket_path);
+
+  while(!g_stop)
+  {
+    pid_t pid;
+    int cfd = accept(lfd, NULL, NULL);
+
+    if(cfd < 0)
+    {
+      if(errno != EINTR)
+        CosaPhpExtLog("zygote: accept failed: %s\n", strerror(errno));
+      continue;
+    }
+
+    /* nothing buffered in the parent may be written twice by the child */
+    fflush(stdout);
+    fflush(stderr);
+
+    pid = fork();
+    if(pid == 0)
+    {
+      close(lfd);
+      signal(SIGTERM, SIG_DFL);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGCHLD, SIG_DFL);
+      zygote_child(cfd, handler, udata);
+    }
+    else if(pid < 0)
+    {
+      CosaPhpExtLog("zygote: fork failed: %s\n", strerror(errno));
+    }
+    close(cfd);
+  }
+
+  close(lfd);
+  unlink(socket_path);
+  return 0;
+}
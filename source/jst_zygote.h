@@ -0,0 +1,73 @@
+/*
+ If not stated otherwise in this file or this component's Licenses.txt file the
+ following copyright and licenses apply:
+
+ Copyright 2018 RDK Management
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+#ifndef JST_ZYGOTE_H
+#define JST_ZYGOTE_H
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+  Wire protocol between jst-cgi and the jst --zygote daemon (unix stream socket):
+
+  client -> zygote: one jst_zygote_header sent with SCM_RIGHTS carrying the
+                    client's stdin, stdout and stderr, followed by
+                    'payload_len' bytes holding argc argv strings then envc
+                    env strings, every string NUL terminated
+  zygote -> client: int32 exit status of the forked request process
+*/
+
+#define JST_ZYGOTE_MAGIC          0x4a53545aU /* "JSTZ" */
+#define JST_ZYGOTE_MAX_PAYLOAD    (256 * 1024)
+#define JST_ZYGOTE_NUM_FDS        3
+
+/* The socket's directory must belong to the zygote's user and be writable
+   by no one else (jst_zygote_run checks it), and jst-cgi only talks to a
+   zygote run by root or its own user (SO_PEERCRED): in a directory like
+   /tmp anyone could bind the path first and be sent the requests. */
+#ifndef JST_ZYGOTE_SOCKET
+#define JST_ZYGOTE_SOCKET         "/var/run/jst/zygote.sock"
+#endif
+
+typedef struct jst_zygote_header
+{
+  uint32_t magic;
+  uint32_t payload_len;
+  uint32_t argc;
+  uint32_t envc;
+}jst_zygote_header;
+
+/* Called in the forked child with stdin/stdout/stderr and the environment
+   of the jst-cgi client installed. The return value becomes the exit status. */
+typedef int (*jst_zygote_handler)(int argc, char** argv, void* udata);
+
+/* Listen on socket_path and fork a child per request until SIGTERM/SIGINT.
+   Everything set up before the call (the warm heap) is inherited by the
+   children copy-on-write. The directory of socket_path is created 0700 if
+   it doesn't exist. Returns non-zero if the socket could not be set up,
+   or its directory is not private to this user. */
+int jst_zygote_run(const char* socket_path, jst_zygote_handler handler, void* udata);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
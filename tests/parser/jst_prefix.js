@@ -16,46 +16,58 @@
  See the License for the specific language governing permissions and
  limitations under the License.
 */
+/* PRELUDE: compiled once and run before every page by the native page
+            driver (jst_run_page), which also calls _jst_finish */
 
-try
-{
 /* HEADERS: accumulate headers into a buffer
             to send to stdout in _jst_finish*/
-_jst_header_buffer = "Content-type: text/html";
+_jst_header_content_type_set = false;
+_jst_header_buffer = "";
 function header(str)
 {
-  if(str.toLowerCase().indexOf('location:') == 0)
+  lstr = str.toLowerCase();
+  if(lstr.indexOf('location:') == 0)
   {
     _jst_header_buffer = "HTTP/1.0 302 Ok\r\n";
     _jst_header_buffer += "Status: 302 Moved\r\n";
-    _jst_header_buffer += str;
+    _jst_header_buffer += str + "\r\n";
   }
   else
   {
-    _jst_header_buffer += "\n" + str;
+    if(lstr.indexOf('content-type:') == 0)
+    {
+      _jst_header_content_type_set = true;
+      if(lstr.indexOf('application/json') != -1)
+        _jst_header_buffer += "Content-Type: text/html\r\n";
+    }
+    _jst_header_buffer += str + "\r\n";
   }
 }
 
-/* ECHO: accumulate main content into a buffer
-         to send to stdout in _jst_finish */
-_jst_echo_buffer = "";
-function echo(str)
+/* ECHO: echo(), _jst_echo() and _jst_static() are native (jst_output.c)
+         and accumulate the content in a buffer sent in _jst_finish */
+
+/* PREFETCH: the parser starts a run page with a call listing the data
+             model parameters it reads with getStr("literal"); they are
+             fetched in a few bus calls before the page runs */
+function _jst_prefetch(names)
 {
-  _jst_echo_buffer += str;
+  if(typeof ccsp_cosa != "undefined" && ccsp_cosa.prefetch)
+    ccsp_cosa.prefetch(names);
 }
 
 /* FINISH: _jst_finish is called at the very end of the script 
            and it will send the headers and content to stdout */
 function _jst_finish()
 {
-  print(_jst_header_buffer);
-  print("\r\n\r\n\n");
-  print(_jst_echo_buffer);
+  if(!_jst_header_content_type_set)
+    print("Content-type: text/html\r");
+  _jst_flush(_jst_header_buffer + "\r\n");
 }
 
 /* EXIT: there is no way to simply quit in the middle of a script, so
-         we throw an exception which will be caught in ccsp_builtin_suffix.js
-         and that will call _jst_finish to write our content */
+         we throw an exception which the page driver catches before it
+         calls _jst_finish to write our content */
 function _jst_exit_exception(code)
 {
   this._jst_exit_code = code;
@@ -80,12 +92,51 @@ var $_SERVER = new Proxy({}, {
 /* SESSION: session data set by web app, saved to disk, and referenced by session id stored in cookie */
 var $_SESSION = {};
 var $_jst_session = null;
+var $_val_input = {};
 function session_start()
 {
   if($_jst_session)
     return;
+  if($_val_input == 1) 
+  {
+    $_val_input = 0;
+    return;
+  }
   ccsp_session.start();
-  header("Set-Cookie: DUKSID=" + ccsp_session.getId() + ";");
+  var host = getenv('HTTPS');
+  if (host == false)
+      var $cookie = "Set-Cookie: DUKSID=" + ccsp_session.getId() + "; httponly";
+  else
+      var $cookie = "Set-Cookie: DUKSID=" + ccsp_session.getId() + "; secure" + "; httponly";
+  header($cookie);
+  $_jst_session = ccsp_session.getData();
+  $_SESSION = new Proxy($_jst_session, {
+    get: function(obj, prop) {
+      return obj[prop];
+    },
+    set: function(obj, prop, val){
+      obj[prop] = val;
+      ccsp_session.setData(obj);
+      return true;
+    },
+    deleteProperty(obj, prop) {
+      if(prop in obj)
+      {
+        delete obj[prop];
+        ccsp_session.setData(obj);
+      }
+      return true;
+    }
+  });
+}
+function session_create(){
+  ccsp_session.create();
+  var host = getenv('HTTPS');
+  if (host == false)
+    var $cookie = "Set-Cookie: DUKSID=" + ccsp_session.getId() + "; httponly";
+  else
+    var $cookie = "Set-Cookie: DUKSID=" + ccsp_session.getId() + "; secure" + "; httponly";
+  header($cookie);
   $_jst_session = ccsp_session.getData();
   $_SESSION = new Proxy($_jst_session, {
     get: function(obj, prop) {
@@ -131,24 +182,82 @@ function session_print()
     print($k + "=" + $_jst_session[$k]);
 }
 
+/* LAZY GLOBALS: computed on first access, so a page that never looks at
+   $_POST/$_FILES never reads or parses the request body */
+function _jst_lazy_global(global, name, init)
+{
+  function define(value)
+  {
+    Object.defineProperty(global, name, { value: value, writable: true, enumerable: true, configurable: true });
+  }
+  Object.defineProperty(global, name, {
+    get: function() { var value = init(); define(value); return value; },
+    set: define,
+    enumerable: true,
+    configurable: true
+  });
+}
+
 /* POST: post data sent in via stdin */
-$_POST={};
-var postData = ccsp_post.getPost();
-if(postData)
+_jst_lazy_global(this, "$_POST", function()
 {
-  var postValues = postData.split('&');
-  for(var i = 0; i < postValues.length; ++i)
+  var post = {};
+  var postData = ccsp_post.getPost();
+  if(postData)
   {
-    var postValue = postValues[i].split('=');
-    if(postValue.length == 2)
+    var postValues = postData.split('&');
+    for(var i = 0; i < postValues.length; ++i)
     {
-      var value = postValue[1].replace(/[+]/g," ");
-      $_POST[postValue[0]] = decodeURIComponent(value);
+      var postValue = postValues[i].split('=');
+      if(postValue.length == 2)
+      {
+        var value = postValue[1].replace(/[+]/g," ");
+        post[postValue[0]] = decodeURIComponent(value);
+      }
+      else
+      {
+        print("unexpected post data");
+        $_val_input = 1;
+      }
     }
-    else
-      print("unexpected post data");
   }
-}
+  return post;
+});
+
+/* FILES: multipart/form-data files via stdin */
+_jst_lazy_global(this, "$_FILES", function()
+{
+  var files = {};
+  var filesData = ccsp_post.getFiles();
+  if(filesData)
+  {
+    var fileList = filesData.split(';');
+    for(var i = 0; i < fileList.length; ++i)
+    {
+      var fileData = fileList[i].split('&');
+      var fileId = null;
+      for(var j = 0; j < fileData.length; ++j)
+      {
+        var fileValue = fileData[j].split('=');
+        if(fileValue.length == 2)
+        {
+          if(!fileId)
+          {
+            fileId = decodeURIComponent(fileValue[1]);
+            files[fileId]={};
+          }
+          else
+          {
+            files[fileId][decodeURIComponent(fileValue[0])]=decodeURIComponent(fileValue[1]);
+          }
+        }
+        else
+          print("unexpected file data");
+      }
+    }
+  }
+  return files;
+});
 
 /* GET: query parameters */
 $_GET= (function ()
@@ -175,4 +284,3 @@ function include($filepath)
 }
 
 /* begin application code */
-
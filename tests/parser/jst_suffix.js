@@ -17,22 +17,7 @@
  limitations under the License.
 */
 
-/* end application code */
-exit(0);
-}
-catch(err)
-{
-  if(typeof(err._jst_exit_code) !== 'undefined')
-  {
-    _jst_finish();
-  }
-  else
-  {
-    print("<html><body>");
-    if(typeof(err.stack) === 'string')
-      print(err.stack.replace(/\n/g, "<br/>\n") + "<br/>");
-    else
-      print(err);
-    print("</body></html>");
-  } 
-}
+/* end application code
+
+   Only used by 'jst --parse-only'. When a page is run, the page driver
+   (jst_run_page) calls _jst_finish after it, or after exit(). */
@@ -21,6 +21,9 @@
 #include <fstream>
 #include <streambuf>
 #include "jst.h"
+extern "C" {
+#include "jst_internal.h"
+}
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -106,6 +109,178 @@ TEST(general, parser) {
   }
 }
 
+/* a gettext .mo catalog of the msgid/msgstr pairs, which must be sorted by msgid */
+static void writeCatalog(const string& path, const vector<pair<string, string> >& entries)
+{
+  uint32_t count = entries.size();
+  uint32_t orig = 28;
+  uint32_t trans = orig + count * 8;
+  uint32_t data = trans + count * 8;
+  uint32_t header[7] = { 0x950412de, 0, count, orig, trans, 0, data };
+  string tables;
+  string strings;
+
+  for(int table = 0; table < 2; ++table)
+  {
+    for(auto entry: entries)
+    {
+      const string& str = table ? entry.second : entry.first;
+      uint32_t desc[2] = { (uint32_t)str.length(), data + (uint32_t)strings.length() };
+      tables.append((const char*)desc, sizeof(desc));
+      strings.append(str.c_str(), str.length() + 1);
+    }
+  }
+
+  std::ofstream out(path.c_str(), std::ios::binary);
+  out.write((const char*)header, sizeof(header));
+  out << tables << strings;
+}
+
+/* _() and ccsp.gettext() with a literal are folded at compile time in a
+   run page when the catalog has the msgid, else left to run time. The
+   catalog is read on first use (jst_i18n.c), so no test before this one
+   may parse a run page. */
+TEST(general, i18n) {
+  char dir[] = "/tmp/jst_i18n_XXXXXX";
+  char* buffer;
+  size_t length;
+
+  ASSERT_NE(mkdtemp(dir), (char*)NULL);
+  string messages = string(dir) + "/de";
+  ASSERT_EQ(mkdir(messages.c_str(), 0700), 0);
+  messages += "/LC_MESSAGES";
+  ASSERT_EQ(mkdir(messages.c_str(), 0700), 0);
+  writeCatalog(messages + "/jsttest.mo", { { "Cancel", "Abbrechen" }, { "Save", "Speichern" } });
+
+  setenv("JST_TEXTDOMAIN", "jsttest", 1);
+  setenv("JST_LOCALEDIR", dir, 1);
+  setenv("LANGUAGE", "de", 1);
+
+  ASSERT_NE(load_template_file("i18n/jst_i18n_translate.jst", &buffer, &length, LOAD_TEMPLATE_BODY), 0);
+  BufferFreer freer(buffer);
+  string code(buffer, length);
+
+  EXPECT_NE(code.find("Speichern"), string::npos);
+  EXPECT_EQ(code.find("_(\"Save\")"), string::npos);
+  EXPECT_NE(code.find("'Abbrechen'"), string::npos);
+  EXPECT_EQ(code.find("gettext"), string::npos);
+  EXPECT_NE(code.find("_(\"Not in the catalog\")"), string::npos);
+
+  unlink((messages + "/jsttest.mo").c_str());
+  rmdir(messages.c_str());
+  rmdir((string(dir) + "/de").c_str());
+  rmdir(dir);
+}
+
+/* the plain C versions of jst_scan.c, to check the SSE2/NEON ones against */
+static const char* scanPair(const char* s, const char* end, char a, char b)
+{
+  for(; end - s > 1; ++s)
+    if(s[0] == a && s[1] == b)
+      return s;
+  return end;
+}
+
+static const char* scanAny(const char* s, const char* end, char a, char b, char c, char d)
+{
+  for(; s < end; ++s)
+    if(*s == a || *s == b || *s == c || *s == d)
+      return s;
+  return end;
+}
+
+static size_t scanCount(const char* s, const char* end, char c)
+{
+  size_t n = 0;
+  for(; s < end; ++s)
+    if(*s == c)
+      n++;
+  return n;
+}
+
+/* a match at every offset of buffers up to 3 chunks of 32 long, so around
+   15/16/31/32 and at the end, with the buffer start both aligned and not */
+TEST(general, scan) {
+  char buffer[128];
+
+  for(int start = 0; start < 2; ++start)
+  {
+    for(int len = 0; len <= 96; ++len)
+    {
+      const char* s = buffer + start;
+      const char* end = s + len;
+
+      for(int pos = -1; pos < len; ++pos)
+      {
+        memset(buffer, 'x', sizeof(buffer));
+        if(pos >= 0)
+        {
+          buffer[start + pos] = '<';
+          if(pos + 1 < len)
+            buffer[start + pos + 1] = '?';
+        }
+        /* a first byte of the pair without the second before the match */
+        if(pos > 0)
+          buffer[start + pos - 1] = '<';
+        EXPECT_EQ(jst_scan_pair(s, end, '<', '?'), scanPair(s, end, '<', '?')) << "len " << len << " pos " << pos;
+        EXPECT_EQ(jst_scan_any(s, end, '\'', '\\', '\n', '?'), scanAny(s, end, '\'', '\\', '\n', '?')) << "len " << len << " pos " << pos;
+        EXPECT_EQ(jst_scan_count(s, end, '<'), scanCount(s, end, '<')) << "len " << len << " pos " << pos;
+      }
+    }
+  }
+
+  /* more matches than the byte counters of jst_scan_count hold */
+  string lines(255 * 16 * 2 + 7, '\n');
+  lines[100] = 'x';
+  EXPECT_EQ(jst_scan_count(lines.data(), lines.data() + lines.length(), '\n'),
+            scanCount(lines.data(), lines.data() + lines.length(), '\n'));
+}
+
+/* more paths than the first index holds (16 in 32 slots), so it grows
+   while paths are added; the order and the include once checks must
+   survive that, and load_template_reset must forget them all */
+TEST(general, registry) {
+  const int count = 100;
+  char path[64];
+
+  load_template_reset();
+  for(int i = 0; i < count; ++i)
+  {
+    snprintf(path, sizeof(path), "/www/include/file%d.jst", i);
+    EXPECT_EQ(load_template_included(path), 0) << path;
+    EXPECT_NE(load_template_mark_included(path), 0) << path;
+  }
+
+  /* a path marked again is not added twice */
+  EXPECT_NE(load_template_mark_included("/www/include/file0.jst"), 0);
+
+  for(int i = 0; i < count; ++i)
+  {
+    snprintf(path, sizeof(path), "/www/include/file%d.jst", i);
+    EXPECT_NE(load_template_included(path), 0) << path;
+    ASSERT_NE(load_template_registry(i), (const char*)NULL) << i;
+    EXPECT_STREQ(load_template_registry(i), path);
+  }
+  EXPECT_EQ(load_template_registry(count), (const char*)NULL);
+  EXPECT_EQ(load_template_included("/www/include/file100.jst"), 0);
+  EXPECT_STREQ(load_template_page(), "/www/include/file0.jst");
+
+  load_template_reset();
+  EXPECT_EQ(load_template_registry(0), (const char*)NULL);
+  EXPECT_STREQ(load_template_page(), "");
+  for(int i = 0; i < count; ++i)
+  {
+    snprintf(path, sizeof(path), "/www/include/file%d.jst", i);
+    EXPECT_EQ(load_template_included(path), 0) << path;
+  }
+
+  /* the next page starts its registry from the first path */
+  EXPECT_NE(load_template_mark_included("/www/include/file42.jst"), 0);
+  EXPECT_STREQ(load_template_registry(0), "/www/include/file42.jst");
+  EXPECT_EQ(load_template_registry(1), (const char*)NULL);
+  load_template_reset();
+}
+
 int main(int argc, char* argv[])
 {
   ::testing::InitGoogleTest(&argc, argv);
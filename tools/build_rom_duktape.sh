@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# If not stated otherwise in this file or this component's Licenses.txt file the
+# following copyright and licenses apply:
+#
+# Copyright 2018 RDK Management
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Generates the Duktape sources for the JST_ROM_BUILTINS cmake option: the
+# built-in objects and strings become read-only data in the binary instead
+# of being created on the heap of every process, and built-in functions
+# become lightfuncs.
+#
+# The names used by php.jst, the prelude and the ccsp modules are added as
+# ROM strings so pages don't intern them again. The php.jst and prelude
+# functions themselves stay ECMAScript: Duktape can only put native
+# functions in ROM. They are compiled once per process (jst_cache.c).
+#
+# usage: build_rom_duktape.sh DUKTAPE_SRC OUTDIR
+#   DUKTAPE_SRC  unpacked duktape-2.3.0 release (has tools/configure.py;
+#                needs python2 with PyYAML)
+#   OUTDIR       duktape.c, duktape.h and duk_config.h are written to OUTDIR/src
+
+DUKTAPE_SRC=$1
+OUTDIR=$2
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ -z "$DUKTAPE_SRC" ] || [ -z "$OUTDIR" ]; then
+  echo "usage: $0 DUKTAPE_SRC OUTDIR" >&2
+  exit 1
+fi
+if [ ! -f "$DUKTAPE_SRC/tools/configure.py" ]; then
+  echo "Error: $DUKTAPE_SRC/tools/configure.py not found" >&2
+  exit 1
+fi
+
+mkdir -p "$OUTDIR" || exit 1
+STRINGS="$OUTDIR/jst_rom_strings.yaml"
+
+{
+  echo "# generated by build_rom_duktape.sh"
+  echo "add_forced_strings:"
+  {
+    # php.jst and prelude functions and prelude globals
+    grep -ohE 'function +[$A-Za-z_][$A-Za-z0-9_]*' "$TOP/jsts/php.jst" "$TOP/jsts/jst_prefix.js" |
+      sed -E 's/^function +//'
+    grep -ohE '^(var +)?[$A-Za-z_][$A-Za-z0-9_]* *=' "$TOP/jsts/jst_prefix.js" |
+      sed -E 's/^var +//; s/ *=$//'
+    # ccsp module bindings (duk_function_list_entry names)
+    grep -ohE '\{ *"[A-Za-z_][A-Za-z0-9_]*" *,' "$TOP"/source/jst_*.c |
+      sed -E 's/^\{ *"//; s/" *,$//'
+  } | sort -u | sed 's/.*/  - str: "&"/'
+} > "$STRINGS" || exit 1
+
+rm -rf "$OUTDIR/src"
+${PYTHON:-python2} "$DUKTAPE_SRC/tools/configure.py" \
+  --output-directory "$OUTDIR/src" \
+  --rom-support \
+  --rom-auto-lightfunc \
+  --builtin-file "$STRINGS" \
+  -DDUK_USE_ROM_OBJECTS \
+  -DDUK_USE_ROM_STRINGS \
+  -DDUK_USE_ROM_GLOBAL_INHERIT \
+  -DDUK_USE_PROMISE_BUILTIN
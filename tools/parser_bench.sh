@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# If not stated otherwise in this file or this component's Licenses.txt file the
+# following copyright and licenses apply:
+#
+# Copyright 2018 RDK Management
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Measures the template parser: times 'jst --parse-only' on synthetic
+# templates doubling in size up to the given one and prints the time per
+# KB of template for each, which stays flat while parsing is linear in the
+# template size. The templates are rows of content and code blocks using
+# a variable named includes, which the parser has to tell apart from an
+# include() it must expand. Needs the installed jst_prefix.js.
+#
+# usage: parser_bench.sh [path/to/jst] [size in KB]
+
+JST=${1:-/usr/sbin/jst}
+MAX=${2:-1024}
+
+if [ ! -x "$JST" ]; then
+  echo "Error: $JST is not executable" >&2
+  exit 1
+fi
+case $JST in /*) ;; *) JST=$PWD/$JST ;; esac
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+SIZE=$((MAX / 8))
+[ $SIZE -lt 1 ] && SIZE=1
+while [ $SIZE -le $MAX ]; do
+  awk -v size=$((SIZE * 1024)) 'BEGIN {
+    print "<table>"
+    for(n = 0; len < size; ++n) {
+      row = sprintf("<tr><td>%d</td><td><?%%= rows[%d].name ?></td><td><?%%= rows[%d].value ?></td></tr>\n<?%%\n  // the includes of row %d\n  var includes = rows[%d].includes || [];\n  total += includes.length;\n?>\n", n, n, n, n, n)
+      printf "%s", row
+      len += length(row)
+    }
+    print "</table>"
+  }' > bench.jst
+
+  # once to warm the page cache, then timed
+  "$JST" --parse-only bench.jst > /dev/null 2>&1
+  START=$(date +%s%N)
+  "$JST" --parse-only bench.jst > /dev/null 2>&1
+  END=$(date +%s%N)
+
+  US=$(( (END - START) / 1000 ))
+  echo "$SIZE KB: $US us, $((US / SIZE)) us per KB"
+  SIZE=$((SIZE * 2))
+done
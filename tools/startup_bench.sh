@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# If not stated otherwise in this file or this component's Licenses.txt file the
+# following copyright and licenses apply:
+#
+# Copyright 2018 RDK Management
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Measures jst process startup: runs a trivial page N times as a CGI would
+# and prints the average wall time per request.
+#
+# usage: startup_bench.sh [path/to/jst] [iterations] [jst options...]
+
+JST=${1:-/usr/sbin/jst}
+N=${2:-200}
+[ $# -gt 2 ] && shift 2 || set --
+
+if [ ! -x "$JST" ]; then
+  echo "Error: $JST is not executable" >&2
+  exit 1
+fi
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+echo '<?% echo("ok"); ?>' > "$DIR/bench.jst"
+# old enough for the bytecode cache to keep it
+touch -t 200001010000 "$DIR/bench.jst"
+
+export GATEWAY_INTERFACE=CGI/1.1
+export REQUEST_METHOD=GET
+export QUERY_STRING=
+export SCRIPT_NAME=/bench.jst
+export SCRIPT_FILENAME="$DIR/bench.jst"
+
+# warm the page cache before timing
+"$JST" "$@" "$DIR/bench.jst" > /dev/null 2>&1
+
+START=$(date +%s%N)
+i=0
+while [ $i -lt "$N" ]; do
+  "$JST" "$@" "$DIR/bench.jst" > /dev/null 2>&1
+  i=$((i + 1))
+done
+END=$(date +%s%N)
+
+echo "$N runs, $(( (END - START) / N / 1000 )) us per request"